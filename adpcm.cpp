@@ -0,0 +1,148 @@
+#include <string.h>
+
+#include "audio.h"
+#include "mixer.h"
+
+
+const u16 s_adpcm_steps[89] =
+{
+        7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+       19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+       50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+     2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+     5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const s8 s_adpcm_index[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+
+// ---------------------------------------------------------------------------
+
+static inline s32 S_AdpcmDiff(s32 index, u8 code)
+{
+    s32 step = s_adpcm_steps[index];
+    s32 diff = step >> 3;
+
+    if (code & 1) diff += step >> 2;
+    if (code & 2) diff += step >> 1;
+    if (code & 4) diff += step;
+
+    return code & 8 ? -diff : diff;
+}
+
+static inline void S_AdpcmStep(s32 *pred, s32 *index, u8 code)
+{
+    *pred += S_AdpcmDiff(*index, code);
+    *pred = *pred < -32768 ? -32768 : *pred > 32767 ? 32767 : *pred;
+
+    *index += s_adpcm_index[code & 7];
+    *index = *index < 0 ? 0 : *index > 88 ? 88 : *index;
+}
+
+// the code whose step lands closest below the difference, as usual for IMA
+static inline u8 S_AdpcmCode(s32 pred, s32 index, s32 sample)
+{
+    s32 step = s_adpcm_steps[index];
+    s32 diff = sample - pred;
+    u8 code = 0;
+
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    if (diff >= step) { code |= 4; diff -= step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; }
+    step >>= 1;
+    if (diff >= step) { code |= 1; }
+
+    return code;
+}
+
+
+// ---------------------------------------------------------------------------
+
+u32 S_AdpcmSize(u32 num_frames)
+{
+    return (num_frames + S_ADPCM_BLOCK_FRAMES - 1) / S_ADPCM_BLOCK_FRAMES * S_ADPCM_BLOCK_BYTES;
+}
+
+void S_EncodeAdpcm(const s16 *frames, u32 num_frames, u8 *out)
+{
+    s32 index = 0;
+
+    for (u32 start = 0; start < num_frames; start += S_ADPCM_BLOCK_FRAMES) {
+        u8 *block = out + start / S_ADPCM_BLOCK_FRAMES * S_ADPCM_BLOCK_BYTES;
+        u32 n = num_frames - start < S_ADPCM_BLOCK_FRAMES ? num_frames - start : S_ADPCM_BLOCK_FRAMES;
+
+        // every block starts exactly on its first frame, the step size
+        // carries over from the block before
+        s32 pred = frames[start];
+
+        block[0] = (u8)(pred & 0xFF);
+        block[1] = (u8)((pred >> 8) & 0xFF);
+        block[2] = (u8)index;
+        block[3] = 0;
+
+        memset(block + 4, 0, S_ADPCM_BLOCK_BYTES - 4);
+
+        for (u32 k = 1; k < S_ADPCM_BLOCK_FRAMES; k++) {
+            // the short last block holds its last frame to the end
+            s32 sample = frames[start + (k < n ? k : n - 1)];
+            u8 code = S_AdpcmCode(pred, index, sample);
+
+            block[4 + (k - 1) / 2] |= (k - 1) & 1 ? code << 4 : code;
+            S_AdpcmStep(&pred, &index, code);
+        }
+    }
+}
+
+// the difference and next step index for every step index and code,
+// decoding is then a lookup, an add and a clamp per frame
+static s32 s_adpcm_diff[89][16];
+static u8 s_adpcm_next[89][16];
+
+static struct s_adpcm_tables
+{
+    s_adpcm_tables()
+    {
+        for (s32 index = 0; index < 89; index++) {
+            for (u8 code = 0; code < 16; code++) {
+                s32 next = index + s_adpcm_index[code & 7];
+
+                s_adpcm_diff[index][code] = S_AdpcmDiff(index, code);
+                s_adpcm_next[index][code] = (u8)(next < 0 ? 0 : next > 88 ? 88 : next);
+            }
+        }
+    }
+} s_adpcm_tables_init;
+
+void S_DecodeAdpcmBlock(const u8 *block, s16 *frames)
+{
+    s32 pred = (s16)(block[0] | block[1] << 8);
+    u32 index = block[2] > 88 ? 88 : block[2];
+
+    frames[0] = (s16)pred;
+
+    for (u32 k = 1; k < S_ADPCM_BLOCK_FRAMES; k += 2) {
+        u8 byte = block[4 + (k - 1) / 2];
+
+        pred += s_adpcm_diff[index][byte & 0xF];
+        pred = pred < -32768 ? -32768 : pred > 32767 ? 32767 : pred;
+        index = s_adpcm_next[index][byte & 0xF];
+        frames[k] = (s16)pred;
+
+        // the odd frame count leaves the last high nibble unused
+        if (k + 1 < S_ADPCM_BLOCK_FRAMES) {
+            pred += s_adpcm_diff[index][byte >> 4];
+            pred = pred < -32768 ? -32768 : pred > 32767 ? 32767 : pred;
+            index = s_adpcm_next[index][byte >> 4];
+            frames[k + 1] = (s16)pred;
+        }
+    }
+}
@@ -13,35 +13,15 @@
 
 #include "audio.h"
 
-struct s_voice_state
+struct s_output_state
 {
-    AUNode varispeed_node;
-    AudioUnit au_varispeed;
-    
-    u8 sample_format;
-    u32 sample_pos;
-    u32 sample_length;
-    u8 sample_loop_type;
-    u32 sample_loop_start;
-    u32 sample_loop_end;
-    void *sample_data;
-};
+    S_render_func_t render;
 
-struct s_soundsystem_state
-{
     AUGraph au_graph;
     
-    AUNode mixer_node;
-    AudioUnit au_mixer;
-    
     AUNode output_node;
     AudioUnit au_output;
-    
-    int mixing_rate;
-    
-    int num_voices;
-    struct s_voice_state *voices;
-} ss;
+} so;
 
 
 
@@ -54,39 +34,31 @@ OSStatus S_RenderAudioCallback(void *inRefCon,
                                UInt32 inNumberFrames, 
                                AudioBufferList *ioData)
 {
-    float *buffer = (float*)ioData->mBuffers[0].mData;
+    float *left = (float*)ioData->mBuffers[0].mData;
+    float *right = (float*)ioData->mBuffers[1].mData;
 
-    s_voice_state *voice = &ss.voices[(long)inRefCon];
-    
-    if (!voice->sample_data) {
-        memset(buffer, 0, sizeof(float) * inNumberFrames);
-    } else {
-        for (int k = 0; k < inNumberFrames; k++) {
-            if (voice->sample_loop_type && voice->sample_pos > voice->sample_loop_end) {
-                voice->sample_pos = voice->sample_loop_start;
-            }
-        
-            if (voice->sample_pos < voice->sample_length) {
-                if (voice->sample_format == 1) {
-                    s8* sample_buffer = (s8*)voice->sample_data;
-                    buffer[k] = (float)sample_buffer[voice->sample_pos] / 127.0f;
-                } else if (voice->sample_format == 2) {
-                    s16* sample_buffer = (s16*)voice->sample_data;
-                    buffer[k] = (float)sample_buffer[voice->sample_pos] / 32767.0f;
-                }
-            
-                voice->sample_pos++;
-            } else {
-                buffer[k] = 0.0f;
-            }
-        }
+    // a render thread records its own health
+    if (so.render) {
+        so.render(left, right, inNumberFrames);
+        return noErr;
     }
 
-    // copy data from channel 0 into the other channels
-    for (int i = 1; i < ioData->mNumberBuffers; i++) {
-        memcpy(ioData->mBuffers[i].mData, ioData->mBuffers[0].mData, ioData->mBuffers[0].mDataByteSize);
-        ioData->mBuffers[i].mDataByteSize = ioData->mBuffers[0].mDataByteSize;
-    }
+    u64 t0 = S_GetTimeNanos();
+    
+    S_RenderFrames(left, right, inNumberFrames);
+    
+    S_HealthRecordRender(S_GetTimeNanos() - t0, inNumberFrames, S_GetActiveVoices());
+    
+    return noErr;
+}
+
+OSStatus S_OverloadListener(AudioObjectID inObjectID,
+                            UInt32 inNumberAddresses,
+                            const AudioObjectPropertyAddress *inAddresses,
+                            void *inClientData)
+{
+    // the device ran dry before the callback delivered
+    S_HealthRecordUnderrun();
     
     return noErr;
 }
@@ -96,30 +68,7 @@ OSStatus S_RenderAudioCallback(void *inRefCon,
 
 void S_CreateAUGraph()
 {
-    NewAUGraph(&ss.au_graph);
-    
-    // create varispeed units
-    ComponentDescription variCD;
-    variCD.componentFlags = 0;
-    variCD.componentFlagsMask = 0;
-    variCD.componentType = kAudioUnitType_FormatConverter;
-    variCD.componentSubType = kAudioUnitSubType_Varispeed;
-    variCD.componentManufacturer = kAudioUnitManufacturer_Apple;
-    
-    for (int i = 0; i < ss.num_voices; i++) {
-        AUGraphNewNode(ss.au_graph, &variCD, 0, 0, &ss.voices[i].varispeed_node);
-    }
-    
-    // create mixer unit
-    ComponentDescription mixerCD;
-    mixerCD.componentFlags = 0;
-    mixerCD.componentFlagsMask = 0;
-    mixerCD.componentType = kAudioUnitType_Mixer;
-    mixerCD.componentSubType = kAudioUnitSubType_StereoMixer;
-    mixerCD.componentManufacturer = kAudioUnitManufacturer_Apple;
-    
-    AUGraphNewNode(ss.au_graph, &mixerCD, 0, 0, &ss.mixer_node);
-    
+    NewAUGraph(&so.au_graph);
     
     // create output unit
     ComponentDescription outputCD;
@@ -129,38 +78,12 @@ void S_CreateAUGraph()
     outputCD.componentSubType = kAudioUnitSubType_DefaultOutput;
     outputCD.componentManufacturer = kAudioUnitManufacturer_Apple;
     
-    AUGraphNewNode(ss.au_graph, &outputCD, 0, 0, &ss.output_node);
+    AUGraphNewNode(so.au_graph, &outputCD, 0, 0, &so.output_node);
     
     
     // open the graph and get the audio units
-    AUGraphOpen(ss.au_graph);
-    AUGraphGetNodeInfo(ss.au_graph, ss.mixer_node, 0, 0, 0, &ss.au_mixer);
-    AUGraphGetNodeInfo(ss.au_graph, ss.output_node, 0, 0, 0, &ss.au_output);
-    
-    for (int i = 0; i < ss.num_voices; i++)
-        AUGraphGetNodeInfo(ss.au_graph, ss.voices[i].varispeed_node, 0, 0, 0, &ss.voices[i].au_varispeed);
-}
-
-int S_SetMixerBusCount(u8 count)
-{
-    UInt32 size = sizeof(UInt32);
-    UInt32 busCount = count;
-    
-    OSStatus result = noErr;
-    
-    result = AudioUnitSetProperty(ss.au_mixer,
-                                  kAudioUnitProperty_BusCount,
-                                  kAudioUnitScope_Input,
-                                  0,
-                                  &busCount,
-                                  size);
-    
-    if (result) {
-        printf("S_SetMixerBusCount: %4.4s\n", (char*)&result);
-        return 1;
-    }
-    
-    return 0;
+    AUGraphOpen(so.au_graph);
+    AUGraphGetNodeInfo(so.au_graph, so.output_node, 0, 0, 0, &so.au_output);
 }
 
 int S_SetStreamFormat(u32 rate)
@@ -179,7 +102,7 @@ int S_SetStreamFormat(u32 rate)
     OSStatus result = noErr;
     
     // setup output unit
-    result = AudioUnitSetProperty(ss.au_output,
+    result = AudioUnitSetProperty(so.au_output,
                                   kAudioUnitProperty_StreamFormat,
                                   kAudioUnitScope_Input,
                                   0,
@@ -191,189 +114,88 @@ int S_SetStreamFormat(u32 rate)
         return 1;
     }
     
-    // setup mixer unit
-    result = AudioUnitSetProperty(ss.au_mixer,
-                         kAudioUnitProperty_StreamFormat,
-                         kAudioUnitScope_Output,
-                         0,
-                         &format,
-                         sizeof(AudioStreamBasicDescription));
-    
-    if (result) {
-        printf("S_SetStreamFormat: Couldn't set mixer format (%4.4s)\n", (char*)&result);
-        return 1;
-    }
-    
     return 0;
 }
 
 int S_SetRenderCallback()
 {
-    // setup callbacks
+    // the output unit pulls the final mix straight from the software mixer
     AURenderCallbackStruct callback;
     callback.inputProc = S_RenderAudioCallback;
     callback.inputProcRefCon = 0;
     
-    for (int i = 0; i < ss.num_voices; i++) {
-        OSStatus result = noErr;
+    OSStatus result = noErr;
     
-        callback.inputProcRefCon = (void*)i;
-        
-        result = AudioUnitSetProperty(ss.voices[i].au_varispeed,
-                                      kAudioUnitProperty_SetRenderCallback,
-                                      kAudioUnitScope_Input,
-                                      0,
-                                      &callback,
-                                      sizeof(callback));
+    result = AudioUnitSetProperty(so.au_output,
+                                  kAudioUnitProperty_SetRenderCallback,
+                                  kAudioUnitScope_Input,
+                                  0,
+                                  &callback,
+                                  sizeof(callback));
     
-        if (result) {
-            printf("S_SetRenderCallback: %4.4s\n", (char*)&result);
-            return 1;
-        }
+    if (result) {
+        printf("S_SetRenderCallback: %4.4s\n", (char*)&result);
+        return 1;
     }
     
     return 0;
 }
 
-void S_StartAUGraph()
+void S_AddOverloadListener()
 {
-    for (int i = 0; i < ss.num_voices; i++)
-        AUGraphConnectNodeInput(ss.au_graph, ss.voices[i].varispeed_node, 0, ss.mixer_node, i);
+    AudioDeviceID device;
+    UInt32 size = sizeof(device);
     
-    AUGraphConnectNodeInput(ss.au_graph, ss.mixer_node, 0, ss.output_node, 0);
+    OSStatus result = AudioUnitGetProperty(so.au_output,
+                                           kAudioOutputUnitProperty_CurrentDevice,
+                                           kAudioUnitScope_Global,
+                                           0,
+                                           &device,
+                                           &size);
     
-    AUGraphInitialize(ss.au_graph);
-    AUGraphStart(ss.au_graph);
+    if (result) {
+        printf("S_AddOverloadListener: %4.4s\n", (char*)&result);
+        return;
+    }
+    
+    AudioObjectPropertyAddress address;
+    address.mSelector = kAudioDeviceProcessorOverload;
+    address.mScope = kAudioObjectPropertyScopeGlobal;
+    address.mElement = kAudioObjectPropertyElementMaster;
+    
+    AudioObjectAddPropertyListener(device, &address, S_OverloadListener, 0);
+}
+
+void S_StartAUGraph()
+{
+    AUGraphInitialize(so.au_graph);
+    AUGraphStart(so.au_graph);
     
     CFRunLoopRunInMode(kCFRunLoopDefaultMode, 2, false);
 }
 
 // ---------------------------------------------------------------------------
 
-int S_Init(u8 num_voices, u32 rate)
+int S_OpenOutput(S_render_func_t render, u32 rate)
 {
-    ss.mixing_rate = rate;
-    
-    ss.num_voices = num_voices;
-    ss.voices = (struct s_voice_state*)malloc(sizeof(struct s_voice_state) * num_voices);
+    so.render = render;
 
-    for (int i = 0; i < num_voices; i++) {
-        ss.voices[i].sample_pos = 0;
-        ss.voices[i].sample_length = 0;
-        ss.voices[i].sample_data = 0;
-    }
-    
-    
     S_CreateAUGraph();
     
-    if (S_SetMixerBusCount(num_voices))
-        return 1;
-    
-    if (S_SetStreamFormat(rate))
+    if (S_SetStreamFormat(rate ? rate : S_GetMixingRate()))
         return 1;
     
     if (S_SetRenderCallback())
         return 1;
     
     S_StartAUGraph();
+    S_AddOverloadListener();
     
     return 0;
 }
 
-void S_Shutdown()
-{
-    AUGraphStop(ss.au_graph);
-    DisposeAUGraph(ss.au_graph);
-}
-
-
-void S_PlayVoice(u8 voice, u8 data_type, u32 length, void *data)
-{
-    if (voice > ss.num_voices)
-        return;
-    
-    ss.voices[voice].sample_pos = 0;
-    ss.voices[voice].sample_format = data_type;
-    ss.voices[voice].sample_length = length;
-    ss.voices[voice].sample_data = data;
-}
-
-void S_StopVoice(u8 voice)
+void S_CloseOutput()
 {
-    if (voice > ss.num_voices)
-        return;
-    
-    ss.voices[voice].sample_pos = 0;
-    ss.voices[voice].sample_length = 0;
-    ss.voices[voice].sample_data = 0;
+    AUGraphStop(so.au_graph);
+    DisposeAUGraph(so.au_graph);
 }
-
-
-void S_SetVoiceVolume(u8 voice, u8 vol)
-{
-    if (voice > ss.num_voices)
-        return;
-
-    OSStatus err = noErr;
-
-    err = AudioUnitSetParameter(ss.au_mixer,
-                                kStereoMixerParam_Volume,
-                                kAudioUnitScope_Input,
-                                voice,
-                                (float)vol/127,
-                                0);
-}
-
-void S_SetVoicePanning(u8 voice, u8 panning)
-{
-    if (voice > ss.num_voices)
-        return;
-    
-    OSStatus err = noErr;
-    
-    err = AudioUnitSetParameter(ss.au_mixer,
-                                kStereoMixerParam_Pan,
-                                kAudioUnitScope_Input,
-                                voice,
-                                (float)panning/255,
-                                0);
-    
-}
-
-void S_SetVoiceFrequency(u8 voice, u32 freq)
-{
-    if (voice > ss.num_voices)
-        return;
-        
-    OSStatus err = noErr;
-    float rate = (float)freq / (float)ss.mixing_rate;
-    
-    err = AudioUnitSetParameter(ss.voices[voice].au_varispeed,
-                                kVarispeedParam_PlaybackRate,
-                                kAudioUnitScope_Global,
-                                0,
-                                rate,
-                                0);
-}
-
-void S_SetSampleOffset(u8 voice, u32 offset)
-{
-    if (voice > ss.num_voices)
-        return;
-    
-    ss.voices[voice].sample_pos += offset;
-    
-    if (ss.voices[voice].sample_pos >= ss.voices[voice].sample_length)
-        ss.voices[voice].sample_pos = ss.voices[voice].sample_length;
-}
-
-void S_SetSampleLoop(u8 voice, u8 type, u32 start, u32 end)
-{
-    if (voice > ss.num_voices)
-        return;
-    
-    ss.voices[voice].sample_loop_type = type;
-    ss.voices[voice].sample_loop_start = start;
-    ss.voices[voice].sample_loop_end = end;
-}
-
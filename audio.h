@@ -12,9 +12,32 @@
 
 #include "types.h"
 
+
+// ----------------------------------------------------------------------------
+// Software mixer (mixer.cpp)
+// ----------------------------------------------------------------------------
+
+// All mixer functions act on the calling thread's current mixer.
+//
+// Realtime contract: after S_Init, S_RenderFrames and the voice setters
+// never allocate, lock or make system calls (see rtcheck.h).
+typedef struct s_soundsystem_state S_mixer_t;
+
+S_mixer_t *S_CreateMixer();
+void S_DestroyMixer(S_mixer_t *mixer);
+void S_SetCurrentMixer(S_mixer_t *mixer);
+S_mixer_t *S_GetCurrentMixer();
+
+// make dst an exact copy of src's settings and voices, stems excepted;
+// the copy plays the same sample data, it does not own it
+int S_CopyMixer(S_mixer_t *dst, const S_mixer_t *src);
+
 int S_Init(u8 num_voices, u32 rate);
 void S_Shutdown();
 
+u32 S_GetMixingRate();
+
+// data_type is the bytes per frame of plain PCM, 1 or 2, or S_FORMAT_ADPCM
 void S_PlayVoice(u8 voice, u8 data_type, u32 length, void *data);
 void S_StopVoice(u8 voice);
 
@@ -23,11 +46,220 @@ void S_SetVoicePanning(u8 voice, u8 panning);
 void S_SetVoiceFrequency(u8 voice, u32 freq);
 void S_SetSampleOffset(u8 voice, u32 offset);
 
+// a muted voice keeps its position and volume ramp moving but is not mixed
+void S_SetVoiceMute(u8 voice, u8 mute);
+
 #define S_LOOP_NONE 0x0
 #define S_LOOP_FWD 0x1
 #define S_LOOP_PP 0x2
 
+// S_LOOP_FWD | S_LOOP_PP plays ping-pong, unknown types do not loop
 void S_SetSampleLoop(u8 voice, u8 type, u32 start, u32 end);
 
+#define S_INTERP_NEAREST 0x0
+#define S_INTERP_LINEAR  0x1
+#define S_INTERP_CUBIC   0x2
+
+void S_SetInterpolation(u8 mode);
+void S_SetVolumeRamp(u32 frames);
+
+// Quality tiers, best first.  A tier sets the interpolation and the volume
+// ramp, and the last one also mixes the voices at half the rate and
+// interpolates the mix back up, which halves the cost of every voice.
+// Switching is realtime safe; S_SetInterpolation picks the tier of that
+// interpolation.
+#define S_QUALITY_CUBIC   0
+#define S_QUALITY_LINEAR  1
+#define S_QUALITY_NEAREST 2
+#define S_QUALITY_HALF    3
+#define S_NUM_QUALITIES   4
+
+void S_SetQuality(u8 tier);
+u8 S_GetQuality();
+
+// render through the plain scalar reference mixer (mixer_ref.cpp) instead
+void S_SetReferenceMode(u8 enable);
+
+// only advance the voices as a render would, without mixing or touching
+// the output buffers, to find the mixer state at a later point cheaply
+void S_SetStateOnly(u8 enable);
+u8 S_GetStateOnly();
+
+// the two mixers would render the same audio from here on: same settings,
+// no stems, and every voice at the same position, gain and ramp
+u8 S_MixersMatch(const S_mixer_t *a, const S_mixer_t *b);
+
+// mix all voices into two planar float buffers; given the same buffer
+// twice it gets the sum of both sides, a mono mix at no extra cost
+void S_RenderFrames(float *left, float *right, u32 num_frames);
+
+// Stems: while set, S_RenderFrames also writes every voice on its own into
+// left[voice] and right[voice], from the same resampled frames as the mix.
+// Renders append from the start of the buffers, set them again to rewind.
+// With right == 0 the stems are mono, left == 0 turns them off.  The
+// reference mixer does not write stems.
+void S_SetStemBuffers(float **left, float **right);
+
+// voices that produced sound during the last S_RenderFrames
+u32 S_GetActiveVoices();
+
+// bytes held by the current mixer and its voices
+u64 S_GetMemoryUsage();
+
+#define S_VOICE_FINISHED 0x0   // no sample, or played past its end
+#define S_VOICE_SILENT   0x1   // zero gain or muted, only the position advances
+#define S_VOICE_ACTIVE   0x2
+
+// state of a voice during the last S_RenderFrames
+u8 S_GetVoiceState(u8 voice);
+
+
+// ----------------------------------------------------------------------------
+// Realtime health counters (health.cpp)
+// ----------------------------------------------------------------------------
+
+// render load histogram: bucket i counts callbacks that used between
+// i and i+1 times S_HEALTH_BUCKET_PERCENT of their deadline
+#define S_HEALTH_BUCKETS        16
+#define S_HEALTH_BUCKET_PERCENT 10
+
+typedef struct {
+    u64 callbacks;
+    u64 frames;
+    u64 total_render_ns;
+    u32 last_render_ns;
+    u32 max_render_ns;
+    u32 deadline_misses;  // callbacks that took longer than the audio they rendered
+    u32 underruns;        // the device ran out of audio
+    u32 late_ticks;       // ticks run behind schedule to catch up
+    u32 dropped_ticks;    // ticks skipped by discarding pending time
+    u32 active_voices;
+    u32 load_histogram[S_HEALTH_BUCKETS];
+} S_health_t;
+
+u64 S_GetTimeNanos();
+
+// writers, safe to call from any thread including the realtime ones
+void S_HealthRecordRender(u64 render_ns, u32 num_frames, u32 active_voices);
+
+// the same at a given rate, for renders that do not end on the current
+// mixer; a rate of 0 records no deadline
+void S_HealthRecordRenderAt(u64 render_ns, u32 num_frames, u32 rate, u32 active_voices);
+void S_HealthRecordUnderrun();
+void S_HealthRecordTicks(u32 late, u32 dropped);
+
+// readers, lock-free and safe to poll from a monitoring thread
+void S_GetHealth(S_health_t *health);
+void S_ResetHealth();
+
+
+// ----------------------------------------------------------------------------
+// Compressed samples (adpcm.cpp)
+// ----------------------------------------------------------------------------
+
+// IMA ADPCM in independent blocks: a 4 byte header with the first frame and
+// the step index, then 4 bits for each further frame.  The mixer decodes
+// a block at a time into a small per-voice cache ahead of the read position,
+// so compressed samples play with loops, offsets and any interpolation.
+
+#define S_FORMAT_ADPCM       3
+#define S_ADPCM_BLOCK_FRAMES 64
+#define S_ADPCM_BLOCK_BYTES  36
+
+u32 S_AdpcmSize(u32 num_frames);
+void S_EncodeAdpcm(const s16 *frames, u32 num_frames, u8 *out);
+void S_DecodeAdpcmBlock(const u8 *block, s16 *frames);
+
+
+// ----------------------------------------------------------------------------
+// Output stage (output.cpp)
+// ----------------------------------------------------------------------------
+
+// The last step between the mix and the device or a file.  It applies a
+// master gain, then clips hard or soft if asked to.  Integer output can
+// get TPDF dither of one LSB either way, and is converted to interleaved
+// 16 or 24 bit, rounded to nearest.  Every pass is a branch-free loop over
+// the block that the compiler vectorizes.  The dither noise is a hash of
+// the sample index rather than a serial generator, so it vectorizes too.
+// Realtime safe.
+
+#define S_CLIP_NONE 0x0   // float output keeps overs, integer output saturates
+#define S_CLIP_HARD 0x1   // clamp to full scale
+#define S_CLIP_SOFT 0x2   // linear up to S_CLIP_KNEE, then bends smoothly towards full scale
+
+#define S_CLIP_KNEE 0.7f
+
+typedef struct {
+    float gain;
+    u8 clip;
+    u8 dither;
+    u32 noise;    // dither position
+} S_output_t;
+
+void S_InitOutput(S_output_t *output, float gain, u8 clip, u8 dither);
+
+// gain and clip in place, for float output
+void S_ProcessOutput(S_output_t *output, float *left, float *right, u32 num_frames);
+
+// gain, clip, dither and interleave; right == 0 converts one channel.  24
+// bit samples are packed little endian, three bytes each.  Float output
+// is not dithered.
+void S_ConvertF32(S_output_t *output, const float *left, const float *right, float *out, u32 num_frames);
+void S_ConvertS16(S_output_t *output, const float *left, const float *right, s16 *out, u32 num_frames);
+void S_ConvertS24(S_output_t *output, const float *left, const float *right, u8 *out, u32 num_frames);
+
+// flush denormals to zero (FTZ and DAZ on SSE, FZ on ARM) in the calling
+// thread, so decaying ramps and filters never take the slow path; the
+// getter tells whether the calling thread does
+void S_EnableFlushToZero();
+u8 S_GetFlushToZero();
+
+
+// ----------------------------------------------------------------------------
+// Output sinks (sink.cpp)
+// ----------------------------------------------------------------------------
+
+// Sinks take the final mix by push, for headless use:
+//   "null"            discards everything, for benchmarking
+//   "wav:file.wav"    WAV file
+//   "raw:file.pcm"    headerless interleaved PCM
+//   "stdout" or "-"   headerless interleaved PCM to stdout, e.g. to pipe
+//                     into an encoder
+//   "alsa[:device]"   ALSA playback, in builds with XM_HAVE_ALSA
+// A sink has one or two channels.  Mono sinks only take the left input.
+typedef struct s_sink S_sink_t;
+
+#define S_SINK_S16 0x0   // little endian signed 16 bit
+#define S_SINK_F32 0x1   // little endian 32 bit float
+#define S_SINK_S24 0x2   // little endian signed 24 bit, packed
+
+S_sink_t *S_OpenSink(const char *spec, u32 rate, u8 num_channels, u8 format);
+void S_CloseSink(S_sink_t *sink);
+
+// the output stage the sink converts through, unity gain and no clipper
+// or dither until set
+void S_SetSinkOutput(S_sink_t *sink, float gain, u8 clip, u8 dither);
+
+// returns the frames written, fewer only on error
+u32 S_WriteSink(S_sink_t *sink, const float *left, const float *right, u32 num_frames);
+
+// block until everything written so far has been played or stored
+void S_DrainSink(S_sink_t *sink);
+
+// frames written but not played yet, 0 for files and pipes
+u32 S_GetSinkLatency(S_sink_t *sink);
+
+
+// ----------------------------------------------------------------------------
+// Output device (audio.cpp, CoreAudio only)
+// ----------------------------------------------------------------------------
+
+// the device pulls from render, or straight from the software mixer when
+// render is 0.  It runs at rate, 0 for the rate of the current mixer.
+typedef u32 (*S_render_func_t)(float *left, float *right, u32 num_frames);
+
+int S_OpenOutput(S_render_func_t render, u32 rate);
+void S_CloseOutput();
+
 
 #endif
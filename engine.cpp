@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+#include "engine.h"
+#include "profile.h"
+#include "rtcheck.h"
+
+
+struct e_engine_state
+{
+    XM_player_state_t *player;
+    S_mixer_t *mixer;
+
+    u32 period_frames;
+    u32 num_slots;
+    float *slot_left;        // num_slots periods each
+    float *slot_right;
+    u32 *slot_frames;
+    S_output_t output;
+
+    // slots written and read so far, the difference is the fill level
+    std::atomic<u32> write_index;
+    std::atomic<u32> read_index;
+    u32 read_offset;         // frames already taken from the slot at read_index
+
+    // the player frame the output is at, in the same count as sync events
+    std::atomic<u64> played;
+
+    std::atomic<u8> song_done;
+    std::atomic<u8> stop;
+
+    // adaptive quality, written by the render thread only
+    u8 adaptive;
+    u8 best_quality;
+    u64 period_ns;
+    float load;
+    u32 held;                // periods since the last change
+    u32 hold_up;             // periods below the low mark before stepping up
+    u32 base_hold;           // about a second
+    u8 stepped_up;           // the last change was a step up
+    std::atomic<u8> quality;
+    std::atomic<float> shown_load;
+
+    u8 running;
+    pthread_t thread;
+} e;
+
+
+// ---------------------------------------------------------------------------
+
+static void E_Sleep(u64 ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+
+    nanosleep(&ts, 0);
+}
+
+// periods to wait after a change before stepping down again, about as
+// long as the smoothing takes to settle
+#define E_HOLD_DOWN 8
+
+static void E_AdaptQuality(u64 render_ns, u32 filled)
+{
+    e.load += ((float)render_ns / e.period_ns - e.load) * 0.125f;
+    e.shown_load.store(e.load, std::memory_order_relaxed);
+
+    if (e.held < 0xFFFFFFFF)
+        e.held++;
+
+    // a step up that held backs the wait off again
+    if (e.stepped_up && e.held == 2 * e.hold_up && e.hold_up > e.base_hold)
+        e.hold_up /= 2;
+
+    u8 tier = S_GetQuality();
+    u8 behind = e.load > E_LOAD_HIGH || filled < e.num_slots / 4;
+
+    if (behind && tier < S_QUALITY_HALF && e.held >= E_HOLD_DOWN) {
+        // stepping up too early costs a longer wait before the next try
+        if (e.stepped_up && e.held < e.hold_up && e.hold_up < 8 * e.base_hold)
+            e.hold_up *= 2;
+
+        e.stepped_up = 0;
+        tier++;
+    } else if (e.load < E_LOAD_LOW && tier > e.best_quality && e.held >= e.hold_up) {
+        e.stepped_up = 1;
+        tier--;
+    } else {
+        return;
+    }
+
+    S_SetQuality(tier);
+    e.quality.store(tier, std::memory_order_relaxed);
+    e.held = 0;
+}
+
+static void *E_RenderThread(void *)
+{
+    XM_SetCurrentPlayer(e.player);
+    S_SetCurrentMixer(e.mixer);
+    S_EnableFlushToZero();
+
+    // profiler builds would otherwise allocate on the first scope mid-render
+    P_InitThread("render", 0);
+
+    // poll twice per period, the consumer never has to wake us
+    u64 poll_ns = (u64)e.period_frames * 500000000ULL / S_GetMixingRate();
+
+    while (!e.stop.load(std::memory_order_relaxed)) {
+        u32 w = e.write_index.load(std::memory_order_relaxed);
+        u32 r = e.read_index.load(std::memory_order_acquire);
+
+        if (w - r == e.num_slots || e.song_done.load(std::memory_order_relaxed)) {
+            E_Sleep(poll_ns);
+            continue;
+        }
+
+        u32 slot = w % e.num_slots;
+        float *left = e.slot_left + slot * e.period_frames;
+        float *right = e.slot_right + slot * e.period_frames;
+
+        u64 t0 = S_GetTimeNanos();
+        u32 n = XM_RenderFrames(left, right, e.period_frames);
+        S_ProcessOutput(&e.output, left, right, n);
+        u64 render_ns = S_GetTimeNanos() - t0;
+
+        S_HealthRecordRender(render_ns, e.period_frames, S_GetActiveVoices());
+
+        // the ring only counts as running low once it was full
+        if (e.adaptive)
+            E_AdaptQuality(render_ns, w < e.num_slots ? e.num_slots : w - r);
+
+        e.slot_frames[slot] = n;
+
+        if (n)
+            e.write_index.store(w + 1, std::memory_order_release);
+
+        if (n < e.period_frames)
+            e.song_done.store(1, std::memory_order_release);
+    }
+
+    return 0;
+}
+
+static int E_CreateThread(s32 priority)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    int result = pthread_create(&e.thread, &attr, E_RenderThread, 0);
+    pthread_attr_destroy(&attr);
+
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void E_DefaultConfig(E_config_t *config)
+{
+    config->period_frames = E_DEFAULT_PERIOD;
+    config->latency_ms = E_DEFAULT_LATENCY;
+    config->priority = 0;
+    config->cpu = -1;
+    config->adaptive = 0;
+    config->gain = 1.0f;
+    config->clip = S_CLIP_NONE;
+}
+
+int E_Start(XM_player_state_t *player, S_mixer_t *mixer, const E_config_t *config)
+{
+    if (e.running || !config->period_frames)
+        return 1;
+
+    S_mixer_t *previous = S_GetCurrentMixer();
+    S_SetCurrentMixer(mixer);
+    u64 latency_frames = (u64)config->latency_ms * S_GetMixingRate() / 1000;
+    u32 rate = S_GetMixingRate();
+    u8 quality = S_GetQuality();
+    S_SetCurrentMixer(previous);
+
+    e.player = player;
+    e.mixer = mixer;
+    e.played.store(player->frame);
+    e.period_frames = config->period_frames;
+    e.num_slots = (u32)((latency_frames + e.period_frames - 1) / e.period_frames);
+
+    if (e.num_slots < 2)
+        e.num_slots = 2;
+
+    e.adaptive = config->adaptive;
+    e.best_quality = quality;
+    e.period_ns = (u64)e.period_frames * 1000000000ULL / rate;
+    e.load = 0;
+    e.held = 0;
+    e.base_hold = rate / e.period_frames + 1;
+    e.hold_up = e.base_hold;
+    e.stepped_up = 0;
+    e.quality.store(quality);
+    e.shown_load.store(0);
+
+    S_InitOutput(&e.output, config->gain, config->clip, 0);
+
+    e.slot_left = (float*)malloc(sizeof(float) * e.num_slots * e.period_frames);
+    e.slot_right = (float*)malloc(sizeof(float) * e.num_slots * e.period_frames);
+    e.slot_frames = (u32*)calloc(e.num_slots, sizeof(u32));
+
+    e.write_index.store(0);
+    e.read_index.store(0);
+    e.read_offset = 0;
+    e.song_done.store(0);
+    e.stop.store(0);
+
+    if (!e.slot_left || !e.slot_right || !e.slot_frames) {
+        E_Stop();
+        return 1;
+    }
+
+    int result = E_CreateThread(config->priority);
+
+    // SCHED_FIFO usually needs privileges, run with the default policy then
+    if (result && config->priority > 0) {
+        fprintf(stderr, "E_Start: SCHED_FIFO priority %d refused, using the default policy\n", config->priority);
+        result = E_CreateThread(0);
+    }
+
+    if (result) {
+        E_Stop();
+        return 1;
+    }
+
+    e.running = 1;
+
+#ifdef __linux__
+    if (config->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config->cpu, &set);
+
+        if (pthread_setaffinity_np(e.thread, sizeof(set), &set))
+            fprintf(stderr, "E_Start: unable to pin the render thread to CPU %d\n", config->cpu);
+    }
+#endif
+
+    // prime the ring before anyone reads from it
+    while (e.write_index.load(std::memory_order_acquire) < e.num_slots && !e.song_done.load(std::memory_order_acquire))
+        E_Sleep(1000000);
+
+    return 0;
+}
+
+void E_Stop()
+{
+    if (e.running) {
+        e.stop.store(1);
+        pthread_join(e.thread, 0);
+        e.running = 0;
+    }
+
+    free(e.slot_left);
+    free(e.slot_right);
+    free(e.slot_frames);
+
+    e.slot_left = 0;
+    e.slot_right = 0;
+    e.slot_frames = 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+u32 E_ReadFrames(float *left, float *right, u32 num_frames)
+{
+    RT_SCOPE();
+
+    u32 done = 0;
+
+    while (done < num_frames) {
+        u32 r = e.read_index.load(std::memory_order_relaxed);
+        u32 w = e.write_index.load(std::memory_order_acquire);
+
+        if (r == w)
+            break;
+
+        u32 slot = r % e.num_slots;
+        u32 n = e.slot_frames[slot] - e.read_offset;
+
+        if (n > num_frames - done)
+            n = num_frames - done;
+
+        u32 offset = slot * e.period_frames + e.read_offset;
+
+        memcpy(left + done, e.slot_left + offset, sizeof(float) * n);
+        memcpy(right + done, e.slot_right + offset, sizeof(float) * n);
+
+        done += n;
+        e.read_offset += n;
+        e.played.fetch_add(n, std::memory_order_relaxed);
+
+        // hand the slot back once it is used up
+        if (e.read_offset == e.slot_frames[slot]) {
+            e.read_offset = 0;
+            e.read_index.store(r + 1, std::memory_order_release);
+        }
+    }
+
+    if (done < num_frames) {
+        memset(left + done, 0, sizeof(float) * (num_frames - done));
+        memset(right + done, 0, sizeof(float) * (num_frames - done));
+
+        if (!e.song_done.load(std::memory_order_acquire))
+            S_HealthRecordUnderrun();
+    }
+
+    return done;
+}
+
+u8 E_IsFinished()
+{
+    return e.song_done.load(std::memory_order_acquire) &&
+           e.read_index.load(std::memory_order_relaxed) == e.write_index.load(std::memory_order_acquire);
+}
+
+u8 E_GetQuality()
+{
+    return e.quality.load(std::memory_order_relaxed);
+}
+
+float E_GetLoad()
+{
+    return e.shown_load.load(std::memory_order_relaxed);
+}
+
+u64 E_GetPlayedFrames()
+{
+    return e.played.load(std::memory_order_relaxed);
+}
+
+u32 E_GetBufferedFrames()
+{
+    u32 r = e.read_index.load(std::memory_order_acquire);
+    u32 w = e.write_index.load(std::memory_order_acquire);
+
+    return (w - r) * e.period_frames;
+}
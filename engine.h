@@ -0,0 +1,72 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "types.h"
+#include "xm.h"
+#include "audio.h"
+
+
+// ----------------------------------------------------------------------------
+// Render thread (engine.cpp)
+// ----------------------------------------------------------------------------
+
+// A dedicated thread runs ticks and mixing ahead of time into a lock-free
+// single-producer/single-consumer ring of fixed-size periods.  The output
+// only copies from the ring, so a slow tick eats into the buffered audio
+// instead of causing a dropout.  The thread also runs the float output
+// stage on each period and flushes denormals to zero.  There is one engine
+// per process.
+
+#define E_DEFAULT_PERIOD  512
+#define E_DEFAULT_LATENCY 50
+
+typedef struct {
+    u32 period_frames;   // frames per ring slot
+    u32 latency_ms;      // audio rendered ahead, rounded up to whole periods
+    s32 priority;        // SCHED_FIFO priority, 0 keeps the default policy
+    s32 cpu;             // pin the render thread to this CPU (Linux only), -1 for any
+    u8 adaptive;         // trade mixer quality for time when rendering falls behind
+    float gain;          // master gain of the output stage (see audio.h)
+    u8 clip;             // S_CLIP_*
+} E_config_t;
+
+void E_DefaultConfig(E_config_t *config);
+
+// Starts rendering the given player through the given mixer, both already
+// initialised, and returns once the ring is full.  Neither may be used by
+// another thread until E_Stop.
+int E_Start(XM_player_state_t *player, S_mixer_t *mixer, const E_config_t *config);
+void E_Stop();
+
+// consumer side, realtime safe: copies up to num_frames from the ring and
+// fills the rest with silence, returns the frames copied
+u32 E_ReadFrames(float *left, float *right, u32 num_frames);
+
+// the song has ended and the ring has been drained
+u8 E_IsFinished();
+
+// Adaptive quality: the render thread keeps a smoothed ratio of the time a
+// period took to render to the time it lasts.  Past E_LOAD_HIGH, or with
+// the ring running low, it steps the mixer down a quality tier (see
+// audio.h) rather than let the output run dry, and below E_LOAD_LOW for a
+// second it steps back up, never above the tier the mixer started at.  A
+// tier costs at most about twice the next one, so the gap between the two
+// thresholds keeps it from flapping; a step up that did not hold doubles
+// the wait before the next one.
+#define E_LOAD_HIGH 0.7f
+#define E_LOAD_LOW  0.3f
+
+// the mixer's current quality tier and the smoothed load
+u8 E_GetQuality();
+float E_GetLoad();
+
+// frames rendered into the ring and not yet handed to the output, counted
+// in whole periods, so a period being read still counts in full
+u32 E_GetBufferedFrames();
+
+// player frames handed to the output so far, to line sync events up with
+// what is being heard
+u64 E_GetPlayedFrames();
+
+
+#endif
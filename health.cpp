@@ -0,0 +1,109 @@
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#include "audio.h"
+
+// Everything here is written from the realtime threads, so it sticks to
+// relaxed atomics on static storage: no allocation, no locks, no syscalls
+// apart from reading the clock.
+
+
+struct s_health_state
+{
+    std::atomic<u64> callbacks;
+    std::atomic<u64> frames;
+    std::atomic<u64> total_render_ns;
+    std::atomic<u32> last_render_ns;
+    std::atomic<u32> max_render_ns;
+    std::atomic<u32> deadline_misses;
+    std::atomic<u32> underruns;
+    std::atomic<u32> late_ticks;
+    std::atomic<u32> dropped_ticks;
+    std::atomic<u32> active_voices;
+    std::atomic<u32> load_histogram[S_HEALTH_BUCKETS];
+} sh;
+
+
+u64 S_GetTimeNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void S_HealthRecordRender(u64 render_ns, u32 num_frames, u32 active_voices)
+{
+    S_HealthRecordRenderAt(render_ns, num_frames, S_GetMixingRate(), active_voices);
+}
+
+void S_HealthRecordRenderAt(u64 render_ns, u32 num_frames, u32 rate, u32 active_voices)
+{
+    u64 deadline_ns = rate ? (u64)num_frames * 1000000000ULL / rate : 0;
+
+    sh.callbacks.fetch_add(1, std::memory_order_relaxed);
+    sh.frames.fetch_add(num_frames, std::memory_order_relaxed);
+    sh.total_render_ns.fetch_add(render_ns, std::memory_order_relaxed);
+    sh.last_render_ns.store((u32)render_ns, std::memory_order_relaxed);
+    sh.active_voices.store(active_voices, std::memory_order_relaxed);
+
+    u32 max = sh.max_render_ns.load(std::memory_order_relaxed);
+    while (render_ns > max && !sh.max_render_ns.compare_exchange_weak(max, (u32)render_ns, std::memory_order_relaxed))
+        ;
+
+    if (deadline_ns && render_ns > deadline_ns)
+        sh.deadline_misses.fetch_add(1, std::memory_order_relaxed);
+
+    // render load in steps of S_HEALTH_BUCKET_PERCENT, the last bucket takes the rest
+    u64 bucket = deadline_ns ? render_ns * 100 / (deadline_ns * S_HEALTH_BUCKET_PERCENT) : S_HEALTH_BUCKETS - 1;
+    if (bucket >= S_HEALTH_BUCKETS)
+        bucket = S_HEALTH_BUCKETS - 1;
+
+    sh.load_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void S_HealthRecordUnderrun()
+{
+    sh.underruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+void S_HealthRecordTicks(u32 late, u32 dropped)
+{
+    sh.late_ticks.fetch_add(late, std::memory_order_relaxed);
+    sh.dropped_ticks.fetch_add(dropped, std::memory_order_relaxed);
+}
+
+void S_GetHealth(S_health_t *health)
+{
+    health->callbacks = sh.callbacks.load(std::memory_order_relaxed);
+    health->frames = sh.frames.load(std::memory_order_relaxed);
+    health->total_render_ns = sh.total_render_ns.load(std::memory_order_relaxed);
+    health->last_render_ns = sh.last_render_ns.load(std::memory_order_relaxed);
+    health->max_render_ns = sh.max_render_ns.load(std::memory_order_relaxed);
+    health->deadline_misses = sh.deadline_misses.load(std::memory_order_relaxed);
+    health->underruns = sh.underruns.load(std::memory_order_relaxed);
+    health->late_ticks = sh.late_ticks.load(std::memory_order_relaxed);
+    health->dropped_ticks = sh.dropped_ticks.load(std::memory_order_relaxed);
+    health->active_voices = sh.active_voices.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < S_HEALTH_BUCKETS; i++)
+        health->load_histogram[i] = sh.load_histogram[i].load(std::memory_order_relaxed);
+}
+
+void S_ResetHealth()
+{
+    sh.callbacks.store(0, std::memory_order_relaxed);
+    sh.frames.store(0, std::memory_order_relaxed);
+    sh.total_render_ns.store(0, std::memory_order_relaxed);
+    sh.last_render_ns.store(0, std::memory_order_relaxed);
+    sh.max_render_ns.store(0, std::memory_order_relaxed);
+    sh.deadline_misses.store(0, std::memory_order_relaxed);
+    sh.underruns.store(0, std::memory_order_relaxed);
+    sh.late_ticks.store(0, std::memory_order_relaxed);
+    sh.dropped_ticks.store(0, std::memory_order_relaxed);
+    sh.active_voices.store(0, std::memory_order_relaxed);
+
+    for (int i = 0; i < S_HEALTH_BUCKETS; i++)
+        sh.load_histogram[i].store(0, std::memory_order_relaxed);
+}
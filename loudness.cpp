@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "loudness.h"
+#include "audio.h"
+
+
+#define LM_BLOCK_FRAMES 4096
+#define LM_TAPS         12     // of the true peak filter, per phase
+#define LM_MAX_FACTOR   4
+
+struct LM_meter_t
+{
+    u32 rate;
+
+    // K-weighting, a high shelf then a high pass, transposed direct form II
+    double shelf_b[3], shelf_a[3];
+    double pass_b[3], pass_a[3];
+    double shelf_z[2][2];
+    double pass_z[2][2];
+
+    // 100 ms sub-blocks, four make a gating block
+    u32 sub_frames;
+    u32 sub_pos;
+    double sub_energy;
+    double recent[4];
+    u64 num_subs;
+
+    // energies of the blocks above the absolute gate
+    double *blocks;
+    u32 num_blocks;
+    u32 capacity;
+
+    // polyphase interpolator, the history is kept twice so a phase reads
+    // its taps in one run
+    u32 factor;
+    float fir[LM_MAX_FACTOR][LM_TAPS];
+    float history[2][2 * LM_TAPS];
+    u32 history_pos;
+
+    float sample_peak;
+    float true_peak;
+};
+
+// -70 LUFS as a block energy
+#define LM_ABSOLUTE_GATE 1.1724653045822963e-7
+
+
+// ---------------------------------------------------------------------------
+
+// filter coefficients for any rate, from the analog prototypes of BS.1770
+static void LM_InitFilters(LM_meter_t *m)
+{
+    double f0 = 1681.974450955533;
+    double g = 3.999843853973347;
+    double q = 0.7071752369554196;
+
+    double k = tan(M_PI * f0 / m->rate);
+    double vh = pow(10.0, g / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+
+    m->shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+    m->shelf_b[1] = 2.0 * (k * k - vh) / a0;
+    m->shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+    m->shelf_a[0] = 1.0;
+    m->shelf_a[1] = 2.0 * (k * k - 1.0) / a0;
+    m->shelf_a[2] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / m->rate);
+    a0 = 1.0 + k / q + k * k;
+
+    m->pass_b[0] = 1.0;
+    m->pass_b[1] = -2.0;
+    m->pass_b[2] = 1.0;
+    m->pass_a[0] = 1.0;
+    m->pass_a[1] = 2.0 * (k * k - 1.0) / a0;
+    m->pass_a[2] = (1.0 - k / q + k * k) / a0;
+}
+
+// Hann windowed sinc, every phase scaled to unity gain at DC
+static void LM_InitInterpolator(LM_meter_t *m)
+{
+    m->factor = m->rate < 96000 ? 4 : m->rate < 192000 ? 2 : 1;
+
+    u32 n = m->factor * LM_TAPS;
+    double center = (n - 1) * 0.5;
+
+    for (u32 p = 0; p < m->factor; p++) {
+        double sum = 0;
+
+        for (u32 t = 0; t < LM_TAPS; t++) {
+            u32 i = p + m->factor * t;
+            double x = (i - center) / m->factor;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 1) / (n + 1));
+
+            m->fir[p][t] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+
+        for (u32 t = 0; t < LM_TAPS; t++)
+            m->fir[p][t] = (float)(m->fir[p][t] / sum);
+    }
+}
+
+static inline double LM_Biquad(const double *b, const double *a, double *z, double x)
+{
+    double y = b[0] * x + z[0];
+
+    z[0] = b[1] * x - a[1] * y + z[1];
+    z[1] = b[2] * x - a[2] * y;
+
+    return y;
+}
+
+static inline float LM_Interpolate(const LM_meter_t *m, const float *history)
+{
+    float peak = 0;
+
+    for (u32 p = 0; p < m->factor; p++) {
+        float y = 0;
+
+        for (u32 t = 0; t < LM_TAPS; t++)
+            y += m->fir[p][t] * history[t];
+
+        y = fabsf(y);
+        peak = y > peak ? y : peak;
+    }
+
+    return peak;
+}
+
+static int LM_AddBlock(LM_meter_t *m, double energy)
+{
+    if (energy <= LM_ABSOLUTE_GATE)
+        return 0;
+
+    if (m->num_blocks == m->capacity) {
+        u32 n = m->capacity ? 2 * m->capacity : 1024;
+        double *blocks = (double*)realloc(m->blocks, sizeof(double) * n);
+
+        if (!blocks)
+            return 1;
+
+        m->blocks = blocks;
+        m->capacity = n;
+    }
+
+    m->blocks[m->num_blocks++] = energy;
+    return 0;
+}
+
+static int LM_EndSubBlock(LM_meter_t *m)
+{
+    m->recent[m->num_subs++ % 4] = m->sub_energy;
+    m->sub_energy = 0;
+    m->sub_pos = 0;
+
+    if (m->num_subs < 4)
+        return 0;
+
+    double energy = m->recent[0] + m->recent[1] + m->recent[2] + m->recent[3];
+    return LM_AddBlock(m, energy / (4.0 * m->sub_frames));
+}
+
+
+// ---------------------------------------------------------------------------
+
+LM_meter_t *LM_CreateMeter(u32 rate)
+{
+    if (!rate)
+        return 0;
+
+    LM_meter_t *m = (LM_meter_t*)calloc(1, sizeof(LM_meter_t));
+    if (!m)
+        return 0;
+
+    m->rate = rate;
+    m->sub_frames = (rate + 5) / 10;
+
+    LM_InitFilters(m);
+    LM_InitInterpolator(m);
+
+    return m;
+}
+
+void LM_DestroyMeter(LM_meter_t *meter)
+{
+    if (!meter)
+        return;
+
+    free(meter->blocks);
+    free(meter);
+}
+
+int LM_AddFrames(LM_meter_t *m, const float *left, const float *right, u32 num_frames)
+{
+    const float *in[2] = { left, right };
+    u32 k = 0;
+
+    while (k < num_frames) {
+        u32 n = m->sub_frames - m->sub_pos;
+        if (n > num_frames - k)
+            n = num_frames - k;
+
+        for (int c = 0; c < 2; c++) {
+            double energy = 0;
+            float sample_peak = m->sample_peak;
+            float true_peak = m->true_peak;
+            u32 pos = m->history_pos;
+
+            for (u32 j = k; j < k + n; j++) {
+                float x = in[c][j];
+                float a = fabsf(x);
+
+                sample_peak = a > sample_peak ? a : sample_peak;
+
+                double y = LM_Biquad(m->pass_b, m->pass_a, m->pass_z[c],
+                                     LM_Biquad(m->shelf_b, m->shelf_a, m->shelf_z[c], x));
+                energy += y * y;
+
+                if (m->factor > 1) {
+                    // newest first, so the taps line up with the filter
+                    pos = pos ? pos - 1 : LM_TAPS - 1;
+                    m->history[c][pos] = m->history[c][pos + LM_TAPS] = x;
+
+                    float t = LM_Interpolate(m, &m->history[c][pos]);
+                    true_peak = t > true_peak ? t : true_peak;
+                }
+            }
+
+            m->sub_energy += energy;
+            m->sample_peak = sample_peak;
+            m->true_peak = true_peak;
+
+            if (c == 1)
+                m->history_pos = pos;
+
+            // the filters decay into denormals over long silences
+            for (int z = 0; z < 2; z++) {
+                if (fabs(m->shelf_z[c][z]) < 1e-30) m->shelf_z[c][z] = 0;
+                if (fabs(m->pass_z[c][z]) < 1e-30) m->pass_z[c][z] = 0;
+            }
+        }
+
+        k += n;
+        m->sub_pos += n;
+
+        if (m->sub_pos == m->sub_frames && LM_EndSubBlock(m))
+            return 1;
+    }
+
+    return 0;
+}
+
+double LM_GetLoudness(const LM_meter_t *m)
+{
+    double sum = 0;
+
+    for (u32 i = 0; i < m->num_blocks; i++)
+        sum += m->blocks[i];
+
+    if (!m->num_blocks)
+        return LM_SILENCE;
+
+    // 10 LU below the loudness of the blocks above the absolute gate
+    double gate = sum / m->num_blocks * 0.1;
+    u32 count = 0;
+
+    sum = 0;
+
+    for (u32 i = 0; i < m->num_blocks; i++) {
+        if (m->blocks[i] > gate) {
+            sum += m->blocks[i];
+            count++;
+        }
+    }
+
+    return count ? -0.691 + 10.0 * log10(sum / count) : LM_SILENCE;
+}
+
+float LM_GetSamplePeak(const LM_meter_t *m)
+{
+    return m->sample_peak;
+}
+
+float LM_GetTruePeak(const LM_meter_t *m)
+{
+    // without oversampling the true peak is the sample peak
+    return m->true_peak > m->sample_peak ? m->true_peak : m->sample_peak;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void LM_DefaultConfig(LM_config_t *config)
+{
+    config->rate = 48000;
+    config->interpolation = S_INTERP_LINEAR;
+    config->max_seconds = 0;
+}
+
+int LM_AnalyzeModule(XM_module_t *module, const LM_config_t *config, LM_result_t *result)
+{
+    XM_player_state_t *saved_player = XM_GetCurrentPlayer();
+    S_mixer_t *saved_mixer = S_GetCurrentMixer();
+
+    XM_player_state_t *player = (XM_player_state_t*)calloc(1, sizeof(XM_player_state_t));
+    S_mixer_t *mixer = S_CreateMixer();
+    LM_meter_t *meter = LM_CreateMeter(config->rate);
+    float *left = (float*)malloc(sizeof(float) * LM_BLOCK_FRAMES);
+    float *right = (float*)malloc(sizeof(float) * LM_BLOCK_FRAMES);
+
+    int failed = !player || !mixer || !meter || !left || !right;
+
+    memset(result, 0, sizeof(LM_result_t));
+
+    if (!failed) {
+        XM_SetCurrentPlayer(player);
+        S_SetCurrentMixer(mixer);
+
+        failed = S_Init(module->num_channels, config->rate);
+    }
+
+    if (!failed) {
+        S_SetInterpolation(config->interpolation);
+        XM_InitPlayer(module);
+
+        u64 max_frames = config->max_seconds > 0 ? (u64)(config->max_seconds * config->rate) : ~0ULL;
+
+        while (result->frames < max_frames && !failed) {
+            u32 n = LM_BLOCK_FRAMES;
+            if (n > max_frames - result->frames)
+                n = (u32)(max_frames - result->frames);
+
+            n = XM_RenderFrames(left, right, n);
+            failed = LM_AddFrames(meter, left, right, n);
+
+            result->frames += n;
+            if (n < LM_BLOCK_FRAMES)
+                break;
+        }
+
+        XM_ShutdownPlayer();
+    }
+
+    XM_SetCurrentPlayer(saved_player);
+    S_SetCurrentMixer(saved_mixer);
+
+    if (!failed) {
+        result->loudness = LM_GetLoudness(meter);
+        result->gain = result->loudness > LM_SILENCE ? LM_REFERENCE - result->loudness : 0.0;
+        result->sample_peak = LM_GetSamplePeak(meter);
+        result->true_peak = LM_GetTruePeak(meter);
+    }
+
+    if (mixer)
+        S_DestroyMixer(mixer);
+
+    LM_DestroyMeter(meter);
+    free(player);
+    free(left);
+    free(right);
+
+    return failed;
+}
@@ -0,0 +1,60 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "types.h"
+#include "xm.h"
+
+
+// ----------------------------------------------------------------------------
+// Loudness analysis (loudness.cpp)
+// ----------------------------------------------------------------------------
+
+// A streaming ITU-R BS.1770 meter: K-weighting, 400 ms blocks every 100 ms,
+// the absolute gate at -70 LUFS and the relative one 10 LU below.  Only the
+// block energies are kept, never the audio.  The true peak comes from 4x
+// oversampling (2x at 96 kHz and up, none from 192 kHz) through a 48 tap
+// windowed sinc.  A meter is used by one thread at a time.
+
+#define LM_SILENCE   (-1e9)   // no block passed the gates
+#define LM_REFERENCE (-18.0)  // ReplayGain 2.0 reference loudness, LUFS
+
+typedef struct LM_meter_t LM_meter_t;
+
+LM_meter_t *LM_CreateMeter(u32 rate);
+void LM_DestroyMeter(LM_meter_t *meter);
+
+// returns non-zero when out of memory for the block energies
+int LM_AddFrames(LM_meter_t *meter, const float *left, const float *right, u32 num_frames);
+
+// LUFS, LM_SILENCE for less than one block or only silence
+double LM_GetLoudness(const LM_meter_t *meter);
+
+// linear, 1.0 is full scale
+float LM_GetSamplePeak(const LM_meter_t *meter);
+float LM_GetTruePeak(const LM_meter_t *meter);
+
+
+// Renders a module offline on a player and mixer of its own and meters the
+// mix.  Any number of threads can analyze modules at once.
+
+typedef struct {
+    u32 rate;
+    u8 interpolation;
+    double max_seconds;   // stop there, 0 for the whole song
+} LM_config_t;
+
+typedef struct {
+    u64 frames;
+    double loudness;      // LUFS
+    double gain;          // dB to LM_REFERENCE, 0 for silence
+    float sample_peak;
+    float true_peak;
+} LM_result_t;
+
+void LM_DefaultConfig(LM_config_t *config);
+
+// returns 0 on success
+int LM_AnalyzeModule(XM_module_t *module, const LM_config_t *config, LM_result_t *result);
+
+
+#endif
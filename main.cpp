@@ -1,8 +1,18 @@
 #include <sys/time.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
 #include "audio.h"
+#include "engine.h"
+#include "playlist.h"
 #include "xm.h"
 
+// ticks run back to back before the rest of a backlog is dropped
+#define MAX_CATCHUP_TICKS 4
+
 int get_milliseconds()
 {
     struct timeval tv;
@@ -18,8 +28,115 @@ int get_milliseconds()
     return (tv.tv_sec - start) * 1000 + tv.tv_usec / 1000;
 }
 
+void *monitor_thread(void *arg)
+{
+    // scrape the realtime counters once a second
+    for (;;) {
+        sleep(1);
+        
+        S_health_t h;
+        S_GetHealth(&h);
+        
+        u32 avg_us = h.callbacks ? (u32)(h.total_render_ns / h.callbacks / 1000) : 0;
+        
+        fprintf(stderr, "render %u/%u/%u us (last/avg/max), %u misses, %u underruns, %u late ticks, %u dropped ticks, %u voices",
+                h.last_render_ns / 1000, avg_us, h.max_render_ns / 1000,
+                h.deadline_misses, h.underruns, h.late_ticks, h.dropped_ticks, h.active_voices);
+        
+        // the adaptive render thread also shows where it stands
+        if (arg)
+            fprintf(stderr, ", quality %u at %.0f%% load", E_GetQuality(), E_GetLoad() * 100.0f);
+        
+        fprintf(stderr, "\n");
+    }
+    
+    return 0;
+}
+
 int main (int argc, char **argv)
 {
+    int monitor = 0;
+    int engine = 0;
+    int crossfade_ms = -1;
+    
+    E_config_t config;
+    E_DefaultConfig(&config);
+    
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-m")) {
+            monitor = 1;
+        } else if (argc > 3 && !strcmp(argv[1], "-l")) {
+            engine = 1;
+            config.latency_ms = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (argc > 3 && !strcmp(argv[1], "-p")) {
+            config.priority = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (argc > 3 && !strcmp(argv[1], "-c")) {
+            config.cpu = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else if (!strcmp(argv[1], "-a")) {
+            config.adaptive = 1;
+        } else if (argc > 3 && !strcmp(argv[1], "-g")) {
+            config.gain = powf(10.0f, (float)atof(argv[2]) / 20.0f);
+            argv++;
+            argc--;
+        } else if (!strcmp(argv[1], "-k")) {
+            config.clip = S_CLIP_SOFT;
+        } else if (argc > 3 && !strcmp(argv[1], "-x")) {
+            crossfade_ms = atoi(argv[2]);
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+        
+        argv++;
+        argc--;
+    }
+    
+    if (argc < 2) {
+        printf("usage: XMPlayerCoreAudio [-m] [-l latency_ms [-p fifo_priority] [-c cpu] [-a] [-g gain_db] [-k]] module.xm\n");
+        printf("       XMPlayerCoreAudio [-m] [-x crossfade_ms] module.xm...\n");
+        return 1;
+    }
+    
+    // several modules play back to back from the playlist
+    if (argc > 2 || crossfade_ms >= 0) {
+        PL_config_t pl_config;
+        PL_DefaultConfig(&pl_config);
+        pl_config.crossfade_ms = crossfade_ms > 0 ? crossfade_ms : 0;
+        
+        if (PL_Start(&pl_config)) {
+            printf("Unable to start the playlist.\n");
+            return 2;
+        }
+        
+        for (int i = 1; i < argc; i++)
+            PL_Add(argv[i]);
+        
+        if (S_OpenOutput(PL_RenderFrames, pl_config.rate)) {
+            printf("Unable to open audio output.\n");
+            return 2;
+        }
+        
+        if (monitor) {
+            pthread_t thread;
+            pthread_create(&thread, 0, monitor_thread, 0);
+        }
+        
+        while (!PL_IsFinished())
+            usleep(100000);
+        
+        S_CloseOutput();
+        PL_Stop();
+        
+        return 0;
+    }
+    
     // load the module
     XM_module_t module;
     if (XM_LoadFile(argv[1], &module) < 0) {
@@ -28,10 +145,41 @@ int main (int argc, char **argv)
     }
     
     XM_InitPlayer(&module);
+    XM_player_state_t *player = XM_GetCurrentPlayer();
 
     int tick_duration = 1000 / (2 * module.default_bpm / 5);
     
-    S_Init(module.num_channels, 44100);
+    if (S_Init(module.num_channels, 44100)) {
+        printf("Unable to open audio output.\n");
+        return 2;
+    }
+    
+    // with a latency, a render thread runs ticks and mixing ahead into a ring
+    if (engine && E_Start(player, S_GetCurrentMixer(), &config)) {
+        printf("Unable to start the render thread.\n");
+        return 2;
+    }
+    
+    if (S_OpenOutput(engine ? E_ReadFrames : 0, 0)) {
+        printf("Unable to open audio output.\n");
+        return 2;
+    }
+    
+    if (monitor) {
+        pthread_t thread;
+        pthread_create(&thread, 0, monitor_thread, engine && config.adaptive ? &config : 0);
+    }
+    
+    if (engine) {
+        while (!E_IsFinished())
+            usleep(100000);
+        
+        S_CloseOutput();
+        E_Stop();
+        S_Shutdown();
+        
+        return 0;
+    }
     
     int t0, t1;
     int frameTime;
@@ -43,23 +191,41 @@ int main (int argc, char **argv)
         t1 = get_milliseconds();
         frameTime = 0;
             
-        // run a logic frame
-        while ((t1 - t0) > tick_duration) {
+        // run a logic frame, catching up at most a few ticks at once
+        int caught_up = 0;
+        
+        while ((t1 - t0) > tick_duration && caught_up < MAX_CATCHUP_TICKS) {
+            // the tick was due more than a tick ago
+            if ((t1 - t0) > 2 * tick_duration)
+                S_HealthRecordTicks(1, 0);
+            
+            // printing is not realtime safe, so the row is shown here
+            // rather than from inside the tick
+            u16 order = player->pattern_index, row = player->row;
+            int new_row = !XM_IsSongFinished() && player->tick % player->current_tempo == 0;
+            
             XM_RunTick();
+            
+            if (new_row)
+                XM_PrintRow(order, row);
                 
             tick_duration = 1000 / (2 * XM_GetCurrentBPM() / 5);
                 
             t0 += tick_duration;
             frameTime += tick_duration;
+            caught_up++;
             
             t1 = get_milliseconds();
         }
             
-        // discard pending time
-        if ((t1 - t0) > tick_duration)
+        // discard pending time, what is left after the catch-up is skipped
+        if ((t1 - t0) > tick_duration) {
+            S_HealthRecordTicks(0, (t1 - t0) / tick_duration - 1);
             t0 = t1 - tick_duration;
+        }
     }
     
+    S_CloseOutput();
     S_Shutdown();
     
     return 0;
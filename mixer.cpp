@@ -0,0 +1,761 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "mixer.h"
+#include "profile.h"
+#include "rtcheck.h"
+
+
+#define S_DEFAULT_RAMP 64
+
+
+struct s_soundsystem_state ss_default;
+
+// every thread mixes into the default mixer unless it selects its own
+static __thread struct s_soundsystem_state *ss = &ss_default;
+
+
+// ---------------------------------------------------------------------------
+
+// The per-frame helpers and the voice loop are templates over everything
+// that stays fixed for a voice during one block: sample format (8 bit, 16
+// bit or ADPCM), loop type, interpolation, stem mode and whether a volume ramp is
+// running.  S_RenderFrames picks the instance from s_mix_table, so no
+// per-frame code branches on any of them.
+
+// decodes the block holding frame i unless it is one of the two cached.  The
+// one further from the new block goes, so the pair follows the read
+// position across block boundaries in either direction.
+static inline s16 S_ReadAdpcm(s_voice_state *voice, s64 i)
+{
+    u32 block = (u32)((u64)i / S_ADPCM_BLOCK_FRAMES);
+    u32 k = (u32)((u64)i % S_ADPCM_BLOCK_FRAMES);
+
+    if (voice->adpcm_block[0] == block)
+        return voice->adpcm_frames[0][k];
+    if (voice->adpcm_block[1] == block)
+        return voice->adpcm_frames[1][k];
+
+    u32 d0 = voice->adpcm_block[0] > block ? voice->adpcm_block[0] - block : block - voice->adpcm_block[0];
+    u32 d1 = voice->adpcm_block[1] > block ? voice->adpcm_block[1] - block : block - voice->adpcm_block[1];
+    int slot = d0 >= d1 ? 0 : 1;
+
+    voice->adpcm_block[slot] = block;
+    S_DecodeAdpcmBlock((const u8*)voice->sample_data + (size_t)block * S_ADPCM_BLOCK_BYTES, voice->adpcm_frames[slot]);
+
+    return voice->adpcm_frames[slot][k];
+}
+
+template <int format, int loop>
+static inline float S_ReadFrame(s_voice_state *voice, s64 i)
+{
+    // resolve frames outside the sample according to the loop mode
+    if (loop == S_LOOP_FWD && i >= voice->sample_loop_end) {
+        s64 loop_length = voice->sample_loop_end - voice->sample_loop_start;
+        i = voice->sample_loop_start + (i - voice->sample_loop_start) % loop_length;
+    } else if (loop == S_LOOP_PP && i >= voice->sample_loop_end) {
+        i = 2 * (s64)voice->sample_loop_end - 1 - i;
+        if (i < voice->sample_loop_start)
+            i = voice->sample_loop_start;
+    }
+
+    if (i < 0 || i >= voice->sample_length)
+        return 0.0f;
+
+    if (format == 1)
+        return (float)((s8*)voice->sample_data)[i] / 127.0f;
+    else if (format == 2)
+        return (float)((s16*)voice->sample_data)[i] / 32767.0f;
+    else
+        return (float)S_ReadAdpcm(voice, i) / 32767.0f;
+}
+
+template <int format, int loop, int interp>
+static inline float S_InterpolateFrame(s_voice_state *voice)
+{
+    s64 i = voice->sample_pos >> S_FRAC_BITS;
+    float t = (float)(voice->sample_pos & S_FRAC_MASK) * (1.0f / 4294967296.0f);
+
+    if (interp == S_INTERP_NEAREST)
+        return S_ReadFrame<format, loop>(voice, i);
+
+    if (interp == S_INTERP_LINEAR) {
+        float s0 = S_ReadFrame<format, loop>(voice, i);
+        float s1 = S_ReadFrame<format, loop>(voice, i + 1);
+        return s0 + (s1 - s0) * t;
+    }
+
+    // catmull-rom spline through four neighbouring frames
+    float sm = S_ReadFrame<format, loop>(voice, i - 1);
+    float s0 = S_ReadFrame<format, loop>(voice, i);
+    float s1 = S_ReadFrame<format, loop>(voice, i + 1);
+    float s2 = S_ReadFrame<format, loop>(voice, i + 2);
+
+    float a = -0.5f * sm + 1.5f * s0 - 1.5f * s1 + 0.5f * s2;
+    float b = sm - 2.5f * s0 + 2.0f * s1 - 0.5f * s2;
+    float c = -0.5f * sm + 0.5f * s1;
+
+    return ((a * t + b) * t + c) * t + s0;
+}
+
+template <int loop>
+static inline int S_AdvanceVoice(s_voice_state *voice)
+{
+    voice->sample_pos += voice->sample_dir * voice->sample_step;
+
+    s64 loop_start = (s64)voice->sample_loop_start << S_FRAC_BITS;
+    s64 loop_end = (s64)voice->sample_loop_end << S_FRAC_BITS;
+
+    if (loop == S_LOOP_FWD) {
+        while (voice->sample_pos >= loop_end)
+            voice->sample_pos -= loop_end - loop_start;
+        return 1;
+    }
+
+    if (loop == S_LOOP_PP) {
+        // bounce between the first and last frame of the loop
+        loop_end -= S_FRAC_ONE;
+
+        while (voice->sample_pos > loop_end || voice->sample_pos < loop_start) {
+            if (voice->sample_pos > loop_end) {
+                voice->sample_pos = 2 * loop_end - voice->sample_pos;
+                voice->sample_dir = -1;
+            } else {
+                voice->sample_pos = 2 * loop_start - voice->sample_pos;
+                voice->sample_dir = 1;
+            }
+
+            if (loop_end <= loop_start) {
+                voice->sample_pos = loop_start;
+                break;
+            }
+        }
+        return 1;
+    }
+
+    return (voice->sample_pos >> S_FRAC_BITS) < voice->sample_length;
+}
+
+static inline u8 S_ClassifyVoice(const s_voice_state *voice)
+{
+    if (!voice->sample_data || (voice->sample_pos >> S_FRAC_BITS) >= voice->sample_length)
+        return S_VOICE_FINISHED;
+
+    if (voice->muted || (voice->gain_left == 0.0f && voice->gain_right == 0.0f && !voice->ramp_frames))
+        return S_VOICE_SILENT;
+
+    return S_VOICE_ACTIVE;
+}
+
+// Move a silent voice on by num_frames without reading it.  Lands on exactly
+// the position and direction the per-frame loop would reach, so the voice
+// picks up seamlessly once it becomes audible again.
+static void S_SkipVoice(s_voice_state *voice, u32 num_frames)
+{
+    s64 loop_start = (s64)voice->sample_loop_start << S_FRAC_BITS;
+    s64 loop_end = (s64)voice->sample_loop_end << S_FRAC_BITS;
+    s64 step = voice->sample_step;
+    s64 distance = step * num_frames;
+
+    if (voice->sample_dir > 0 && step > 0) {
+        switch (voice->sample_loop_type) {
+            case S_LOOP_FWD:
+                voice->sample_pos += distance;
+                if (voice->sample_pos >= loop_end)
+                    voice->sample_pos = loop_start + (voice->sample_pos - loop_start) % (loop_end - loop_start);
+                return;
+
+            case S_LOOP_NONE: {
+                s64 end = (s64)voice->sample_length << S_FRAC_BITS;
+
+                // stop on the first step past the end
+                if (voice->sample_pos + distance >= end)
+                    distance = (end - voice->sample_pos + step - 1) / step * step;
+
+                voice->sample_pos += distance;
+                return;
+            }
+        }
+    }
+
+    s64 last = loop_end - S_FRAC_ONE;
+    s64 period = 2 * (last - loop_start);
+
+    if (voice->sample_loop_type == S_LOOP_PP && period > 0 &&
+        voice->sample_pos >= loop_start && voice->sample_pos <= last) {
+        // unfold the bounce into a forward loop of twice the length
+        s64 u = voice->sample_pos - loop_start;
+        if (voice->sample_dir < 0)
+            u = period - u;
+
+        u = (u + distance) % period;
+
+        voice->sample_dir = u <= period / 2 ? 1 : -1;
+        voice->sample_pos = loop_start + (u <= period / 2 ? u : period - u);
+        return;
+    }
+
+    // backwards one-shots, voices before a ping-pong loop and the like
+    for (u32 k = 0; k < num_frames; k++) {
+        switch (voice->sample_loop_type) {
+            case S_LOOP_FWD: S_AdvanceVoice<S_LOOP_FWD>(voice); break;
+            case S_LOOP_PP: S_AdvanceVoice<S_LOOP_PP>(voice); break;
+
+            default:
+                if (!S_AdvanceVoice<S_LOOP_NONE>(voice))
+                    return;
+        }
+    }
+}
+
+// finish the part of a volume ramp a muted voice would have played
+static inline void S_SkipRamp(s_voice_state *voice, u32 num_frames)
+{
+    for (u32 k = 0; k < num_frames && voice->ramp_frames; k++) {
+        voice->gain_left += voice->ramp_left;
+        voice->gain_right += voice->ramp_right;
+
+        if (--voice->ramp_frames == 0) {
+            voice->gain_left = voice->target_left;
+            voice->gain_right = voice->target_right;
+        }
+    }
+}
+
+static void S_UpdateVoiceGain(s_voice_state *voice)
+{
+    float vol = (float)voice->volume / 127.0f;
+
+    voice->target_left = vol * (float)(255 - voice->panning) / 255.0f;
+    voice->target_right = vol * (float)voice->panning / 255.0f;
+
+    if (!ss->ramp_length) {
+        voice->gain_left = voice->target_left;
+        voice->gain_right = voice->target_right;
+        voice->ramp_frames = 0;
+        return;
+    }
+
+    voice->ramp_frames = ss->ramp_length;
+    voice->ramp_left = (voice->target_left - voice->gain_left) / ss->ramp_length;
+    voice->ramp_right = (voice->target_right - voice->gain_right) / ss->ramp_length;
+}
+
+#define S_STEMS_NONE   0
+#define S_STEMS_MONO   1
+#define S_STEMS_STEREO 2
+
+// mixes until the block ends or a one-shot voice runs out, returns the
+// number of frames mixed.  The ramp instances must not outlast the ramp.
+template <int format, int loop, int interp, int stems, int ramp>
+static u32 S_MixVoice(s_voice_state *voice, float *left, float *right,
+                      float *stem_left, float *stem_right, u32 num_frames)
+{
+    float gain_left = voice->gain_left;
+    float gain_right = voice->gain_right;
+
+    for (u32 k = 0; k < num_frames; k++) {
+        // looped voices never run past their end
+        if (loop == S_LOOP_NONE && (voice->sample_pos >> S_FRAC_BITS) >= voice->sample_length)
+            return k;
+
+        float s = S_InterpolateFrame<format, loop, interp>(voice);
+        float l = s * gain_left;
+        float r = s * gain_right;
+
+        left[k] += l;
+        right[k] += r;
+
+        // the stems reuse the resampled frame, mono ones sum both sides
+        if (stems == S_STEMS_STEREO) {
+            stem_left[k] = l;
+            stem_right[k] = r;
+        } else if (stems == S_STEMS_MONO) {
+            stem_left[k] = l + r;
+        }
+
+        if (ramp) {
+            gain_left += voice->ramp_left;
+            gain_right += voice->ramp_right;
+
+            if (--voice->ramp_frames == 0) {
+                gain_left = voice->target_left;
+                gain_right = voice->target_right;
+            }
+        }
+
+        if (!S_AdvanceVoice<loop>(voice)) {
+            voice->gain_left = gain_left;
+            voice->gain_right = gain_right;
+            return k + 1;
+        }
+    }
+
+    voice->gain_left = gain_left;
+    voice->gain_right = gain_right;
+    return num_frames;
+}
+
+typedef u32 (*s_mix_func)(s_voice_state *voice, float *left, float *right,
+                          float *stem_left, float *stem_right, u32 num_frames);
+
+#define S_MIX_RAMP(f, l, i, s)  { S_MixVoice<f, l, i, s, 0>, S_MixVoice<f, l, i, s, 1> }
+#define S_MIX_STEMS(f, l, i)    { S_MIX_RAMP(f, l, i, 0), S_MIX_RAMP(f, l, i, 1), S_MIX_RAMP(f, l, i, 2) }
+#define S_MIX_INTERP(f, l)      { S_MIX_STEMS(f, l, 0), S_MIX_STEMS(f, l, 1), S_MIX_STEMS(f, l, 2) }
+#define S_MIX_LOOP(f)           { S_MIX_INTERP(f, 0), S_MIX_INTERP(f, 1), S_MIX_INTERP(f, 2) }
+
+// [format - 1][loop type][interpolation][stem mode][ramp]
+static const s_mix_func s_mix_table[3][3][3][3][2] = { S_MIX_LOOP(1), S_MIX_LOOP(2), S_MIX_LOOP(S_FORMAT_ADPCM) };
+
+static void S_MixVoices(float *left, float *right, u32 num_frames)
+{
+    memset(left, 0, sizeof(float) * num_frames);
+    memset(right, 0, sizeof(float) * num_frames);
+
+    ss->active_voices = 0;
+
+    for (int v = 0; v < ss->num_voices; v++) {
+        s_voice_state *voice = &ss->voices[v];
+
+        float *stem_left = ss->stem_left ? ss->stem_left[v] + ss->stem_pos : 0;
+        float *stem_right = ss->stem_right ? ss->stem_right[v] + ss->stem_pos : 0;
+
+        if (stem_left)
+            memset(stem_left, 0, sizeof(float) * num_frames);
+        if (stem_right)
+            memset(stem_right, 0, sizeof(float) * num_frames);
+
+        // finished voices cost nothing, silent and muted ones only advance
+        voice->state = S_ClassifyVoice(voice);
+
+        if (voice->state == S_VOICE_FINISHED)
+            continue;
+
+        if (voice->state == S_VOICE_SILENT) {
+            S_SkipVoice(voice, num_frames);
+            S_SkipRamp(voice, num_frames);
+            continue;
+        }
+
+        ss->active_voices++;
+
+        P_SCOPE1("S_MixVoice", "voice", v);
+
+        const s_mix_func (&mix)[2] = s_mix_table[voice->sample_format - 1][voice->sample_loop_type]
+                                                [ss->interpolation][stem_right ? S_STEMS_STEREO : stem_left ? S_STEMS_MONO : S_STEMS_NONE];
+
+        // run the ramp instance up to the end of the ramp, the plain one after
+        u32 done = 0;
+
+        if (voice->ramp_frames) {
+            u32 n = voice->ramp_frames < num_frames ? voice->ramp_frames : num_frames;
+
+            done = mix[1](voice, left, right, stem_left, stem_right, n);
+            if (done < n)
+                continue;
+        }
+
+        if (done < num_frames) {
+            mix[0](voice, left + done, right + done, stem_left ? stem_left + done : 0,
+                   stem_right ? stem_right + done : 0, num_frames - done);
+        }
+    }
+}
+
+// Every mixed frame stands for two output frames: the voices step twice as
+// far, the mix goes into the front of the buffers and is spread out from
+// the back, each frame followed by its midpoint with the one before.  An
+// odd block leaves the last mixed frame for the next one.
+static void S_RenderHalfRate(float *left, float *right, u32 num_frames)
+{
+    u32 k = 0;
+
+    if (ss->half_phase && num_frames) {
+        left[0] = ss->half_left;
+        right[0] = ss->half_right;
+        ss->half_phase = 0;
+        k = 1;
+    }
+
+    u32 m = (num_frames - k + 1) / 2;
+
+    if (m) {
+        float prev_left = k ? left[0] : ss->last_left;
+        float prev_right = k ? right[0] : ss->last_right;
+
+        for (int v = 0; v < ss->num_voices; v++)
+            ss->voices[v].sample_step <<= 1;
+
+        S_MixVoices(left + k, right + k, m);
+
+        for (int v = 0; v < ss->num_voices; v++)
+            ss->voices[v].sample_step >>= 1;
+
+        ss->half_left = left[k + m - 1];
+        ss->half_right = right[k + m - 1];
+
+        for (u32 j = m; j-- > 0; ) {
+            float l = left[k + j];
+            float r = right[k + j];
+            float pl = j ? left[k + j - 1] : prev_left;
+            float pr = j ? right[k + j - 1] : prev_right;
+
+            if (k + 2 * j + 1 < num_frames) {
+                left[k + 2 * j + 1] = l;
+                right[k + 2 * j + 1] = r;
+            } else {
+                ss->half_phase = 1;
+            }
+
+            left[k + 2 * j] = (pl + l) * 0.5f;
+            right[k + 2 * j] = (pr + r) * 0.5f;
+        }
+    }
+}
+
+void S_RenderFrames(float *left, float *right, u32 num_frames)
+{
+    RT_SCOPE();
+    P_SCOPE1("S_RenderFrames", "frames", num_frames);
+
+    if (ss->state_only) {
+        // every voice moves on exactly as if it had been mixed
+        for (int v = 0; v < ss->num_voices; v++) {
+            s_voice_state *voice = &ss->voices[v];
+
+            if (S_ClassifyVoice(voice) != S_VOICE_FINISHED) {
+                S_SkipVoice(voice, num_frames);
+                S_SkipRamp(voice, num_frames);
+            }
+        }
+
+        ss->active_voices = 0;
+        return;
+    }
+
+    if (ss->reference) {
+        S_RenderFramesReference(ss, left, right, num_frames);
+        return;
+    }
+
+    // stems stay at full rate, they are for offline use anyway
+    if (ss->half_rate && !ss->stem_left)
+        S_RenderHalfRate(left, right, num_frames);
+    else
+        S_MixVoices(left, right, num_frames);
+
+    if (num_frames) {
+        ss->last_left = left[num_frames - 1];
+        ss->last_right = right[num_frames - 1];
+    }
+
+    ss->stem_pos += num_frames;
+}
+
+
+// ---------------------------------------------------------------------------
+
+S_mixer_t *S_CreateMixer()
+{
+    return (S_mixer_t*)calloc(1, sizeof(struct s_soundsystem_state));
+}
+
+void S_DestroyMixer(S_mixer_t *mixer)
+{
+    if (ss == mixer)
+        ss = &ss_default;
+
+    free(mixer->voices);
+    free(mixer);
+}
+
+int S_CopyMixer(S_mixer_t *dst, const S_mixer_t *src)
+{
+    s_voice_state *voices = dst->voices;
+
+    if (dst->num_voices != src->num_voices) {
+        free(voices);
+        voices = (s_voice_state*)malloc(sizeof(s_voice_state) * (src->num_voices + 1));
+
+        if (!voices) {
+            dst->voices = 0;
+            dst->num_voices = 0;
+            return 1;
+        }
+    }
+
+    *dst = *src;
+    dst->voices = voices;
+    dst->stem_left = 0;
+    dst->stem_right = 0;
+    dst->state_only = 0;
+
+    memcpy(dst->voices, src->voices, sizeof(s_voice_state) * src->num_voices);
+
+    return 0;
+}
+
+void S_SetCurrentMixer(S_mixer_t *mixer)
+{
+    ss = mixer ? mixer : &ss_default;
+}
+
+S_mixer_t *S_GetCurrentMixer()
+{
+    return ss;
+}
+
+
+int S_Init(u8 num_voices, u32 rate)
+{
+    ss->mixing_rate = rate;
+    ss->interpolation = S_INTERP_LINEAR;
+    ss->ramp_length = S_DEFAULT_RAMP;
+    ss->quality = S_QUALITY_LINEAR;
+    ss->half_rate = 0;
+    ss->half_phase = 0;
+    ss->last_left = 0;
+    ss->last_right = 0;
+    ss->reference = 0;
+    ss->state_only = 0;
+    ss->stem_left = 0;
+    ss->stem_right = 0;
+
+    free(ss->voices);
+
+    ss->num_voices = num_voices;
+    ss->voices = (struct s_voice_state*)malloc(sizeof(struct s_voice_state) * num_voices);
+
+    if (!ss->voices)
+        return 1;
+
+    memset(ss->voices, 0, sizeof(struct s_voice_state) * num_voices);
+
+    for (int i = 0; i < num_voices; i++) {
+        ss->voices[i].sample_dir = 1;
+        ss->voices[i].panning = 0x80;
+    }
+
+    return 0;
+}
+
+void S_Shutdown()
+{
+    free(ss->voices);
+    ss->voices = 0;
+    ss->num_voices = 0;
+}
+
+u32 S_GetActiveVoices()
+{
+    return ss->active_voices;
+}
+
+u64 S_GetMemoryUsage()
+{
+    return sizeof(struct s_soundsystem_state) + (u64)ss->num_voices * sizeof(struct s_voice_state);
+}
+
+u8 S_GetVoiceState(u8 voice)
+{
+    if (voice >= ss->num_voices)
+        return S_VOICE_FINISHED;
+
+    return ss->voices[voice].state;
+}
+
+u32 S_GetMixingRate()
+{
+    return ss->mixing_rate;
+}
+
+void S_SetInterpolation(u8 mode)
+{
+    // anything past linear is cubic, as in the reference mixer
+    ss->interpolation = mode < S_INTERP_CUBIC ? mode : S_INTERP_CUBIC;
+    ss->quality = S_QUALITY_NEAREST - ss->interpolation;
+    ss->half_rate = 0;
+}
+
+void S_SetVolumeRamp(u32 frames)
+{
+    ss->ramp_length = frames;
+}
+
+void S_SetQuality(u8 tier)
+{
+    static const u8 interpolation[S_NUM_QUALITIES] = { S_INTERP_CUBIC, S_INTERP_LINEAR, S_INTERP_NEAREST, S_INTERP_NEAREST };
+
+    if (tier >= S_NUM_QUALITIES)
+        tier = S_NUM_QUALITIES - 1;
+
+    // the cheaper tiers ramp in half the time, so fewer frames take the
+    // ramp path
+    ss->interpolation = interpolation[tier];
+    ss->ramp_length = tier < S_QUALITY_NEAREST ? S_DEFAULT_RAMP : S_DEFAULT_RAMP / 2;
+    ss->quality = tier;
+
+    // half rate starts out from the last frame output
+    if (tier == S_QUALITY_HALF && !ss->half_rate)
+        ss->half_phase = 0;
+
+    ss->half_rate = tier == S_QUALITY_HALF;
+}
+
+u8 S_GetQuality()
+{
+    return ss->quality;
+}
+
+void S_SetStemBuffers(float **left, float **right)
+{
+    ss->stem_left = left;
+    ss->stem_right = left ? right : 0;
+    ss->stem_pos = 0;
+}
+
+void S_SetReferenceMode(u8 enable)
+{
+    ss->reference = enable;
+}
+
+void S_SetStateOnly(u8 enable)
+{
+    ss->state_only = enable;
+}
+
+u8 S_GetStateOnly()
+{
+    return ss->state_only;
+}
+
+static u8 S_VoicesMatch(const s_voice_state *a, const s_voice_state *b)
+{
+    return a->sample_format == b->sample_format && a->sample_length == b->sample_length &&
+           a->sample_loop_type == b->sample_loop_type && a->sample_loop_start == b->sample_loop_start &&
+           a->sample_loop_end == b->sample_loop_end && a->sample_data == b->sample_data &&
+           a->sample_pos == b->sample_pos && a->sample_step == b->sample_step && a->sample_dir == b->sample_dir &&
+           a->volume == b->volume && a->panning == b->panning &&
+           a->gain_left == b->gain_left && a->gain_right == b->gain_right &&
+           a->target_left == b->target_left && a->target_right == b->target_right &&
+           a->ramp_left == b->ramp_left && a->ramp_right == b->ramp_right &&
+           a->ramp_frames == b->ramp_frames && a->muted == b->muted;
+}
+
+u8 S_MixersMatch(const S_mixer_t *a, const S_mixer_t *b)
+{
+    if (a->mixing_rate != b->mixing_rate || a->interpolation != b->interpolation ||
+        a->ramp_length != b->ramp_length || a->reference != b->reference ||
+        a->state_only != b->state_only || a->stem_left || b->stem_left || a->num_voices != b->num_voices ||
+        a->half_rate || b->half_rate)
+        return 0;
+
+    for (int v = 0; v < a->num_voices; v++)
+        if (!S_VoicesMatch(&a->voices[v], &b->voices[v]))
+            return 0;
+
+    return 1;
+}
+
+
+void S_PlayVoice(u8 voice, u8 data_type, u32 length, void *data)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].sample_pos = 0;
+    ss->voices[voice].sample_dir = 1;
+    ss->voices[voice].sample_format = data_type;
+    ss->voices[voice].sample_length = length;
+    ss->voices[voice].sample_data = data;
+    ss->voices[voice].sample_loop_type = S_LOOP_NONE;
+    ss->voices[voice].sample_loop_start = 0;
+    ss->voices[voice].sample_loop_end = length;
+
+    ss->voices[voice].adpcm_block[0] = 0xFFFFFFFF;
+    ss->voices[voice].adpcm_block[1] = 0xFFFFFFFF;
+}
+
+void S_StopVoice(u8 voice)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].sample_pos = 0;
+    ss->voices[voice].sample_length = 0;
+    ss->voices[voice].sample_data = 0;
+}
+
+
+void S_SetVoiceVolume(u8 voice, u8 vol)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].volume = vol;
+    S_UpdateVoiceGain(&ss->voices[voice]);
+}
+
+void S_SetVoiceMute(u8 voice, u8 mute)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].muted = mute;
+}
+
+void S_SetVoicePanning(u8 voice, u8 panning)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].panning = panning;
+    S_UpdateVoiceGain(&ss->voices[voice]);
+}
+
+void S_SetVoiceFrequency(u8 voice, u32 freq)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    ss->voices[voice].sample_step = ((s64)freq << S_FRAC_BITS) / ss->mixing_rate;
+}
+
+void S_SetSampleOffset(u8 voice, u32 offset)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    s64 pos = (ss->voices[voice].sample_pos >> S_FRAC_BITS) + offset;
+
+    if (pos >= ss->voices[voice].sample_length)
+        pos = ss->voices[voice].sample_length;
+
+    ss->voices[voice].sample_pos = pos << S_FRAC_BITS;
+}
+
+void S_SetSampleLoop(u8 voice, u8 type, u32 start, u32 end)
+{
+    if (voice >= ss->num_voices)
+        return;
+
+    s_voice_state *v = &ss->voices[voice];
+
+    if (end > v->sample_length)
+        end = v->sample_length;
+
+    // both loop bits play ping-pong, as in FT2, anything else is no loop
+    if (type == (S_LOOP_FWD | S_LOOP_PP))
+        type = S_LOOP_PP;
+    else if (type > S_LOOP_PP)
+        type = S_LOOP_NONE;
+
+    // loops with length zero are skipped
+    if (start >= end)
+        type = S_LOOP_NONE;
+
+    v->sample_loop_type = type;
+    v->sample_loop_start = type ? start : 0;
+    v->sample_loop_end = type ? end : v->sample_length;
+}
@@ -0,0 +1,81 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "types.h"
+#include "audio.h"
+
+// private to the mixer implementations, everyone else goes through audio.h
+
+
+// sample positions are 32.32 fixed point
+#define S_FRAC_BITS 32
+#define S_FRAC_ONE  ((s64)1 << S_FRAC_BITS)
+#define S_FRAC_MASK (S_FRAC_ONE - 1)
+
+struct s_voice_state
+{
+    u8 sample_format;
+    u32 sample_length;
+    u8 sample_loop_type;
+    u32 sample_loop_start;
+    u32 sample_loop_end;
+    void *sample_data;
+
+    s64 sample_pos;
+    s64 sample_step;
+    s8 sample_dir;
+
+    u8 volume;
+    u8 panning;
+
+    float gain_left;
+    float gain_right;
+    float target_left;
+    float target_right;
+    float ramp_left;
+    float ramp_right;
+    u32 ramp_frames;
+    u8 muted;
+
+    u8 state;    // S_VOICE_*, as of the last render
+
+    // the last two ADPCM blocks decoded, by block number
+    u32 adpcm_block[2];
+    s16 adpcm_frames[2][S_ADPCM_BLOCK_FRAMES];
+};
+
+struct s_soundsystem_state
+{
+    u32 mixing_rate;
+    u8 interpolation;
+    u32 ramp_length;
+    u8 reference;
+    u8 state_only;
+    u32 active_voices;
+
+    u8 quality;
+    u8 half_rate;
+    u8 half_phase;            // the last frame mixed is still to be output
+    float half_left;          // that frame
+    float half_right;
+    float last_left;          // the last frame output, where half rate starts from
+    float last_right;
+
+    float **stem_left;
+    float **stem_right;
+    u32 stem_pos;
+
+    int num_voices;
+    struct s_voice_state *voices;
+};
+
+
+// adpcm.cpp
+extern const u16 s_adpcm_steps[89];
+extern const s8 s_adpcm_index[8];
+
+// mixer_ref.cpp
+void S_RenderFramesReference(struct s_soundsystem_state *mixer, float *left, float *right, u32 num_frames);
+
+
+#endif
@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "audio.h"
+#include "mixer.h"
+
+// Reference mixer: one frame and one voice at a time, every bounds and loop
+// check done per read.  It defines what the optimized paths in mixer.cpp
+// must produce and is deliberately kept free of any optimization.  It only
+// shares the voice state with mixer.cpp, never any code.
+
+
+// decodes from the start of the frame's block on every read
+static s16 R_ReadAdpcm(const s_voice_state *voice, s64 i)
+{
+    const u8 *block = (const u8*)voice->sample_data + i / S_ADPCM_BLOCK_FRAMES * S_ADPCM_BLOCK_BYTES;
+
+    s32 pred = (s16)(block[0] | block[1] << 8);
+    s32 index = block[2] > 88 ? 88 : block[2];
+
+    for (s64 k = 1; k <= i % S_ADPCM_BLOCK_FRAMES; k++) {
+        u8 code = (block[4 + (k - 1) / 2] >> ((k - 1) % 2 * 4)) & 0xF;
+        s32 step = s_adpcm_steps[index];
+        s32 diff = step / 8 + (code & 1 ? step / 4 : 0) + (code & 2 ? step / 2 : 0) + (code & 4 ? step : 0);
+
+        pred = code & 8 ? pred - diff : pred + diff;
+        if (pred > 32767) pred = 32767;
+        if (pred < -32768) pred = -32768;
+
+        index += s_adpcm_index[code & 7];
+        if (index > 88) index = 88;
+        if (index < 0) index = 0;
+    }
+
+    return (s16)pred;
+}
+
+static float R_ReadFrame(const s_voice_state *voice, s64 i)
+{
+    if (voice->sample_loop_type == S_LOOP_FWD && i >= voice->sample_loop_end) {
+        s64 loop_length = voice->sample_loop_end - voice->sample_loop_start;
+        i = voice->sample_loop_start + (i - voice->sample_loop_start) % loop_length;
+    }
+
+    if (voice->sample_loop_type == S_LOOP_PP && i >= voice->sample_loop_end) {
+        i = 2 * (s64)voice->sample_loop_end - 1 - i;
+        if (i < voice->sample_loop_start)
+            i = voice->sample_loop_start;
+    }
+
+    if (i < 0 || i >= voice->sample_length)
+        return 0.0f;
+
+    if (voice->sample_format == 1)
+        return (float)((s8*)voice->sample_data)[i] / 127.0f;
+
+    if (voice->sample_format == S_FORMAT_ADPCM)
+        return (float)R_ReadAdpcm(voice, i) / 32767.0f;
+
+    return (float)((s16*)voice->sample_data)[i] / 32767.0f;
+}
+
+static float R_Sample(const s_voice_state *voice, u8 interpolation)
+{
+    s64 i = voice->sample_pos >> S_FRAC_BITS;
+    float t = (float)(voice->sample_pos & S_FRAC_MASK) * (1.0f / 4294967296.0f);
+
+    if (interpolation == S_INTERP_NEAREST)
+        return R_ReadFrame(voice, i);
+
+    if (interpolation == S_INTERP_LINEAR) {
+        float s0 = R_ReadFrame(voice, i);
+        float s1 = R_ReadFrame(voice, i + 1);
+        return s0 + (s1 - s0) * t;
+    }
+
+    float sm = R_ReadFrame(voice, i - 1);
+    float s0 = R_ReadFrame(voice, i);
+    float s1 = R_ReadFrame(voice, i + 1);
+    float s2 = R_ReadFrame(voice, i + 2);
+
+    float a = -0.5f * sm + 1.5f * s0 - 1.5f * s1 + 0.5f * s2;
+    float b = sm - 2.5f * s0 + 2.0f * s1 - 0.5f * s2;
+    float c = -0.5f * sm + 0.5f * s1;
+
+    return ((a * t + b) * t + c) * t + s0;
+}
+
+static void R_Advance(s_voice_state *voice)
+{
+    voice->sample_pos += voice->sample_dir * voice->sample_step;
+
+    s64 loop_start = (s64)voice->sample_loop_start << S_FRAC_BITS;
+    s64 loop_end = (s64)voice->sample_loop_end << S_FRAC_BITS;
+
+    if (voice->sample_loop_type == S_LOOP_FWD) {
+        while (voice->sample_pos >= loop_end)
+            voice->sample_pos -= loop_end - loop_start;
+    }
+
+    if (voice->sample_loop_type == S_LOOP_PP) {
+        s64 last = loop_end - S_FRAC_ONE;
+
+        while (voice->sample_pos > last || voice->sample_pos < loop_start) {
+            if (voice->sample_pos > last) {
+                voice->sample_pos = 2 * last - voice->sample_pos;
+                voice->sample_dir = -1;
+            } else {
+                voice->sample_pos = 2 * loop_start - voice->sample_pos;
+                voice->sample_dir = 1;
+            }
+
+            if (last <= loop_start) {
+                voice->sample_pos = loop_start;
+                break;
+            }
+        }
+    }
+}
+
+static int R_Playing(const s_voice_state *voice)
+{
+    return voice->sample_data && (voice->sample_pos >> S_FRAC_BITS) < voice->sample_length;
+}
+
+static u8 R_State(const s_voice_state *voice)
+{
+    if (!R_Playing(voice))
+        return S_VOICE_FINISHED;
+
+    if (voice->muted || (voice->gain_left == 0.0f && voice->gain_right == 0.0f && voice->ramp_frames == 0))
+        return S_VOICE_SILENT;
+
+    return S_VOICE_ACTIVE;
+}
+
+void S_RenderFramesReference(s_soundsystem_state *mixer, float *left, float *right, u32 num_frames)
+{
+    mixer->active_voices = 0;
+
+    // zero gain voices are still mixed here, only their state says otherwise
+    for (int v = 0; v < mixer->num_voices; v++) {
+        mixer->voices[v].state = R_State(&mixer->voices[v]);
+        mixer->active_voices += mixer->voices[v].state == S_VOICE_ACTIVE;
+    }
+
+    for (u32 k = 0; k < num_frames; k++) {
+        left[k] = 0.0f;
+        right[k] = 0.0f;
+
+        for (int v = 0; v < mixer->num_voices; v++) {
+            s_voice_state *voice = &mixer->voices[v];
+
+            if (!R_Playing(voice))
+                continue;
+
+            if (!voice->muted) {
+                float s = R_Sample(voice, mixer->interpolation);
+
+                left[k] += s * voice->gain_left;
+                right[k] += s * voice->gain_right;
+            }
+
+            if (voice->ramp_frames) {
+                voice->gain_left += voice->ramp_left;
+                voice->gain_right += voice->ramp_right;
+
+                if (--voice->ramp_frames == 0) {
+                    voice->gain_left = voice->target_left;
+                    voice->gain_right = voice->target_right;
+                }
+            }
+
+            R_Advance(voice);
+        }
+    }
+}
@@ -0,0 +1,239 @@
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+#include "audio.h"
+#include "rtcheck.h"
+
+
+// frames shaped at a time, the scratch stays in L1
+#define S_OUTPUT_CHUNK 256
+
+
+// ---------------------------------------------------------------------------
+
+// The passes are templates over the clip mode and dither, as the mixer's
+// voice loop is over its modes, so the per-sample loops carry no branches
+// and vectorize.
+
+template <int clip>
+static void S_ShapeChannel(float gain, const float *in, float *out, u32 num_frames)
+{
+    const float knee = S_CLIP_KNEE;
+    const float range = 1.0f - S_CLIP_KNEE;
+
+    for (u32 k = 0; k < num_frames; k++) {
+        float x = in[k] * gain;
+
+        if (clip == S_CLIP_HARD) {
+            x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+        } else if (clip == S_CLIP_SOFT) {
+            // slope 1 at the knee, full scale only reached at infinity.  The
+            // overshoot is max(a - knee, 0) in arithmetic, a select there
+            // is split into branches and stops the loop vectorizing.
+            float a = fabsf(x);
+            float d = a - knee;
+            float over = 0.5f * (d + fabsf(d));
+            float y = a - over + range * over / (range + over);
+
+            x = copysignf(y, x);
+        }
+
+        out[k] = x;
+    }
+}
+
+// a TPDF value in (-1, 1), the difference of the two halves of a hash
+static inline float S_DitherNoise(u32 i)
+{
+    i ^= i >> 16;
+    i *= 0x7FEB352D;
+    i ^= i >> 15;
+    i *= 0x846CA68B;
+    i ^= i >> 16;
+
+    return (float)((s32)(i & 0xFFFF) - (s32)(i >> 16)) * (1.0f / 65536.0f);
+}
+
+// scale to the integer range, dither and saturate in place, then round
+// half away from zero.  As one loop GCC folds the clamp and the rounding
+// into a branch and gives up on vectorizing it.
+template <int dither>
+static void S_QuantizeChannel(float *in, s32 *out, u32 num_frames, float scale, u32 noise, u32 stride)
+{
+    for (u32 k = 0; k < num_frames; k++) {
+        float y = in[k] * scale;
+
+        if (dither)
+            y += S_DitherNoise(noise + k * stride);
+
+        in[k] = y < -scale ? -scale : y > scale ? scale : y;
+    }
+
+    for (u32 k = 0; k < num_frames; k++)
+        out[k] = (s32)(in[k] + copysignf(0.5f, in[k]));
+}
+
+static void S_Shape(const S_output_t *output, const float *in, float *out, u32 num_frames)
+{
+    switch (output->clip) {
+        case S_CLIP_HARD: S_ShapeChannel<S_CLIP_HARD>(output->gain, in, out, num_frames); break;
+        case S_CLIP_SOFT: S_ShapeChannel<S_CLIP_SOFT>(output->gain, in, out, num_frames); break;
+        default:          S_ShapeChannel<S_CLIP_NONE>(output->gain, in, out, num_frames); break;
+    }
+}
+
+// shape and quantize up to S_OUTPUT_CHUNK frames of both channels, the
+// two channels take alternate dither positions
+static u8 S_Quantize(S_output_t *output, const float *left, const float *right, u32 num_frames,
+                     float scale, s32 *qleft, s32 *qright)
+{
+    float shaped[S_OUTPUT_CHUNK];
+    u8 channels = right ? 2 : 1;
+
+    for (u8 c = 0; c < channels; c++) {
+        S_Shape(output, c ? right : left, shaped, num_frames);
+
+        if (output->dither)
+            S_QuantizeChannel<1>(shaped, c ? qright : qleft, num_frames, scale, output->noise + c, channels);
+        else
+            S_QuantizeChannel<0>(shaped, c ? qright : qleft, num_frames, scale, 0, channels);
+    }
+
+    output->noise += num_frames * channels;
+    return channels;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void S_InitOutput(S_output_t *output, float gain, u8 clip, u8 dither)
+{
+    output->gain = gain;
+    output->clip = clip <= S_CLIP_SOFT ? clip : S_CLIP_HARD;
+    output->dither = dither;
+    output->noise = 0;
+}
+
+void S_ProcessOutput(S_output_t *output, float *left, float *right, u32 num_frames)
+{
+    RT_SCOPE();
+
+    if (output->gain == 1.0f && output->clip == S_CLIP_NONE)
+        return;
+
+    S_Shape(output, left, left, num_frames);
+
+    if (right)
+        S_Shape(output, right, right, num_frames);
+}
+
+void S_ConvertF32(S_output_t *output, const float *left, const float *right, float *out, u32 num_frames)
+{
+    RT_SCOPE();
+
+    float shaped[2][S_OUTPUT_CHUNK];
+
+    for (u32 done = 0; done < num_frames; done += S_OUTPUT_CHUNK) {
+        u32 n = num_frames - done < S_OUTPUT_CHUNK ? num_frames - done : S_OUTPUT_CHUNK;
+        float *dst = out + (right ? 2 * done : done);
+
+        if (!right) {
+            S_Shape(output, left + done, dst, n);
+            continue;
+        }
+
+        S_Shape(output, left + done, shaped[0], n);
+        S_Shape(output, right + done, shaped[1], n);
+
+        for (u32 k = 0; k < n; k++) {
+            dst[2 * k] = shaped[0][k];
+            dst[2 * k + 1] = shaped[1][k];
+        }
+    }
+}
+
+void S_ConvertS16(S_output_t *output, const float *left, const float *right, s16 *out, u32 num_frames)
+{
+    RT_SCOPE();
+
+    s32 q[2][S_OUTPUT_CHUNK];
+
+    for (u32 done = 0; done < num_frames; done += S_OUTPUT_CHUNK) {
+        u32 n = num_frames - done < S_OUTPUT_CHUNK ? num_frames - done : S_OUTPUT_CHUNK;
+        u8 channels = S_Quantize(output, left + done, right ? right + done : 0, n, 32767.0f, q[0], q[1]);
+        s16 *dst = out + channels * done;
+
+        if (channels == 1) {
+            for (u32 k = 0; k < n; k++)
+                dst[k] = (s16)q[0][k];
+            continue;
+        }
+
+        for (u32 k = 0; k < n; k++) {
+            dst[2 * k] = (s16)q[0][k];
+            dst[2 * k + 1] = (s16)q[1][k];
+        }
+    }
+}
+
+void S_ConvertS24(S_output_t *output, const float *left, const float *right, u8 *out, u32 num_frames)
+{
+    RT_SCOPE();
+
+    s32 q[2][S_OUTPUT_CHUNK];
+
+    for (u32 done = 0; done < num_frames; done += S_OUTPUT_CHUNK) {
+        u32 n = num_frames - done < S_OUTPUT_CHUNK ? num_frames - done : S_OUTPUT_CHUNK;
+        u8 channels = S_Quantize(output, left + done, right ? right + done : 0, n, 8388607.0f, q[0], q[1]);
+        u8 *dst = out + 3 * channels * done;
+
+        // three bytes do not fit a vector lane, packing is the one scalar pass
+        for (u32 k = 0; k < n; k++) {
+            for (u8 c = 0; c < channels; c++) {
+                s32 v = q[c][k];
+
+                dst[0] = (u8)v;
+                dst[1] = (u8)(v >> 8);
+                dst[2] = (u8)(v >> 16);
+                dst += 3;
+            }
+        }
+    }
+}
+
+void S_EnableFlushToZero()
+{
+#if defined(__SSE__) || defined(_M_X64)
+    // FTZ and DAZ
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#elif defined(__aarch64__)
+    u64 fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ULL << 24)));
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+    u32 fpscr;
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1u << 24)));
+#endif
+}
+
+u8 S_GetFlushToZero()
+{
+#if defined(__SSE__) || defined(_M_X64)
+    return (_mm_getcsr() & 0x8040) == 0x8040;
+#elif defined(__aarch64__)
+    u64 fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    return (fpcr >> 24) & 1;
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+    u32 fpscr;
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+    return (fpscr >> 24) & 1;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "audio.h"
+
+
+// the player and mixer as they were when a segment starts
+struct pr_segment
+{
+    XM_player_state_t player;
+    S_mixer_t *mixer;
+    u32 num_frames;
+
+    float *left;
+    float *right;
+    u8 done;
+    u8 failed;
+};
+
+struct pr_render
+{
+    pr_segment *segments;
+    int num_segments;
+
+    // workers stay within window segments of the writer to bound memory
+    int next;
+    int written;
+    int window;
+    u8 stop;
+    u8 flush_to_zero;    // as on the calling thread
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+
+// ---------------------------------------------------------------------------
+
+static int PR_AddSegment(pr_segment **segments, int *num_segments, int *capacity)
+{
+    if (*num_segments == *capacity) {
+        int n = *capacity ? 2 * *capacity : 64;
+        pr_segment *s = (pr_segment*)realloc(*segments, sizeof(pr_segment) * n);
+
+        if (!s)
+            return 1;
+
+        *segments = s;
+        *capacity = n;
+    }
+
+    pr_segment *seg = &(*segments)[*num_segments];
+    memset(seg, 0, sizeof(pr_segment));
+
+    seg->player = *XM_GetCurrentPlayer();
+    seg->mixer = S_CreateMixer();
+
+    if (!seg->mixer || S_CopyMixer(seg->mixer, S_GetCurrentMixer())) {
+        if (seg->mixer)
+            S_DestroyMixer(seg->mixer);
+        return 1;
+    }
+
+    (*num_segments)++;
+    return 0;
+}
+
+// run the song without mixing and snapshot each order as it starts
+static int PR_FindSegments(const PR_config_t *config, pr_render *r)
+{
+    XM_player_state_t *player = XM_GetCurrentPlayer();
+    int capacity = 0;
+    u16 order = 0xFFFF;
+    u64 frames = 0;
+
+    S_SetStateOnly(1);
+
+    for (;;) {
+        if (config->max_frames && frames >= config->max_frames)
+            break;
+
+        if (!player->tick_frames_left) {
+            if (XM_IsSongFinished())
+                break;
+
+            if (player->pattern_index != order) {
+                order = player->pattern_index;
+
+                if (PR_AddSegment(&r->segments, &r->num_segments, &capacity))
+                    return 1;
+            }
+        }
+
+        // one tick per call, either its first frame or the rest of it
+        u32 n = player->tick_frames_left ? player->tick_frames_left : 1;
+
+        if (config->max_frames && n > config->max_frames - frames)
+            n = (u32)(config->max_frames - frames);
+
+        n = XM_RenderFrames(0, 0, n);
+        if (!n)
+            break;
+
+        r->segments[r->num_segments - 1].num_frames += n;
+        frames += n;
+    }
+
+    S_SetStateOnly(0);
+    return 0;
+}
+
+static void *PR_Worker(void *arg)
+{
+    pr_render *r = (pr_render*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+
+        while (!r->stop && r->next < r->num_segments && r->next >= r->written + r->window)
+            pthread_cond_wait(&r->cond, &r->lock);
+
+        if (r->stop || r->next >= r->num_segments) {
+            pthread_mutex_unlock(&r->lock);
+            return 0;
+        }
+
+        pr_segment *seg = &r->segments[r->next++];
+        pthread_mutex_unlock(&r->lock);
+
+        seg->left = (float*)malloc(sizeof(float) * (seg->num_frames + 1));
+        seg->right = (float*)malloc(sizeof(float) * (seg->num_frames + 1));
+
+        if (seg->left && seg->right) {
+            // the same float mode as the caller, or the segments could differ
+            if (r->flush_to_zero)
+                S_EnableFlushToZero();
+
+            XM_SetCurrentPlayer(&seg->player);
+            S_SetCurrentMixer(seg->mixer);
+
+            seg->num_frames = XM_RenderFrames(seg->left, seg->right, seg->num_frames);
+        } else {
+            seg->failed = 1;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        seg->done = 1;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+
+void PR_DefaultConfig(PR_config_t *config)
+{
+    config->rate = 44100;
+    config->interpolation = S_INTERP_LINEAR;
+    config->num_threads = 0;
+    config->max_frames = 0;
+}
+
+s64 PR_RenderSong(XM_module_t *module, const PR_config_t *config, PR_write_func_t write, void *user)
+{
+    XM_player_state_t *saved_player = XM_GetCurrentPlayer();
+    S_mixer_t *saved_mixer = S_GetCurrentMixer();
+
+    XM_player_state_t *player = (XM_player_state_t*)calloc(1, sizeof(XM_player_state_t));
+    S_mixer_t *mixer = S_CreateMixer();
+
+    pr_render r;
+    memset(&r, 0, sizeof(r));
+
+    int num_threads = config->num_threads ? config->num_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    int failed = !player || !mixer;
+
+    if (!failed) {
+        XM_SetCurrentPlayer(player);
+        S_SetCurrentMixer(mixer);
+
+        failed = S_Init(module->num_channels, config->rate);
+    }
+
+    if (!failed) {
+        S_SetInterpolation(config->interpolation);
+        XM_InitPlayer(module);
+
+        failed = PR_FindSegments(config, &r);
+    }
+
+    XM_SetCurrentPlayer(saved_player);
+    S_SetCurrentMixer(saved_mixer);
+
+    s64 frames = 0;
+
+    if (!failed) {
+        pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+        int started = 0;
+
+        r.window = 2 * num_threads;
+        r.flush_to_zero = S_GetFlushToZero();
+        pthread_mutex_init(&r.lock, 0);
+        pthread_cond_init(&r.cond, 0);
+
+        while (threads && started < num_threads && !pthread_create(&threads[started], 0, PR_Worker, &r))
+            started++;
+
+        failed = !started;
+
+        // hand the segments over in song order as they complete
+        for (int i = 0; i < r.num_segments && !failed; i++) {
+            pr_segment *seg = &r.segments[i];
+
+            pthread_mutex_lock(&r.lock);
+            while (!seg->done)
+                pthread_cond_wait(&r.cond, &r.lock);
+            pthread_mutex_unlock(&r.lock);
+
+            if (seg->failed || (seg->num_frames && write(user, seg->left, seg->right, seg->num_frames)))
+                failed = 1;
+
+            frames += seg->num_frames;
+
+            free(seg->left);
+            free(seg->right);
+            seg->left = seg->right = 0;
+
+            pthread_mutex_lock(&r.lock);
+            r.written++;
+            pthread_cond_broadcast(&r.cond);
+            pthread_mutex_unlock(&r.lock);
+        }
+
+        pthread_mutex_lock(&r.lock);
+        r.stop = 1;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], 0);
+
+        pthread_cond_destroy(&r.cond);
+        pthread_mutex_destroy(&r.lock);
+        free(threads);
+    }
+
+    for (int i = 0; i < r.num_segments; i++) {
+        free(r.segments[i].left);
+        free(r.segments[i].right);
+        S_DestroyMixer(r.segments[i].mixer);
+    }
+
+    free(r.segments);
+
+    // the snapshots shared the frequency table, it goes last
+    if (player && player->module) {
+        XM_SetCurrentPlayer(player);
+        XM_ShutdownPlayer();
+        XM_SetCurrentPlayer(saved_player);
+    }
+
+    if (mixer)
+        S_DestroyMixer(mixer);
+
+    free(player);
+
+    return failed ? -1 : frames;
+}
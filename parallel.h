@@ -0,0 +1,35 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "types.h"
+#include "xm.h"
+
+
+// ----------------------------------------------------------------------------
+// Parallel song render (parallel.cpp)
+// ----------------------------------------------------------------------------
+
+// Renders one song on several threads with output sample-identical to a
+// serial XM_RenderFrames.  A state-only pass first runs every tick and
+// advances the voices without mixing, taking a snapshot of the player and
+// mixer at each order boundary.  The segments between snapshots are then
+// mixed concurrently and handed to the writer in song order.
+
+typedef struct {
+    u32 rate;
+    u8 interpolation;
+    u32 num_threads;    // 0 for one per CPU
+    u64 max_frames;     // 0 for the whole song
+} PR_config_t;
+
+// receives the whole song in order, a segment at a time; returning
+// non-zero stops the render
+typedef int (*PR_write_func_t)(void *user, const float *left, const float *right, u32 num_frames);
+
+void PR_DefaultConfig(PR_config_t *config);
+
+// returns the frames written, or -1 on failure
+s64 PR_RenderSong(XM_module_t *module, const PR_config_t *config, PR_write_func_t write, void *user);
+
+
+#endif
@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "playlist.h"
+#include "rtcheck.h"
+
+
+// frames mixed per step while two songs overlap
+#define PL_CHUNK 1024
+
+// how often the loader looks for work
+#define PL_POLL_NS 10000000ULL
+
+struct pl_song
+{
+    XM_module_t module;
+    XM_player_state_t player;
+    S_mixer_t *mixer;
+
+    u64 length;    // frames to play, from the state-only pass
+    u64 pos;
+
+    pl_song *next_retired;
+};
+
+struct pl_playlist
+{
+    PL_config_t config;
+    u32 fade_frames;
+
+    // files waiting to be loaded, only the loader and PL_Add touch them
+    pthread_mutex_t lock;
+    char **files;
+    int num_files;
+    int capacity;
+    int next_file;
+
+    // handed from the loader to the render side, and back on a lock-free
+    // stack to be freed
+    std::atomic<pl_song*> next;
+    std::atomic<pl_song*> retired;
+    std::atomic<u8> stop;
+
+    // files loaded, failed to load and songs played to the end
+    std::atomic<u32> loaded;
+    std::atomic<u32> failed;
+    std::atomic<u32> played;
+
+    // render side only
+    pl_song *current;
+    pl_song *fading;     // the outgoing song during a crossfade
+    u64 fade_pos;
+
+    float scratch_left[2][PL_CHUNK];
+    float scratch_right[2][PL_CHUNK];
+
+    u8 running;
+    pthread_t thread;
+} pl;
+
+
+// ---------------------------------------------------------------------------
+
+static void PL_Sleep(u64 ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+
+    nanosleep(&ts, 0);
+}
+
+static void PL_FreeSong(pl_song *song)
+{
+    XM_player_state_t *player = XM_GetCurrentPlayer();
+
+    XM_SetCurrentPlayer(&song->player);
+    XM_ShutdownPlayer();
+    XM_SetCurrentPlayer(player);
+
+    S_DestroyMixer(song->mixer);
+    XM_FreeModule(&song->module);
+    free(song);
+}
+
+// run the whole song without mixing to find where it ends
+static u64 PL_MeasureSong(pl_song *song)
+{
+    XM_player_state_t player = song->player;
+    S_mixer_t *mixer = S_CreateMixer();
+
+    if (!mixer || S_CopyMixer(mixer, song->mixer)) {
+        if (mixer)
+            S_DestroyMixer(mixer);
+        return 0;
+    }
+
+    u64 max_frames = pl.config.max_seconds > 0 ? (u64)(pl.config.max_seconds * pl.config.rate) : ~0ULL;
+    u64 frames = 0;
+
+    XM_SetCurrentPlayer(&player);
+    S_SetCurrentMixer(mixer);
+    S_SetStateOnly(1);
+
+    while (frames < max_frames) {
+        u32 n = max_frames - frames < 65536 ? (u32)(max_frames - frames) : 65536;
+        u32 done = XM_RenderFrames(0, 0, n);
+
+        frames += done;
+        if (done < n)
+            break;
+    }
+
+    XM_SetCurrentPlayer(0);
+    S_SetCurrentMixer(0);
+    S_DestroyMixer(mixer);
+
+    return frames;
+}
+
+static pl_song *PL_LoadSong(const char *file)
+{
+    pl_song *song = (pl_song*)calloc(1, sizeof(pl_song));
+    if (!song)
+        return 0;
+
+    if (XM_LoadFile(file, &song->module) < 0) {
+        fprintf(stderr, "%s: unable to load module\n", file);
+        free(song);
+        return 0;
+    }
+
+    song->mixer = S_CreateMixer();
+
+    if (song->mixer) {
+        S_SetCurrentMixer(song->mixer);
+
+        if (S_Init(song->module.num_channels, pl.config.rate)) {
+            S_DestroyMixer(song->mixer);
+            song->mixer = 0;
+        } else {
+            S_SetInterpolation(pl.config.interpolation);
+        }
+
+        S_SetCurrentMixer(0);
+    }
+
+    if (!song->mixer) {
+        XM_FreeModule(&song->module);
+        free(song);
+        return 0;
+    }
+
+    XM_SetCurrentPlayer(&song->player);
+    XM_InitPlayer(&song->module);
+    XM_SetCurrentPlayer(0);
+
+    song->length = PL_MeasureSong(song);
+
+    // nothing to play, not even silence
+    if (!song->length) {
+        PL_FreeSong(song);
+        return 0;
+    }
+
+    return song;
+}
+
+static void *PL_LoaderThread(void *)
+{
+    while (!pl.stop.load(std::memory_order_acquire)) {
+        pl_song *retired = pl.retired.exchange(0, std::memory_order_acq_rel);
+
+        while (retired) {
+            pl_song *next = retired->next_retired;
+            PL_FreeSong(retired);
+            retired = next;
+        }
+
+        // keep one song ready behind the current one
+        if (!pl.next.load(std::memory_order_acquire)) {
+            char *file = 0;
+
+            pthread_mutex_lock(&pl.lock);
+            if (pl.next_file < pl.num_files)
+                file = pl.files[pl.next_file++];
+            pthread_mutex_unlock(&pl.lock);
+
+            if (file) {
+                pl_song *song = PL_LoadSong(file);
+
+                if (song) {
+                    pl.next.store(song, std::memory_order_release);
+                    pl.loaded.fetch_add(1, std::memory_order_release);
+                } else
+                    pl.failed.fetch_add(1, std::memory_order_release);
+                continue;
+            }
+        }
+
+        PL_Sleep(PL_POLL_NS);
+    }
+
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+static u32 PL_RenderSong(pl_song *song, float *left, float *right, u32 num_frames)
+{
+    if (num_frames > song->length - song->pos)
+        num_frames = (u32)(song->length - song->pos);
+
+    XM_SetCurrentPlayer(&song->player);
+    S_SetCurrentMixer(song->mixer);
+
+    u32 n = XM_RenderFrames(left, right, num_frames);
+
+    // a short render ends the song early rather than stalling on it
+    if (n < num_frames)
+        song->length = song->pos + n;
+
+    song->pos += n;
+    return n;
+}
+
+static void PL_Retire(pl_song *song)
+{
+    pl_song *head = pl.retired.load(std::memory_order_relaxed);
+
+    do {
+        song->next_retired = head;
+    } while (!pl.retired.compare_exchange_weak(head, song, std::memory_order_release, std::memory_order_relaxed));
+
+    pl.played.fetch_add(1, std::memory_order_release);
+}
+
+// mix the last frames of the fading song into the first of the current one
+static u32 PL_RenderCrossfade(float *left, float *right, u32 num_frames)
+{
+    if (num_frames > PL_CHUNK)
+        num_frames = PL_CHUNK;
+
+    u32 out = PL_RenderSong(pl.fading, pl.scratch_left[0], pl.scratch_right[0], num_frames);
+    u32 in = PL_RenderSong(pl.current, pl.scratch_left[1], pl.scratch_right[1], num_frames);
+    u32 n = out > in ? out : in;
+
+    for (u32 k = 0; k < n; k++) {
+        float g = pl.fade_pos + k < pl.fade_frames ? (float)(pl.fade_pos + k) / pl.fade_frames : 1.0f;
+        float l = k < in ? pl.scratch_left[1][k] * g : 0.0f;
+        float r = k < in ? pl.scratch_right[1][k] * g : 0.0f;
+
+        if (k < out) {
+            l += pl.scratch_left[0][k] * (1.0f - g);
+            r += pl.scratch_right[0][k] * (1.0f - g);
+        }
+
+        left[k] = l;
+        right[k] = r;
+    }
+
+    pl.fade_pos += n;
+
+    if (pl.fading->pos == pl.fading->length) {
+        PL_Retire(pl.fading);
+        pl.fading = 0;
+    }
+
+    return n;
+}
+
+u32 PL_RenderFrames(float *left, float *right, u32 num_frames)
+{
+    RT_SCOPE();
+
+    XM_player_state_t *player = XM_GetCurrentPlayer();
+    S_mixer_t *mixer = S_GetCurrentMixer();
+
+    u64 t0 = S_GetTimeNanos();
+    u32 done = 0;
+
+    while (done < num_frames) {
+        if (!pl.current) {
+            pl.current = pl.next.exchange(0, std::memory_order_acq_rel);
+            if (!pl.current)
+                break;
+        }
+
+        if (pl.fading) {
+            u32 n = PL_RenderCrossfade(left + done, right + done, num_frames - done);
+            done += n;
+
+            if (!n)
+                break;
+            continue;
+        }
+
+        // the crossfade starts so that the outgoing song ends with it
+        u64 fade_start = pl.current->length > pl.fade_frames ? pl.current->length - pl.fade_frames : 0;
+
+        if (pl.current->pos >= fade_start) {
+            pl_song *next = pl.next.exchange(0, std::memory_order_acq_rel);
+
+            if (next) {
+                if (pl.fade_frames && pl.current->pos < pl.current->length) {
+                    pl.fading = pl.current;
+                    pl.fade_pos = 0;
+                } else {
+                    PL_Retire(pl.current);
+                }
+
+                pl.current = next;
+                continue;
+            }
+
+            // no song to go to yet, finish this one and wait
+            if (pl.current->pos == pl.current->length) {
+                PL_Retire(pl.current);
+                pl.current = 0;
+                break;
+            }
+        }
+
+        u32 n = num_frames - done;
+        if (pl.current->pos < fade_start && n > fade_start - pl.current->pos)
+            n = (u32)(fade_start - pl.current->pos);
+
+        done += PL_RenderSong(pl.current, left + done, right + done, n);
+    }
+
+    if (done < num_frames) {
+        memset(left + done, 0, sizeof(float) * (num_frames - done));
+        memset(right + done, 0, sizeof(float) * (num_frames - done));
+    }
+
+    // the voices of whichever song rendered last
+    // the current mixer may be the caller's again, which needs no rate
+    S_HealthRecordRenderAt(S_GetTimeNanos() - t0, num_frames, pl.config.rate, done ? S_GetActiveVoices() : 0);
+
+    XM_SetCurrentPlayer(player);
+    S_SetCurrentMixer(mixer);
+
+    return done;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void PL_DefaultConfig(PL_config_t *config)
+{
+    config->rate = 44100;
+    config->interpolation = S_INTERP_LINEAR;
+    config->crossfade_ms = 0;
+    config->max_seconds = 0;
+}
+
+int PL_Start(const PL_config_t *config)
+{
+    if (pl.running || !config->rate)
+        return 1;
+
+    pl.config = *config;
+    pl.fade_frames = (u32)((u64)config->crossfade_ms * config->rate / 1000);
+
+    pl.files = 0;
+    pl.num_files = 0;
+    pl.capacity = 0;
+    pl.next_file = 0;
+
+    pl.next.store(0);
+    pl.retired.store(0);
+    pl.stop.store(0);
+    pl.loaded.store(0);
+    pl.failed.store(0);
+    pl.played.store(0);
+
+    pl.current = 0;
+    pl.fading = 0;
+
+    pthread_mutex_init(&pl.lock, 0);
+
+    if (pthread_create(&pl.thread, 0, PL_LoaderThread, 0)) {
+        pthread_mutex_destroy(&pl.lock);
+        return 1;
+    }
+
+    pl.running = 1;
+    return 0;
+}
+
+void PL_Stop()
+{
+    if (!pl.running)
+        return;
+
+    pl.stop.store(1, std::memory_order_release);
+    pthread_join(pl.thread, 0);
+
+    pl_song *songs[] = { pl.current, pl.fading, pl.next.load() };
+
+    for (u32 i = 0; i < sizeof(songs) / sizeof(songs[0]); i++)
+        if (songs[i])
+            PL_FreeSong(songs[i]);
+
+    for (pl_song *song = pl.retired.exchange(0); song; ) {
+        pl_song *next = song->next_retired;
+        PL_FreeSong(song);
+        song = next;
+    }
+
+    for (int i = 0; i < pl.num_files; i++)
+        free(pl.files[i]);
+
+    free(pl.files);
+    pthread_mutex_destroy(&pl.lock);
+
+    pl.running = 0;
+}
+
+int PL_Add(const char *file)
+{
+    char *copy = strdup(file);
+    if (!copy)
+        return 1;
+
+    pthread_mutex_lock(&pl.lock);
+
+    if (pl.num_files == pl.capacity) {
+        int n = pl.capacity ? 2 * pl.capacity : 16;
+        char **files = (char**)realloc(pl.files, sizeof(char*) * n);
+
+        if (!files) {
+            pthread_mutex_unlock(&pl.lock);
+            free(copy);
+            return 1;
+        }
+
+        pl.files = files;
+        pl.capacity = n;
+    }
+
+    pl.files[pl.num_files++] = copy;
+    pthread_mutex_unlock(&pl.lock);
+
+    return 0;
+}
+
+u8 PL_IsFinished()
+{
+    // every file taken by the loader either failed or was played out
+    pthread_mutex_lock(&pl.lock);
+    int num_files = pl.num_files;
+    int taken = pl.next_file;
+    pthread_mutex_unlock(&pl.lock);
+
+    return taken == num_files &&
+           pl.failed.load(std::memory_order_acquire) + pl.played.load(std::memory_order_acquire) == (u32)num_files;
+}
+
+u8 PL_IsPreloaded()
+{
+    if (pl.next.load(std::memory_order_acquire))
+        return 1;
+
+    pthread_mutex_lock(&pl.lock);
+    int num_files = pl.num_files;
+    pthread_mutex_unlock(&pl.lock);
+
+    return pl.loaded.load(std::memory_order_acquire) + pl.failed.load(std::memory_order_acquire) == (u32)num_files;
+}
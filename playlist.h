@@ -0,0 +1,51 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include "types.h"
+#include "xm.h"
+#include "audio.h"
+
+
+// ----------------------------------------------------------------------------
+// Gapless playlist (playlist.cpp)
+// ----------------------------------------------------------------------------
+
+// Plays a queue of modules back to back.  A loader thread loads the next
+// module while the current one plays and measures its exact length with a
+// state-only pass, so the render side knows ahead of time where the song
+// ends and where a crossfade has to start.  Handover is sample-exact with no
+// gap, or a linear crossfade of the configured length, and the finished
+// song is freed back on the loader thread.  There is one playlist per
+// process.
+
+typedef struct {
+    u32 rate;
+    u8 interpolation;
+    u32 crossfade_ms;   // 0 for a gapless cut
+    double max_seconds; // play at most this much of each song, 0 for all
+} PL_config_t;
+
+void PL_DefaultConfig(PL_config_t *config);
+
+int PL_Start(const PL_config_t *config);
+void PL_Stop();
+
+// queue a module file, may be called any time from any thread
+int PL_Add(const char *file);
+
+// realtime safe, renders the playlist and fills any frames no song is
+// ready for with silence; returns the frames of music rendered.  Matches
+// S_render_func_t, so it can drive S_OpenOutput directly at the playlist's
+// rate.  The calling thread's mixer is left alone and needs no S_Init.
+u32 PL_RenderFrames(float *left, float *right, u32 num_frames);
+
+// every queued song has been played
+u8 PL_IsFinished();
+
+// the next song is loaded or there is nothing left to load.  An offline
+// render waits for this before every block, so handovers land exactly
+// where they would with a loader that always keeps up.
+u8 PL_IsPreloaded();
+
+
+#endif
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "preview.h"
+#include "audio.h"
+
+
+#define PV_BLOCK_FRAMES 4096
+#define PV_PEAK_BATCH   256
+#define PV_SKIP_FRAMES  (1 << 20)   // a state-only call at a time
+
+// takes every block of the preview in order, non-zero stops the render
+typedef int (*pv_block_func)(void *ctx, const float *frames, u32 num_frames);
+
+struct pv_peaks
+{
+    PV_peak_func_t write;
+    void *user;
+
+    u64 num_frames;     // of the whole preview, with num_windows
+    u32 num_windows;
+    u32 window_frames;
+
+    u64 window;         // the one being measured
+    u64 frame;
+    u32 count;
+    float min;
+    float max;
+    double squares;
+
+    PV_peak_t batch[PV_PEAK_BATCH];
+    u32 num_batch;
+    u64 written;
+};
+
+struct pv_pcm
+{
+    PV_write_func_t write;
+    void *user;
+};
+
+
+// ---------------------------------------------------------------------------
+
+static u64 PV_StartFrame(const PV_config_t *config)
+{
+    return config->start > 0 ? (u64)(config->start * config->rate) : 0;
+}
+
+static u64 PV_MaxFrames(const PV_config_t *config)
+{
+    return config->seconds > 0 ? (u64)(config->seconds * config->rate) : ~0ULL;
+}
+
+// set up the current player and mixer and run them up to the start
+static int PV_Begin(XM_module_t *module, const PV_config_t *config)
+{
+    if (S_Init(module->num_channels, config->rate))
+        return 1;
+
+    // a preview only needs the shape of the song
+    S_SetInterpolation(S_INTERP_NEAREST);
+    S_SetVolumeRamp(0);
+
+    XM_InitPlayer(module);
+
+    u64 skip = PV_StartFrame(config);
+
+    S_SetStateOnly(1);
+
+    while (skip) {
+        u32 n = skip < PV_SKIP_FRAMES ? (u32)skip : PV_SKIP_FRAMES;
+
+        n = XM_RenderFrames(0, 0, n);
+        if (!n)
+            break;
+
+        skip -= n;
+    }
+
+    S_SetStateOnly(0);
+    return 0;
+}
+
+// the frames the preview will have, without mixing them
+static int PV_Measure(XM_module_t *module, const PV_config_t *config, u64 *num_frames)
+{
+    if (PV_Begin(module, config))
+        return 1;
+
+    u64 max_frames = PV_MaxFrames(config);
+    u64 frames = 0;
+
+    S_SetStateOnly(1);
+
+    while (frames < max_frames) {
+        u32 n = max_frames - frames < PV_SKIP_FRAMES ? (u32)(max_frames - frames) : PV_SKIP_FRAMES;
+
+        n = XM_RenderFrames(0, 0, n);
+        if (!n)
+            break;
+
+        frames += n;
+    }
+
+    S_SetStateOnly(0);
+
+    XM_ShutdownPlayer();
+
+    *num_frames = frames;
+    return 0;
+}
+
+// renders the preview on a player and mixer of its own, measuring it
+// first when asked to
+static s64 PV_Render(XM_module_t *module, const PV_config_t *config, u64 *measure, pv_block_func block, void *ctx)
+{
+    XM_player_state_t *saved_player = XM_GetCurrentPlayer();
+    S_mixer_t *saved_mixer = S_GetCurrentMixer();
+
+    XM_player_state_t *player = (XM_player_state_t*)calloc(1, sizeof(XM_player_state_t));
+    S_mixer_t *mixer = S_CreateMixer();
+    float *frames = (float*)malloc(sizeof(float) * PV_BLOCK_FRAMES);
+
+    int failed = !player || !mixer || !frames || !config->rate;
+    s64 total = 0;
+
+    if (!failed) {
+        XM_SetCurrentPlayer(player);
+        S_SetCurrentMixer(mixer);
+
+        if (measure)
+            failed = PV_Measure(module, config, measure);
+
+        if (!failed)
+            failed = PV_Begin(module, config);
+    }
+
+    if (!failed) {
+        u64 max_frames = PV_MaxFrames(config);
+
+        while ((u64)total < max_frames) {
+            u32 n = PV_BLOCK_FRAMES;
+            if (n > max_frames - total)
+                n = (u32)(max_frames - total);
+
+            // both sides mix into the one buffer, which sums them
+            n = XM_RenderFrames(frames, frames, n);
+
+            for (u32 k = 0; k < n; k++)
+                frames[k] *= 0.5f;
+
+            if (n && block(ctx, frames, n)) {
+                failed = 1;
+                break;
+            }
+
+            total += n;
+            if (n < PV_BLOCK_FRAMES)
+                break;
+        }
+
+        XM_ShutdownPlayer();
+    }
+
+    XM_SetCurrentPlayer(saved_player);
+    S_SetCurrentMixer(saved_mixer);
+
+    if (mixer)
+        S_DestroyMixer(mixer);
+
+    free(player);
+    free(frames);
+
+    return failed ? -1 : total;
+}
+
+static int PV_WritePcm(void *ctx, const float *frames, u32 num_frames)
+{
+    pv_pcm *pcm = (pv_pcm*)ctx;
+    return pcm->write(pcm->user, frames, num_frames);
+}
+
+
+// ---------------------------------------------------------------------------
+
+static int PV_FlushPeaks(pv_peaks *p)
+{
+    if (!p->num_batch)
+        return 0;
+
+    int stop = p->write(p->user, p->batch, p->num_batch);
+
+    p->written += p->num_batch;
+    p->num_batch = 0;
+
+    return stop;
+}
+
+static int PV_EndWindow(pv_peaks *p)
+{
+    PV_peak_t *peak = &p->batch[p->num_batch++];
+
+    peak->min = p->count ? p->min : 0.0f;
+    peak->max = p->count ? p->max : 0.0f;
+    peak->rms = p->count ? (float)sqrt(p->squares / p->count) : 0.0f;
+
+    p->window++;
+    p->count = 0;
+    p->squares = 0;
+
+    return p->num_batch == PV_PEAK_BATCH ? PV_FlushPeaks(p) : 0;
+}
+
+// the frame the current window ends at, windows of a known number share
+// out the preview as evenly as whole frames allow
+static u64 PV_WindowEnd(const pv_peaks *p)
+{
+    if (!p->num_windows)
+        return (p->window + 1) * p->window_frames;
+
+    if (p->window >= p->num_windows)
+        return ~0ULL;
+
+    return (p->window + 1) * p->num_frames / p->num_windows;
+}
+
+static int PV_AddPeakFrames(void *ctx, const float *frames, u32 num_frames)
+{
+    pv_peaks *p = (pv_peaks*)ctx;
+    u32 k = 0;
+
+    while (k < num_frames) {
+        u64 end = PV_WindowEnd(p);
+
+        if (p->frame >= end) {
+            if (PV_EndWindow(p))
+                return 1;
+            continue;
+        }
+
+        u32 n = end - p->frame < num_frames - k ? (u32)(end - p->frame) : num_frames - k;
+        float lo = p->count ? p->min : frames[k];
+        float hi = p->count ? p->max : frames[k];
+        double squares = 0;
+
+        for (u32 j = k; j < k + n; j++) {
+            float s = frames[j];
+
+            lo = s < lo ? s : lo;
+            hi = s > hi ? s : hi;
+            squares += s * s;
+        }
+
+        p->min = lo;
+        p->max = hi;
+        p->squares += squares;
+        p->count += n;
+        p->frame += n;
+        k += n;
+    }
+
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void PV_DefaultConfig(PV_config_t *config)
+{
+    config->rate = 11025;
+    config->start = 0;
+    config->seconds = 0;
+    config->window_frames = 256;
+    config->num_windows = 0;
+}
+
+s64 PV_RenderPreview(XM_module_t *module, const PV_config_t *config, PV_write_func_t write, void *user)
+{
+    pv_pcm pcm;
+    pcm.write = write;
+    pcm.user = user;
+
+    return PV_Render(module, config, 0, PV_WritePcm, &pcm);
+}
+
+s64 PV_RenderPeaks(XM_module_t *module, const PV_config_t *config, PV_peak_func_t write, void *user)
+{
+    if (!config->num_windows && !config->window_frames)
+        return -1;
+
+    pv_peaks *p = (pv_peaks*)calloc(1, sizeof(pv_peaks));
+    if (!p)
+        return -1;
+
+    p->write = write;
+    p->user = user;
+    p->num_windows = config->num_windows;
+    p->window_frames = config->window_frames;
+
+    int failed = PV_Render(module, config, p->num_windows ? &p->num_frames : 0, PV_AddPeakFrames, p) < 0;
+
+    // close the last window, and with a fixed number any empty ones
+    if (!failed && p->num_windows) {
+        while (!failed && p->window < p->num_windows)
+            failed = PV_EndWindow(p);
+    } else if (!failed && p->count) {
+        failed = PV_EndWindow(p);
+    }
+
+    if (!failed)
+        failed = PV_FlushPeaks(p);
+
+    s64 written = failed ? -1 : (s64)p->written;
+    free(p);
+
+    return written;
+}
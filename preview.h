@@ -0,0 +1,51 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "types.h"
+#include "xm.h"
+
+
+// ----------------------------------------------------------------------------
+// Preview render (preview.cpp)
+// ----------------------------------------------------------------------------
+
+// Cheap renders for waveform overviews and short previews: mono, at a low
+// rate, with nearest neighbour stepping and no volume ramps.  The song runs
+// through the normal tick logic at that rate, so rows and notes land at the
+// same times as in a full render, to within a frame of the preview.  A
+// preview can start into the song, the part before it runs state-only.
+// Instead of PCM it can also hand out the minimum, maximum and RMS of every
+// window of frames.  Both render on a player and mixer of their own.
+
+typedef struct {
+    u32 rate;
+    double start;         // seconds into the song the preview starts at
+    double seconds;       // length, 0 for the rest of the song
+    u32 window_frames;    // frames per peak window
+    u32 num_windows;      // or split the preview into this many, 0 to use window_frames
+} PV_config_t;
+
+typedef struct {
+    float min;
+    float max;
+    float rms;
+} PV_peak_t;
+
+// receive the preview in order; returning non-zero stops the render
+typedef int (*PV_write_func_t)(void *user, const float *frames, u32 num_frames);
+typedef int (*PV_peak_func_t)(void *user, const PV_peak_t *peaks, u32 num_peaks);
+
+void PV_DefaultConfig(PV_config_t *config);
+
+// mono PCM, the average of both sides; returns the frames written, or -1
+// on failure
+s64 PV_RenderPreview(XM_module_t *module, const PV_config_t *config, PV_write_func_t write, void *user);
+
+// One peak per window, a short last one included.  With num_windows the
+// preview length is measured with a state-only pass first, and there are
+// exactly that many, empty ones all zero.  Returns the peaks written, or
+// -1 on failure.
+s64 PV_RenderPeaks(XM_module_t *module, const PV_config_t *config, PV_peak_func_t write, void *user);
+
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "profile.h"
+#include "audio.h"
+
+
+#define P_MAX_THREADS 64
+
+struct p_event
+{
+    const char *name;
+    const char *arg_names[2];
+    s32 args[2];
+    u64 start;
+    u64 duration;
+};
+
+struct p_thread_buffer
+{
+    char name[32];
+    u32 tid;
+    u32 max_events;
+    u32 num_events;
+    u32 dropped;
+    p_event *events;
+};
+
+static p_thread_buffer *p_threads[P_MAX_THREADS];
+static std::atomic<u32> p_num_threads(0);
+static u64 p_epoch;
+
+static __thread p_thread_buffer *p_current;
+static __thread u8 p_unprofiled;   // no slot or no memory, scopes are ignored
+
+
+// ---------------------------------------------------------------------------
+
+void P_InitThread(const char *name, u32 max_events)
+{
+    if (p_current || p_unprofiled)
+        return;
+
+    u32 tid = p_num_threads.fetch_add(1);
+    if (tid >= P_MAX_THREADS) {
+        p_unprofiled = 1;
+        return;
+    }
+
+    p_thread_buffer *buffer = (p_thread_buffer*)calloc(1, sizeof(p_thread_buffer));
+    if (buffer) {
+        buffer->max_events = max_events ? max_events : P_DEFAULT_EVENTS;
+        buffer->events = (p_event*)malloc((size_t)buffer->max_events * sizeof(p_event));
+    }
+
+    // the slot stays empty, the writer skips it
+    if (!buffer || !buffer->events) {
+        free(buffer);
+        p_unprofiled = 1;
+        return;
+    }
+
+    buffer->tid = tid + 1;
+
+    if (name)
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    else
+        snprintf(buffer->name, sizeof(buffer->name), "thread %u", buffer->tid);
+
+    if (!p_epoch)
+        p_epoch = S_GetTimeNanos();
+
+    p_current = buffer;
+    p_threads[tid] = buffer;
+}
+
+void P_Reset()
+{
+    u32 n = p_num_threads.load();
+
+    for (u32 i = 0; i < n && i < P_MAX_THREADS; i++) {
+        if (p_threads[i]) {
+            p_threads[i]->num_events = 0;
+            p_threads[i]->dropped = 0;
+        }
+    }
+
+    p_epoch = S_GetTimeNanos();
+}
+
+static void P_WriteString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        fputc(*s, fp);
+    }
+
+    fputc('"', fp);
+}
+
+int P_WriteChromeTrace(const char *file)
+{
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        perror(file);
+        return -1;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    int first = 1;
+    u32 n = p_num_threads.load();
+
+    for (u32 i = 0; i < n && i < P_MAX_THREADS; i++) {
+        p_thread_buffer *buffer = p_threads[i];
+        if (!buffer)
+            continue;
+
+        fprintf(fp, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":",
+                first ? "" : ",\n", buffer->tid);
+        P_WriteString(fp, buffer->name);
+        fprintf(fp, "}}");
+        first = 0;
+
+        for (u32 k = 0; k < buffer->num_events; k++) {
+            p_event *ev = &buffer->events[k];
+
+            // timestamps are microseconds since the first thread registered
+            fprintf(fp, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                    buffer->tid, (ev->start - p_epoch) / 1000.0, ev->duration / 1000.0);
+            P_WriteString(fp, ev->name);
+
+            if (ev->arg_names[0]) {
+                fprintf(fp, ",\"args\":{");
+                P_WriteString(fp, ev->arg_names[0]);
+                fprintf(fp, ":%d", ev->args[0]);
+
+                if (ev->arg_names[1]) {
+                    fputc(',', fp);
+                    P_WriteString(fp, ev->arg_names[1]);
+                    fprintf(fp, ":%d", ev->args[1]);
+                }
+
+                fputc('}', fp);
+            }
+
+            fputc('}', fp);
+        }
+
+        if (buffer->dropped)
+            fprintf(stderr, "P_WriteChromeTrace: %s dropped %u events, buffer full\n", buffer->name, buffer->dropped);
+    }
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+#ifdef XM_PROFILE
+
+P_Scope::P_Scope(const char *name, const char *a, s32 va, const char *b, s32 vb)
+{
+    this->name = name;
+    arg_names[0] = a;
+    arg_names[1] = b;
+    args[0] = va;
+    args[1] = vb;
+    start = S_GetTimeNanos();
+}
+
+P_Scope::~P_Scope()
+{
+    u64 end = S_GetTimeNanos();
+
+    if (!p_current && !p_unprofiled)
+        P_InitThread(0, 0);
+
+    p_thread_buffer *buffer = p_current;
+    if (!buffer)
+        return;
+
+    if (buffer->num_events >= buffer->max_events) {
+        buffer->dropped++;
+        return;
+    }
+
+    p_event *ev = &buffer->events[buffer->num_events++];
+    ev->name = name;
+    ev->arg_names[0] = arg_names[0];
+    ev->arg_names[1] = arg_names[1];
+    ev->args[0] = args[0];
+    ev->args[1] = args[1];
+    ev->start = start;
+    ev->duration = end - start;
+}
+
+#endif
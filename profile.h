@@ -0,0 +1,55 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+
+// ----------------------------------------------------------------------------
+// Scoped profiler (profile.cpp)
+// ----------------------------------------------------------------------------
+
+// Scopes record a complete event with up to two integer arguments into a
+// buffer owned by the calling thread.  Everything compiles to nothing
+// unless XM_PROFILE is defined.
+
+#define P_DEFAULT_EVENTS (1 << 20)
+
+// optional: name the calling thread and preallocate its buffer, otherwise
+// the buffer is allocated on the thread's first event.  A thread whose
+// buffer cannot be allocated stays unprofiled.
+void P_InitThread(const char *name, u32 max_events);
+
+// write every thread's events as Chrome trace JSON (chrome://tracing, Perfetto)
+int P_WriteChromeTrace(const char *file);
+void P_Reset();
+
+#ifdef XM_PROFILE
+
+struct P_Scope
+{
+    const char *name;
+    const char *arg_names[2];
+    s32 args[2];
+    u64 start;
+
+    P_Scope(const char *name, const char *a = 0, s32 va = 0, const char *b = 0, s32 vb = 0);
+    ~P_Scope();
+};
+
+#define P_CONCAT2(a, b) a##b
+#define P_CONCAT(a, b) P_CONCAT2(a, b)
+
+#define P_SCOPE(name) P_Scope P_CONCAT(p_scope_, __LINE__)(name)
+#define P_SCOPE1(name, a, va) P_Scope P_CONCAT(p_scope_, __LINE__)(name, a, va)
+#define P_SCOPE2(name, a, va, b, vb) P_Scope P_CONCAT(p_scope_, __LINE__)(name, a, va, b, vb)
+
+#else
+
+#define P_SCOPE(name)
+#define P_SCOPE1(name, a, va)
+#define P_SCOPE2(name, a, va, b, vb)
+
+#endif
+
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <atomic>
+
+#include "rtcheck.h"
+
+#if defined(XM_RTCHECK) && defined(__GLIBC__)
+#define RT_INTERPOSE 1
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+
+static std::atomic<u32> rt_violations(0);
+static std::atomic<const char*> rt_first(0);
+
+
+// ---------------------------------------------------------------------------
+
+u32 RT_GetViolations()
+{
+    return rt_violations.load(std::memory_order_relaxed);
+}
+
+const char *RT_GetFirstViolation()
+{
+    return rt_first.load(std::memory_order_relaxed);
+}
+
+void RT_ResetViolations()
+{
+    rt_violations.store(0, std::memory_order_relaxed);
+    rt_first.store(0, std::memory_order_relaxed);
+}
+
+u8 RT_IsEnforced()
+{
+#ifdef RT_INTERPOSE
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+#ifdef XM_RTCHECK
+
+static __thread u32 rt_depth;
+static const int rt_abort = getenv("XM_RTCHECK_ABORT") != 0;
+
+RT_Scope::RT_Scope()
+{
+    rt_depth++;
+}
+
+RT_Scope::~RT_Scope()
+{
+    rt_depth--;
+}
+
+static void RT_Violation(const char *what)
+{
+    if (!rt_depth)
+        return;
+
+    rt_violations.fetch_add(1, std::memory_order_relaxed);
+
+    const char *expected = 0;
+    rt_first.compare_exchange_strong(expected, what, std::memory_order_relaxed);
+
+    if (rt_abort)
+        abort();
+}
+
+#endif
+
+
+// ---------------------------------------------------------------------------
+
+#ifdef RT_INTERPOSE
+
+// the interposers forward to glibc's own entry points, which neither
+// allocate nor come back through the interposed symbols
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+typedef int (*rt_mutex_lock_t)(pthread_mutex_t *mutex);
+static rt_mutex_lock_t rt_real_mutex_lock;
+
+void *malloc(size_t size)
+{
+    RT_Violation("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    RT_Violation("calloc");
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    RT_Violation("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+        RT_Violation("free");
+    __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    RT_Violation("pthread_mutex_lock");
+
+    if (!rt_real_mutex_lock)
+        rt_real_mutex_lock = (rt_mutex_lock_t)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+
+    return rt_real_mutex_lock(mutex);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    RT_Violation("write");
+    return syscall(SYS_write, fd, buf, count);
+}
+
+}
+
+#endif
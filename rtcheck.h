@@ -0,0 +1,45 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+#include "types.h"
+
+
+// ----------------------------------------------------------------------------
+// Realtime contract enforcement (rtcheck.cpp)
+// ----------------------------------------------------------------------------
+
+// Code inside an RT_SCOPE must not allocate, lock or make system calls.
+// Builds with XM_RTCHECK interpose malloc, calloc, realloc, free,
+// pthread_mutex_lock and write (glibc only) and count every call made
+// from inside a scope as a violation.  Setting XM_RTCHECK_ABORT in the
+// environment aborts on the first one instead.  Everything compiles to
+// nothing unless XM_RTCHECK is defined.
+
+u32 RT_GetViolations();
+const char *RT_GetFirstViolation();
+void RT_ResetViolations();
+
+// 1 when the interposers are linked in and catching calls
+u8 RT_IsEnforced();
+
+#ifdef XM_RTCHECK
+
+struct RT_Scope
+{
+    RT_Scope();
+    ~RT_Scope();
+};
+
+#define RT_CONCAT2(a, b) a##b
+#define RT_CONCAT(a, b) RT_CONCAT2(a, b)
+
+#define RT_SCOPE() RT_Scope RT_CONCAT(rt_scope_, __LINE__)
+
+#else
+
+#define RT_SCOPE()
+
+#endif
+
+
+#endif
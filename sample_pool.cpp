@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "xm.h"
+
+
+// Every block carries this header in front of the sample data.  Blocks
+// start out private to the loader and join the pool when shared.
+struct xm_pool_entry
+{
+    xm_pool_entry *next;
+    u64 hash;
+    u32 bytes;
+    u32 refs;    // 0 while private
+};
+
+// keep the data as aligned as malloc would
+#define XM_POOL_HEADER ((sizeof(xm_pool_entry) + 15) & ~(size_t)15)
+
+static pthread_mutex_t xm_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static xm_pool_entry **xm_pool_buckets;
+static u32 xm_pool_num_buckets;
+static XM_pool_stats_t xm_pool_stats;
+
+
+// ---------------------------------------------------------------------------
+
+static inline xm_pool_entry *XM_PoolEntry(const void *data)
+{
+    return (xm_pool_entry*)((u8*)data - XM_POOL_HEADER);
+}
+
+static inline u64 XM_HashMix(u64 h, u64 v)
+{
+    h ^= v * 0x9E3779B97F4A7C15ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xBF58476D1CE4E5B9ULL;
+}
+
+// eight bytes a step, the tail is padded with zeroes and the length
+// goes in last
+static u64 XM_HashBytes(const u8 *data, u32 bytes)
+{
+    u64 h = 0x243F6A8885A308D3ULL;
+    u32 i = 0;
+
+    for (; i + 8 <= bytes; i += 8) {
+        u64 v;
+        memcpy(&v, data + i, 8);
+        h = XM_HashMix(h, v);
+    }
+
+    if (i < bytes) {
+        u64 v = 0;
+        memcpy(&v, data + i, bytes - i);
+        h = XM_HashMix(h, v);
+    }
+
+    h = XM_HashMix(h, bytes);
+    return h ^ (h >> 29);
+}
+
+static void XM_PoolGrow()
+{
+    u32 num_buckets = xm_pool_num_buckets ? 2 * xm_pool_num_buckets : 256;
+    xm_pool_entry **buckets = (xm_pool_entry**)calloc(num_buckets, sizeof(xm_pool_entry*));
+
+    // a full table still works, just with longer chains
+    if (!buckets)
+        return;
+
+    for (u32 b = 0; b < xm_pool_num_buckets; b++) {
+        xm_pool_entry *e = xm_pool_buckets[b];
+
+        while (e) {
+            xm_pool_entry *next = e->next;
+            xm_pool_entry **head = &buckets[e->hash & (num_buckets - 1)];
+
+            e->next = *head;
+            *head = e;
+            e = next;
+        }
+    }
+
+    free(xm_pool_buckets);
+    xm_pool_buckets = buckets;
+    xm_pool_num_buckets = num_buckets;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void *XM_PoolAlloc(u32 bytes)
+{
+    xm_pool_entry *e = (xm_pool_entry*)malloc(XM_POOL_HEADER + bytes);
+    if (!e)
+        return 0;
+
+    e->next = 0;
+    e->hash = 0;
+    e->bytes = bytes;
+    e->refs = 0;
+
+    return (u8*)e + XM_POOL_HEADER;
+}
+
+void *XM_PoolShare(void *data, u32 *shared_bytes)
+{
+    xm_pool_entry *e = XM_PoolEntry(data);
+
+    // hashing needs no lock, only the table does
+    e->hash = XM_HashBytes((const u8*)data, e->bytes);
+
+    pthread_mutex_lock(&xm_pool_lock);
+
+    if (xm_pool_stats.num_samples >= xm_pool_num_buckets)
+        XM_PoolGrow();
+
+    xm_pool_entry **head = xm_pool_num_buckets ? &xm_pool_buckets[e->hash & (xm_pool_num_buckets - 1)] : 0;
+
+    for (xm_pool_entry *p = head ? *head : 0; p; p = p->next) {
+        if (p->hash == e->hash && p->bytes == e->bytes && !memcmp((u8*)p + XM_POOL_HEADER, data, e->bytes)) {
+            p->refs++;
+            xm_pool_stats.shared_bytes += p->bytes;
+            pthread_mutex_unlock(&xm_pool_lock);
+
+            if (shared_bytes)
+                *shared_bytes = p->bytes;
+
+            free(e);
+            return (u8*)p + XM_POOL_HEADER;
+        }
+    }
+
+    e->refs = 1;
+
+    // without a table the block stays private, it still frees the same way
+    if (head) {
+        e->next = *head;
+        *head = e;
+
+        xm_pool_stats.num_samples++;
+        xm_pool_stats.bytes += e->bytes;
+    }
+
+    pthread_mutex_unlock(&xm_pool_lock);
+
+    if (shared_bytes)
+        *shared_bytes = 0;
+
+    return data;
+}
+
+void XM_PoolRelease(void *data)
+{
+    if (!data)
+        return;
+
+    xm_pool_entry *e = XM_PoolEntry(data);
+
+    pthread_mutex_lock(&xm_pool_lock);
+
+    if (e->refs > 1) {
+        e->refs--;
+        xm_pool_stats.shared_bytes -= e->bytes;
+        pthread_mutex_unlock(&xm_pool_lock);
+        return;
+    }
+
+    if (e->refs && xm_pool_num_buckets) {
+        xm_pool_entry **p = &xm_pool_buckets[e->hash & (xm_pool_num_buckets - 1)];
+
+        while (*p && *p != e)
+            p = &(*p)->next;
+
+        if (*p) {
+            *p = e->next;
+
+            xm_pool_stats.num_samples--;
+            xm_pool_stats.bytes -= e->bytes;
+        }
+    }
+
+    pthread_mutex_unlock(&xm_pool_lock);
+
+    free(e);
+}
+
+u32 XM_PoolRefs(const void *data)
+{
+    pthread_mutex_lock(&xm_pool_lock);
+    u32 refs = XM_PoolEntry(data)->refs;
+    pthread_mutex_unlock(&xm_pool_lock);
+
+    return refs;
+}
+
+void XM_GetPoolStats(XM_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&xm_pool_lock);
+    *stats = xm_pool_stats;
+    pthread_mutex_unlock(&xm_pool_lock);
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef XM_HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "audio.h"
+
+
+// frames converted per backend write
+#define S_SINK_CHUNK 1024
+
+struct s_sink
+{
+    u32 rate;
+    u8 num_channels;
+    u8 format;
+    S_output_t output;
+
+    // backend, takes interleaved frames in the sink's format
+    u32 (*write)(s_sink *sink, const void *frames, u32 num_frames);
+    void (*drain)(s_sink *sink);
+    u32 (*latency)(s_sink *sink);
+    void (*close)(s_sink *sink);
+
+    FILE *fp;
+    u8 wav;
+    u64 data_bytes;
+
+#ifdef XM_HAVE_ALSA
+    snd_pcm_t *pcm;
+#endif
+};
+
+
+// ---------------------------------------------------------------------------
+
+static u32 S_FrameBytes(const s_sink *sink)
+{
+    return sink->num_channels * (sink->format == S_SINK_F32 ? 4 : sink->format == S_SINK_S24 ? 3 : 2);
+}
+
+static u32 S_NullWrite(s_sink *, const void *, u32 num_frames)
+{
+    return num_frames;
+}
+
+static void S_NullDrain(s_sink *)
+{
+}
+
+static u32 S_NullLatency(s_sink *)
+{
+    return 0;
+}
+
+static void S_NullClose(s_sink *)
+{
+}
+
+
+// ---------------------------------------------------------------------------
+
+static void S_Write16(FILE *fp, u16 v)
+{
+    fputc(v & 0xFF, fp);
+    fputc(v >> 8, fp);
+}
+
+static void S_Write32(FILE *fp, u32 v)
+{
+    S_Write16(fp, v & 0xFFFF);
+    S_Write16(fp, v >> 16);
+}
+
+static void S_WriteWavHeader(s_sink *sink)
+{
+    u16 bytes = (u16)(S_FrameBytes(sink) / sink->num_channels);
+    u32 data_bytes = sink->data_bytes > 0xFFFFFFFF - 36 ? 0xFFFFFFFF - 36 : (u32)sink->data_bytes;
+
+    fwrite("RIFF", 1, 4, sink->fp);
+    S_Write32(sink->fp, 36 + data_bytes);
+    fwrite("WAVEfmt ", 1, 8, sink->fp);
+    S_Write32(sink->fp, 16);
+    S_Write16(sink->fp, sink->format == S_SINK_F32 ? 3 : 1);   // IEEE float or PCM
+    S_Write16(sink->fp, sink->num_channels);
+    S_Write32(sink->fp, sink->rate);
+    S_Write32(sink->fp, sink->rate * sink->num_channels * bytes);
+    S_Write16(sink->fp, sink->num_channels * bytes);
+    S_Write16(sink->fp, bytes * 8);
+    fwrite("data", 1, 4, sink->fp);
+    S_Write32(sink->fp, data_bytes);
+}
+
+static u32 S_FileWrite(s_sink *sink, const void *frames, u32 num_frames)
+{
+    size_t frame_bytes = S_FrameBytes(sink);
+    size_t n = fwrite(frames, frame_bytes, num_frames, sink->fp);
+
+    sink->data_bytes += n * frame_bytes;
+    return (u32)n;
+}
+
+static void S_FileDrain(s_sink *sink)
+{
+    fflush(sink->fp);
+}
+
+static void S_FileClose(s_sink *sink)
+{
+    // the sizes in the header are only known now, pipes keep the placeholder
+    if (sink->wav && fseek(sink->fp, 0, SEEK_SET) == 0)
+        S_WriteWavHeader(sink);
+
+    if (sink->fp == stdout)
+        fflush(stdout);
+    else
+        fclose(sink->fp);
+}
+
+static int S_OpenFileSink(s_sink *sink, const char *file, u8 wav)
+{
+    sink->fp = strcmp(file, "-") ? fopen(file, "wb") : stdout;
+    if (!sink->fp) {
+        perror(file);
+        return 1;
+    }
+
+    sink->wav = wav;
+    sink->write = S_FileWrite;
+    sink->drain = S_FileDrain;
+    sink->latency = S_NullLatency;
+    sink->close = S_FileClose;
+
+    if (wav)
+        S_WriteWavHeader(sink);
+
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+#ifdef XM_HAVE_ALSA
+
+static u32 S_AlsaWrite(s_sink *sink, const void *frames, u32 num_frames)
+{
+    size_t frame_bytes = S_FrameBytes(sink);
+    u32 done = 0;
+
+    while (done < num_frames) {
+        snd_pcm_sframes_t n = snd_pcm_writei(sink->pcm, (const u8*)frames + done * frame_bytes, num_frames - done);
+
+        // recover from underruns and suspends, give up on anything else
+        if (n < 0 && snd_pcm_recover(sink->pcm, (int)n, 1) < 0)
+            break;
+
+        if (n > 0)
+            done += (u32)n;
+    }
+
+    return done;
+}
+
+static void S_AlsaDrain(s_sink *sink)
+{
+    snd_pcm_drain(sink->pcm);
+}
+
+static u32 S_AlsaLatency(s_sink *sink)
+{
+    snd_pcm_sframes_t delay;
+
+    if (snd_pcm_delay(sink->pcm, &delay) < 0 || delay < 0)
+        return 0;
+
+    return (u32)delay;
+}
+
+static void S_AlsaClose(s_sink *sink)
+{
+    snd_pcm_close(sink->pcm);
+}
+
+static int S_OpenAlsaSink(s_sink *sink, const char *device)
+{
+    static const snd_pcm_format_t formats[] = { SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_S24_3LE };
+
+    int result = snd_pcm_open(&sink->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+
+    if (result >= 0) {
+        result = snd_pcm_set_params(sink->pcm, formats[sink->format],
+                                    SND_PCM_ACCESS_RW_INTERLEAVED, sink->num_channels, sink->rate, 1, 50000);
+
+        if (result < 0)
+            snd_pcm_close(sink->pcm);
+    }
+
+    if (result < 0) {
+        fprintf(stderr, "%s: %s\n", device, snd_strerror(result));
+        return 1;
+    }
+
+    sink->write = S_AlsaWrite;
+    sink->drain = S_AlsaDrain;
+    sink->latency = S_AlsaLatency;
+    sink->close = S_AlsaClose;
+
+    return 0;
+}
+
+#endif
+
+
+// ---------------------------------------------------------------------------
+
+S_sink_t *S_OpenSink(const char *spec, u32 rate, u8 num_channels, u8 format)
+{
+    if (num_channels < 1 || num_channels > 2 || format > S_SINK_S24)
+        return 0;
+
+    s_sink *sink = (s_sink*)calloc(1, sizeof(s_sink));
+    if (!sink)
+        return 0;
+
+    sink->rate = rate;
+    sink->num_channels = num_channels;
+    sink->format = format;
+    S_InitOutput(&sink->output, 1.0f, S_CLIP_NONE, 0);
+
+    sink->write = S_NullWrite;
+    sink->drain = S_NullDrain;
+    sink->latency = S_NullLatency;
+    sink->close = S_NullClose;
+
+    int failed = 0;
+
+    if (!strcmp(spec, "null"))
+        failed = 0;
+    else if (!strncmp(spec, "wav:", 4))
+        failed = S_OpenFileSink(sink, spec + 4, 1);
+    else if (!strncmp(spec, "raw:", 4))
+        failed = S_OpenFileSink(sink, spec + 4, 0);
+    else if (!strcmp(spec, "stdout") || !strcmp(spec, "-"))
+        failed = S_OpenFileSink(sink, "-", 0);
+#ifdef XM_HAVE_ALSA
+    else if (!strcmp(spec, "alsa"))
+        failed = S_OpenAlsaSink(sink, "default");
+    else if (!strncmp(spec, "alsa:", 5))
+        failed = S_OpenAlsaSink(sink, spec + 5);
+#endif
+    else {
+        fprintf(stderr, "%s: unknown output sink\n", spec);
+        failed = 1;
+    }
+
+    if (failed) {
+        free(sink);
+        return 0;
+    }
+
+    return sink;
+}
+
+void S_CloseSink(S_sink_t *sink)
+{
+    if (!sink)
+        return;
+
+    sink->close(sink);
+    free(sink);
+}
+
+void S_SetSinkOutput(S_sink_t *sink, float gain, u8 clip, u8 dither)
+{
+    S_InitOutput(&sink->output, gain, clip, dither);
+}
+
+u32 S_WriteSink(S_sink_t *sink, const float *left, const float *right, u32 num_frames)
+{
+    // interleave and convert a chunk at a time, without allocating
+    union {
+        s16 pcm16[2 * S_SINK_CHUNK];
+        float pcm32[2 * S_SINK_CHUNK];
+        u8 pcm24[6 * S_SINK_CHUNK];
+    } buffer;
+
+    const float *r = sink->num_channels == 2 ? right : 0;
+    u32 done = 0;
+
+    while (done < num_frames) {
+        u32 n = num_frames - done;
+        if (n > S_SINK_CHUNK)
+            n = S_SINK_CHUNK;
+
+        if (sink->format == S_SINK_F32)
+            S_ConvertF32(&sink->output, left + done, r ? r + done : 0, buffer.pcm32, n);
+        else if (sink->format == S_SINK_S24)
+            S_ConvertS24(&sink->output, left + done, r ? r + done : 0, buffer.pcm24, n);
+        else
+            S_ConvertS16(&sink->output, left + done, r ? r + done : 0, buffer.pcm16, n);
+
+        u32 written = sink->write(sink, &buffer, n);
+        done += written;
+
+        if (written < n)
+            break;
+    }
+
+    return done;
+}
+
+void S_DrainSink(S_sink_t *sink)
+{
+    sink->drain(sink);
+}
+
+u32 S_GetSinkLatency(S_sink_t *sink)
+{
+    return sink->latency(sink);
+}
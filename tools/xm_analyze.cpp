@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xm.h"
+#include "audio.h"
+#include "loudness.h"
+
+
+struct a_options
+{
+    LM_config_t config;
+    u32 num_threads;
+    const char *output;
+} ao;
+
+struct a_file
+{
+    const char *name;
+    LM_result_t result;
+    u8 failed;
+};
+
+// workers take the next file until none are left
+struct a_batch
+{
+    a_file *files;
+    int num_files;
+    int next;
+
+    pthread_mutex_t lock;
+};
+
+
+// ---------------------------------------------------------------------------
+
+double A_Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *A_Worker(void *arg)
+{
+    a_batch *b = (a_batch*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        int i = b->next < b->num_files ? b->next++ : -1;
+        pthread_mutex_unlock(&b->lock);
+
+        if (i < 0)
+            return 0;
+
+        a_file *f = &b->files[i];
+        XM_module_t module;
+
+        if (XM_LoadFile(f->name, &module) < 0) {
+            f->failed = 1;
+            continue;
+        }
+
+        f->failed = LM_AnalyzeModule(&module, &ao.config, &f->result) != 0;
+
+        XM_FreeModule(&module);
+    }
+}
+
+// dB of a linear level, -inf for silence
+double A_Decibels(double level)
+{
+    return level > 0 ? 20.0 * log10(level) : -INFINITY;
+}
+
+int A_WriteSummary(FILE *fp, const a_batch *b)
+{
+    fprintf(fp, "file\tseconds\tloudness_lufs\tgain_db\tsample_peak_dbfs\ttrue_peak_dbtp\n");
+
+    for (int i = 0; i < b->num_files; i++) {
+        const a_file *f = &b->files[i];
+        const LM_result_t *r = &f->result;
+
+        if (f->failed) {
+            fprintf(fp, "%s\tfailed\n", f->name);
+            continue;
+        }
+
+        fprintf(fp, "%s\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n", f->name, (double)r->frames / ao.config.rate,
+                r->loudness > LM_SILENCE ? r->loudness : -INFINITY, r->gain,
+                A_Decibels(r->sample_peak), A_Decibels(r->true_peak));
+    }
+
+    return ferror(fp);
+}
+
+
+// ---------------------------------------------------------------------------
+
+void A_Usage()
+{
+    printf("usage: xm_analyze [options] module.xm ...\n");
+    printf("  -o file         write the summary here instead of stdout\n");
+    printf("  -j threads      modules analyzed at once, 0 for one per CPU (0)\n");
+    printf("  -r rate         mixing rate (48000)\n");
+    printf("  -i interp       nearest, linear or cubic (linear)\n");
+    printf("  -s seconds      analyze at most this much of a song, 0 for all (600)\n");
+}
+
+int main(int argc, char **argv)
+{
+    LM_DefaultConfig(&ao.config);
+    ao.config.max_seconds = 600;
+    ao.num_threads = 0;
+    ao.output = 0;
+
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            ao.output = argv[++i];
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            ao.num_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            ao.config.rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            ao.config.max_seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            const char *arg = argv[++i];
+
+            if (!strcmp(arg, "nearest")) ao.config.interpolation = S_INTERP_NEAREST;
+            else if (!strcmp(arg, "cubic")) ao.config.interpolation = S_INTERP_CUBIC;
+            else ao.config.interpolation = S_INTERP_LINEAR;
+        } else {
+            A_Usage();
+            return 2;
+        }
+    }
+
+    if (i == argc || !ao.config.rate) {
+        A_Usage();
+        return 2;
+    }
+
+    a_batch b;
+    memset(&b, 0, sizeof(b));
+
+    b.num_files = argc - i;
+    b.files = (a_file*)calloc(b.num_files, sizeof(a_file));
+
+    if (!b.files)
+        return 1;
+
+    for (int f = 0; f < b.num_files; f++)
+        b.files[f].name = argv[i + f];
+
+    int num_threads = ao.num_threads ? ao.num_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > b.num_files)
+        num_threads = b.num_files;
+
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    int started = 0;
+
+    pthread_mutex_init(&b.lock, 0);
+
+    double t0 = A_Now();
+
+    while (threads && started < num_threads && !pthread_create(&threads[started], 0, A_Worker, &b))
+        started++;
+
+    // no thread at all, do it here
+    if (!started)
+        A_Worker(&b);
+
+    for (int t = 0; t < started; t++)
+        pthread_join(threads[t], 0);
+
+    double elapsed = A_Now() - t0;
+
+    pthread_mutex_destroy(&b.lock);
+    free(threads);
+
+    FILE *fp = ao.output ? fopen(ao.output, "w") : stdout;
+    int failed = !fp;
+
+    if (fp) {
+        failed = A_WriteSummary(fp, &b);
+
+        if (fp != stdout && fclose(fp))
+            failed = 1;
+    }
+
+    int failures = 0;
+    double seconds = 0;
+
+    for (int f = 0; f < b.num_files; f++) {
+        failures += b.files[f].failed;
+        seconds += (double)b.files[f].result.frames / ao.config.rate;
+    }
+
+    fprintf(stderr, "%d modules, %.0f seconds of music in %.1f s on %d threads, %d failed\n",
+            b.num_files, seconds, elapsed, started ? started : 1, failures);
+
+    free(b.files);
+
+    return failed || failures ? 1 : 0;
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "xm.h"
+#include "audio.h"
+#include "profile.h"
+
+
+#define B_ROUNDS 3
+#define B_BLOCK_FRAMES 1024
+#define B_MAX_RESULTS 4096
+
+static const char *b_interp_names[] = { "nearest", "linear", "cubic" };
+
+struct b_options
+{
+    double min_time;
+    u32 rate;
+    FILE *out;
+} bo;
+
+
+// ---------------------------------------------------------------------------
+
+double B_Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+const char *B_BaseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void B_Report(const char *bench, const char *name, double value, const char *unit)
+{
+    fprintf(bo.out, "%s,%s,%.6g,%s\n", bench, name, value, unit);
+    fflush(bo.out);
+}
+
+
+// ---------------------------------------------------------------------------
+
+void B_BenchLoad(const char *file)
+{
+    struct stat st;
+    if (stat(file, &st) < 0) {
+        perror(file);
+        return;
+    }
+
+    double best = 0;
+
+    for (int r = 0; r < B_ROUNDS; r++) {
+        int loads = 0;
+        double t0 = B_Now(), elapsed;
+
+        do {
+            XM_module_t module;
+            if (XM_LoadFile(file, &module) < 0)
+                return;
+            XM_FreeModule(&module);
+
+            loads++;
+            elapsed = B_Now() - t0;
+        } while (elapsed < bo.min_time);
+
+        double mbps = (double)st.st_size * loads / elapsed / (1024.0 * 1024.0);
+        if (mbps > best)
+            best = mbps;
+    }
+
+    B_Report("load", B_BaseName(file), best, "MB/s");
+}
+
+void B_BenchTicks(XM_module_t *module, const char *file)
+{
+    double best = 0;
+
+    S_Init(module->num_channels, bo.rate);
+
+    for (int r = 0; r < B_ROUNDS; r++) {
+        u64 ticks = 0;
+        double t0 = B_Now(), elapsed;
+
+        XM_InitPlayer(module);
+
+        do {
+            for (int i = 0; i < 256; i++) {
+                if (XM_IsSongFinished()) {
+                    XM_ShutdownPlayer();
+                    XM_InitPlayer(module);
+                }
+
+                XM_RunTick();
+            }
+
+            ticks += 256;
+            elapsed = B_Now() - t0;
+        } while (elapsed < bo.min_time);
+
+        XM_ShutdownPlayer();
+
+        if (ticks / elapsed > best)
+            best = ticks / elapsed;
+    }
+
+    S_Shutdown();
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s/%dch", B_BaseName(file), module->num_channels);
+    B_Report("tick", name, best, "ticks/s");
+}
+
+void B_BenchRender(XM_module_t *module, const char *file, u8 interp)
+{
+    static float left[B_BLOCK_FRAMES], right[B_BLOCK_FRAMES];
+    double best = 0;
+
+    S_Init(module->num_channels, bo.rate);
+    S_SetInterpolation(interp);
+
+    for (int r = 0; r < B_ROUNDS; r++) {
+        u64 frames = 0;
+        double t0 = B_Now(), elapsed;
+
+        XM_InitPlayer(module);
+
+        do {
+            u32 n = XM_RenderFrames(left, right, B_BLOCK_FRAMES);
+
+            if (n < B_BLOCK_FRAMES) {
+                XM_ShutdownPlayer();
+                XM_InitPlayer(module);
+            }
+
+            frames += n;
+            elapsed = B_Now() - t0;
+        } while (elapsed < bo.min_time);
+
+        XM_ShutdownPlayer();
+
+        if (frames / elapsed > best)
+            best = frames / elapsed;
+    }
+
+    S_Shutdown();
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s/%s", B_BaseName(file), b_interp_names[interp]);
+    B_Report("render", name, best, "frames/s");
+}
+
+void B_BenchModule(const char *file)
+{
+    B_BenchLoad(file);
+
+    XM_module_t module;
+    if (XM_LoadFile(file, &module) < 0) {
+        fprintf(stderr, "%s: unable to load module\n", file);
+        return;
+    }
+
+    if (module.song_length > 0) {
+        B_BenchTicks(&module, file);
+
+        for (u8 interp = S_INTERP_NEAREST; interp <= S_INTERP_CUBIC; interp++)
+            B_BenchRender(&module, file, interp);
+    }
+
+    XM_FreeModule(&module);
+}
+
+
+// ---------------------------------------------------------------------------
+
+void B_BenchMixer(u8 data_type, u8 interp, u8 num_voices)
+{
+    static float left[B_BLOCK_FRAMES], right[B_BLOCK_FRAMES];
+    const u32 length = 65536;
+    u32 seed = 0x12345678;
+    double best = 0;
+
+    void *data = malloc(length * data_type);
+
+    for (u32 i = 0; i < length; i++) {
+        seed = seed * 1664525 + 1013904223;
+
+        if (data_type == 2)
+            ((s16*)data)[i] = (s16)(seed >> 16);
+        else
+            ((s8*)data)[i] = (s8)(seed >> 24);
+    }
+
+    S_Init(num_voices, bo.rate);
+    S_SetInterpolation(interp);
+
+    for (u8 v = 0; v < num_voices; v++) {
+        seed = seed * 1664525 + 1013904223;
+
+        S_PlayVoice(v, data_type, length, data);
+        S_SetSampleLoop(v, S_LOOP_FWD, 0, length);
+        S_SetVoiceFrequency(v, 4000 + (seed >> 8) % 44000);
+        S_SetVoiceVolume(v, 64 + (seed & 63));
+        S_SetVoicePanning(v, seed >> 24);
+    }
+
+    for (int r = 0; r < B_ROUNDS; r++) {
+        u64 frames = 0;
+        double t0 = B_Now(), elapsed;
+
+        do {
+            S_RenderFrames(left, right, B_BLOCK_FRAMES);
+
+            frames += B_BLOCK_FRAMES;
+            elapsed = B_Now() - t0;
+        } while (elapsed < bo.min_time);
+
+        if (frames * num_voices / elapsed > best)
+            best = frames * num_voices / elapsed;
+    }
+
+    S_Shutdown();
+    free(data);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s/%dv", data_type == 2 ? "s16" : "s8", b_interp_names[interp], num_voices);
+    B_Report("mix", name, best, "voice-frames/s");
+}
+
+
+// ---------------------------------------------------------------------------
+
+struct b_result
+{
+    char key[512];
+    double value;
+};
+
+int B_ReadResults(const char *file, b_result *results)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        perror(file);
+        return -1;
+    }
+
+    char line[512];
+    int n = 0;
+
+    while (n < B_MAX_RESULTS && fgets(line, sizeof(line), fp)) {
+        // benchmark,case,value,unit
+        char *value = strchr(line, ',');
+        if (!value || !(value = strchr(value + 1, ',')))
+            continue;
+
+        *value++ = 0;
+        snprintf(results[n].key, sizeof(results[n].key), "%s", line);
+        results[n].value = atof(value);
+
+        if (results[n].value > 0)
+            n++;
+    }
+
+    fclose(fp);
+    return n;
+}
+
+int B_Compare(const char *old_file, const char *new_file, double threshold)
+{
+    static b_result old_results[B_MAX_RESULTS], new_results[B_MAX_RESULTS];
+
+    int num_old = B_ReadResults(old_file, old_results);
+    int num_new = B_ReadResults(new_file, new_results);
+
+    if (num_old < 0 || num_new < 0)
+        return 2;
+
+    int regressions = 0;
+
+    for (int i = 0; i < num_new; i++) {
+        for (int k = 0; k < num_old; k++) {
+            if (strcmp(new_results[i].key, old_results[k].key) != 0)
+                continue;
+
+            // all benchmarks report throughput, higher is better
+            double delta = (new_results[i].value / old_results[k].value - 1.0) * 100.0;
+            int regressed = delta < -threshold;
+
+            printf("%-48s %12.6g %12.6g %+7.1f%%%s\n", new_results[i].key,
+                   old_results[k].value, new_results[i].value, delta, regressed ? "  REGRESSION" : "");
+
+            regressions += regressed;
+            break;
+        }
+    }
+
+    return regressions ? 1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void B_Usage()
+{
+    printf("usage: xm_bench [-t seconds] [-r rate] [-o results.csv] [-T trace.json] [module.xm ...]\n");
+    printf("       xm_bench -c old.csv new.csv [threshold%%]\n");
+}
+
+int main(int argc, char **argv)
+{
+    bo.min_time = 0.5;
+    bo.rate = 44100;
+    bo.out = stdout;
+
+    const char *trace = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-c") && i + 2 < argc) {
+            double threshold = i + 3 < argc ? atof(argv[i + 3]) : 5.0;
+            return B_Compare(argv[i + 1], argv[i + 2], threshold);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            bo.min_time = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            bo.rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            if (!(bo.out = fopen(argv[++i], "w"))) {
+                perror(argv[i]);
+                return 2;
+            }
+        } else {
+            B_Usage();
+            return 2;
+        }
+    }
+
+    if (trace) {
+#ifndef XM_PROFILE
+        fprintf(stderr, "xm_bench: built without XM_PROFILE, the trace will be empty\n");
+#endif
+        P_InitThread("xm_bench", 0);
+    }
+
+    fprintf(bo.out, "benchmark,case,value,unit\n");
+
+    for (u8 data_type = 1; data_type <= 2; data_type++)
+        for (u8 interp = S_INTERP_NEAREST; interp <= S_INTERP_CUBIC; interp++)
+            for (u8 voices = 8; voices <= 64; voices *= 2)
+                B_BenchMixer(data_type, interp, voices);
+
+    // the synthetic sweep alone fills the buffer, trace only the modules
+    if (trace)
+        P_Reset();
+
+    for (; i < argc; i++)
+        B_BenchModule(argv[i]);
+
+    if (bo.out != stdout)
+        fclose(bo.out);
+
+    if (trace)
+        P_WriteChromeTrace(trace);
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "xm.h"
+#include "audio.h"
+
+
+#define D_MAX_TICK_FRAMES 65536
+
+// an optimized mixer configuration and how far it may stray from the reference
+struct d_path
+{
+    const char *name;
+    u8 interpolation;
+    double max_rms_db;   // -INFINITY: must be bit-exact
+};
+
+static const d_path d_paths[] = {
+    { "nearest", S_INTERP_NEAREST, -INFINITY },
+    { "linear",  S_INTERP_LINEAR,  -INFINITY },
+    { "cubic",   S_INTERP_CUBIC,   -INFINITY },
+};
+
+#define D_NUM_PATHS (sizeof(d_paths) / sizeof(d_paths[0]))
+
+// one player and mixer pair
+struct d_pipeline
+{
+    XM_player_state_t player;
+    S_mixer_t *mixer;
+    float left[D_MAX_TICK_FRAMES];
+    float right[D_MAX_TICK_FRAMES];
+};
+
+struct d_options
+{
+    u32 rate;
+    double seconds;
+    double tolerance;
+    u8 compress;
+} dopt;
+
+
+// ---------------------------------------------------------------------------
+
+u64 D_Hash(const float *data, u32 n, u64 hash)
+{
+    // FNV-1a over the raw float bits
+    const u8 *bytes = (const u8*)data;
+
+    for (u32 i = 0; i < n * sizeof(float); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+void D_Select(d_pipeline *p)
+{
+    XM_SetCurrentPlayer(&p->player);
+    S_SetCurrentMixer(p->mixer);
+}
+
+void D_Open(d_pipeline *p, XM_module_t *module, u8 interpolation, u8 reference)
+{
+    memset(&p->player, 0, sizeof(p->player));
+    p->mixer = S_CreateMixer();
+
+    D_Select(p);
+
+    S_Init(module->num_channels, dopt.rate);
+    S_SetInterpolation(interpolation);
+    S_SetReferenceMode(reference);
+    XM_InitPlayer(module);
+}
+
+void D_Close(d_pipeline *p)
+{
+    D_Select(p);
+
+    XM_ShutdownPlayer();
+    S_DestroyMixer(p->mixer);
+
+    XM_SetCurrentPlayer(0);
+}
+
+// render exactly one tick, returns its length in frames
+u32 D_RenderTick(d_pipeline *p)
+{
+    D_Select(p);
+
+    // the first frame runs the tick, the rest of it follows
+    u32 n = XM_RenderFrames(p->left, p->right, 1);
+    if (!n)
+        return 0;
+
+    u32 rest = XM_GetCurrentPlayer()->tick_frames_left;
+    if (rest > D_MAX_TICK_FRAMES - 1)
+        rest = D_MAX_TICK_FRAMES - 1;
+
+    return n + XM_RenderFrames(p->left + 1, p->right + 1, rest);
+}
+
+
+// ---------------------------------------------------------------------------
+
+int D_TestPath(XM_module_t *module, const char *file, const d_path *path)
+{
+    static d_pipeline ref, opt;
+
+    D_Open(&ref, module, path->interpolation, 1);
+    D_Open(&opt, module, path->interpolation, 0);
+
+    u64 max_frames = dopt.seconds > 0 ? (u64)(dopt.seconds * dopt.rate) : ~0ULL;
+    u64 frame = 0;
+    u64 ref_hash = 0xCBF29CE484222325ULL, opt_hash = ref_hash;
+    u32 ticks = 0, differing_ticks = 0;
+    double err_sum = 0, ref_sum = 0, max_err = 0;
+
+    u8 reported = 0;
+    u64 first_frame = 0;
+    u32 first_tick = 0;
+    u16 first_order = 0, first_row = 0;
+    float first_ref = 0, first_opt = 0;
+
+    while (frame < max_frames) {
+        // position of the tick about to run, before either player advances
+        u16 order = ref.player.pattern_index;
+        u16 row = ref.player.row;
+
+        u32 n = D_RenderTick(&ref);
+        u32 m = D_RenderTick(&opt);
+
+        if (n != m) {
+            printf("%s [%s]: tick %u has %u frames in the reference, %u optimized\n", file, path->name, ticks, n, m);
+            reported = 2;
+            break;
+        }
+
+        if (!n)
+            break;
+
+        u64 block_ref = D_Hash(ref.left, n, D_Hash(ref.right, n, 0xCBF29CE484222325ULL));
+        u64 block_opt = D_Hash(opt.left, n, D_Hash(opt.right, n, 0xCBF29CE484222325ULL));
+
+        ref_hash = D_Hash(ref.left, n, D_Hash(ref.right, n, ref_hash));
+        opt_hash = D_Hash(opt.left, n, D_Hash(opt.right, n, opt_hash));
+
+        if (block_ref != block_opt) {
+            differing_ticks++;
+
+            for (u32 k = 0; k < n; k++) {
+                double dl = (double)opt.left[k] - ref.left[k];
+                double dr = (double)opt.right[k] - ref.right[k];
+                double e = fabs(dl) > fabs(dr) ? fabs(dl) : fabs(dr);
+
+                err_sum += dl * dl + dr * dr;
+
+                if (e > max_err)
+                    max_err = e;
+
+                if (e > dopt.tolerance && !reported) {
+                    reported = 1;
+                    first_frame = frame + k;
+                    first_tick = ticks;
+                    first_order = order;
+                    first_row = row;
+                    first_ref = fabs(dl) > fabs(dr) ? ref.left[k] : ref.right[k];
+                    first_opt = fabs(dl) > fabs(dr) ? opt.left[k] : opt.right[k];
+                }
+            }
+        }
+
+        for (u32 k = 0; k < n; k++)
+            ref_sum += (double)ref.left[k] * ref.left[k] + (double)ref.right[k] * ref.right[k];
+
+        frame += n;
+        ticks++;
+    }
+
+    D_Close(&ref);
+    D_Close(&opt);
+
+    if (reported == 2)
+        return 1;
+
+    // error energy relative to the reference signal
+    double rms_db = err_sum > 0 ? 10.0 * log10(err_sum / (ref_sum > 0 ? ref_sum : 1.0)) : -INFINITY;
+    int failed = rms_db > path->max_rms_db;
+
+    if (ref_hash == opt_hash) {
+        printf("%s [%s]: bit-exact, %u ticks, %llu frames, hash %016llx\n",
+               file, path->name, ticks, (unsigned long long)frame, (unsigned long long)ref_hash);
+    } else {
+        printf("%s [%s]: %u of %u ticks differ, max error %.3g, rms error %.1f dB (limit %.1f dB)%s\n",
+               file, path->name, differing_ticks, ticks, max_err, rms_db, path->max_rms_db, failed ? "  FAILED" : "");
+    }
+
+    if (reported)
+        printf("    first difference at frame %llu (tick %u, order %u, row %u): reference %.9g, optimized %.9g\n",
+               (unsigned long long)first_frame, first_tick, first_order, first_row, first_ref, first_opt);
+
+    return failed;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void D_Usage()
+{
+    printf("usage: xm_difftest [-s seconds] [-r rate] [-e tolerance] [-z] module.xm ...\n");
+    printf("  -s seconds     render length per module, 0 for the whole song (60)\n");
+    printf("  -r rate        mixing rate (44100)\n");
+    printf("  -e tolerance   smallest sample difference reported as the first difference (0)\n");
+    printf("  -z             compress the samples to ADPCM first\n");
+}
+
+int main(int argc, char **argv)
+{
+    dopt.rate = 44100;
+    dopt.seconds = 60;
+    dopt.tolerance = 0;
+    dopt.compress = 0;
+
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            dopt.seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            dopt.rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            dopt.tolerance = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-z")) {
+            dopt.compress = 1;
+        } else {
+            D_Usage();
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        D_Usage();
+        return 2;
+    }
+
+    int failures = 0;
+
+    for (; i < argc; i++) {
+        XM_module_t module;
+
+        if (XM_LoadFile(argv[i], &module) < 0) {
+            printf("%s: unable to load module\n", argv[i]);
+            failures++;
+            continue;
+        }
+
+        if (dopt.compress)
+            XM_CompressSamples(&module);
+
+        for (u32 p = 0; p < D_NUM_PATHS; p++)
+            failures += D_TestPath(&module, argv[i], &d_paths[p]);
+
+        XM_FreeModule(&module);
+    }
+
+    printf("%d failure(s)\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xm.h"
+
+
+// generated modules only use effects the player understands
+static const u8 g_effects[] = {
+    XM_FX_TONE_PORTA,
+    XM_FX_VIBRATO,
+    XM_FX_SET_PANNING,
+    XM_FX_SAMPLE_OFFSET,
+    XM_FX_VOLUME_SLIDE,
+    XM_FX_SET_VOLUME,
+    XM_FX_MULTI_EFFECT_E,
+    XM_FX_SET_GLOBAL_VOLUME,
+};
+
+#define G_NUM_EFFECTS (sizeof(g_effects) / sizeof(g_effects[0]))
+
+struct g_options
+{
+    u64 seed;
+    u16 num_channels;
+    u16 num_patterns;
+    u16 song_length;
+    u16 num_rows;
+    u16 num_instruments;
+    float note_density;
+    float effect_density;
+    u8 bits;
+    int loop_type;  // S_LOOP_*, 3 for both loop bits, or -1 for a mix of none, fwd and pp
+    u32 sample_length;
+    u8 envelopes;
+    u16 tempo;
+    u16 bpm;
+} go;
+
+u64 g_state;
+
+
+// ---------------------------------------------------------------------------
+
+// xorshift64*: identical output on every platform for a given seed
+u32 G_Random()
+{
+    g_state ^= g_state >> 12;
+    g_state ^= g_state << 25;
+    g_state ^= g_state >> 27;
+
+    return (u32)((g_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+u32 G_RandomRange(u32 n)
+{
+    return G_Random() % n;
+}
+
+int G_Chance(float p)
+{
+    return G_Random() < (u32)(p * 4294967295.0);
+}
+
+
+void G_Write8(FILE *fp, u8 v)
+{
+    fputc(v, fp);
+}
+
+void G_Write16(FILE *fp, u16 v)
+{
+    fputc(v & 0xFF, fp);
+    fputc(v >> 8, fp);
+}
+
+void G_Write32(FILE *fp, u32 v)
+{
+    G_Write16(fp, v & 0xFFFF);
+    G_Write16(fp, v >> 16);
+}
+
+void G_WriteString(FILE *fp, const char *s, int length)
+{
+    for (int i = 0; i < length; i++)
+        fputc(*s ? *s++ : 0, fp);
+}
+
+
+// ---------------------------------------------------------------------------
+
+void G_WriteHeader(FILE *fp)
+{
+    G_WriteString(fp, "Extended Module: ", 17);
+    G_WriteString(fp, "xm_gen stress module", 20);
+    G_Write8(fp, 0x1A);
+    G_WriteString(fp, "xm_gen", 20);
+    G_Write16(fp, 0x0104);
+
+    // header size counts from the header size field itself
+    G_Write32(fp, 276);
+    G_Write16(fp, go.song_length);
+    G_Write16(fp, 0);
+    G_Write16(fp, go.num_channels);
+    G_Write16(fp, go.num_patterns);
+    G_Write16(fp, go.num_instruments);
+    G_Write16(fp, XM_MODULE_LINEAR_FREQ);
+    G_Write16(fp, go.tempo);
+    G_Write16(fp, go.bpm);
+
+    for (int i = 0; i < 256; i++)
+        G_Write8(fp, i < go.song_length ? G_RandomRange(go.num_patterns) : 0);
+}
+
+void G_RandomEffect(XM_note_t *note)
+{
+    note->fxtype = g_effects[G_RandomRange(G_NUM_EFFECTS)];
+
+    switch (note->fxtype) {
+        case XM_FX_SET_VOLUME:
+        case XM_FX_SET_GLOBAL_VOLUME:
+            note->fxparam = G_RandomRange(65);
+            break;
+
+        case XM_FX_VOLUME_SLIDE:
+            // only one nibble may be set
+            note->fxparam = G_Random() & 1 ? (1 + G_RandomRange(15)) << 4 : 1 + G_RandomRange(15);
+            break;
+
+        case XM_FX_MULTI_EFFECT_E:
+            note->fxparam = (XM_FX_E_NOTE_DELAY << 4) | (1 + G_RandomRange(go.tempo - 1));
+            break;
+
+        default:
+            note->fxparam = 1 + G_RandomRange(255);
+            break;
+    }
+}
+
+void G_WritePattern(FILE *fp)
+{
+    u32 num_notes = go.num_rows * go.num_channels;
+    u8 *packed = (u8*)malloc(num_notes * 6);
+    u32 size = 0;
+
+    for (u32 i = 0; i < num_notes; i++) {
+        XM_note_t note;
+        memset(&note, 0, sizeof(note));
+
+        // the first row sets up every channel so no note plays without an instrument
+        if (i < go.num_channels || G_Chance(go.note_density)) {
+            note.note = G_Chance(0.05f) && i >= go.num_channels ? 97 : 1 + G_RandomRange(96);
+            note.instrument = 1 + G_RandomRange(go.num_instruments);
+
+            if (G_Chance(0.5f))
+                note.volume = 0x10 + G_RandomRange(65);
+        }
+
+        if (G_Chance(go.effect_density))
+            G_RandomEffect(&note);
+
+        u8 flags = 0x80;
+        if (note.note) flags |= 0x01;
+        if (note.instrument) flags |= 0x02;
+        if (note.volume) flags |= 0x04;
+        if (note.fxtype) flags |= 0x08;
+        if (note.fxparam) flags |= 0x10;
+
+        // full notes are stored unpacked, everything else uses the flag byte
+        if (flags == 0x9F) {
+            packed[size++] = note.note;
+            packed[size++] = note.instrument;
+            packed[size++] = note.volume;
+            packed[size++] = note.fxtype;
+            packed[size++] = note.fxparam;
+        } else {
+            packed[size++] = flags;
+            if (flags & 0x01) packed[size++] = note.note;
+            if (flags & 0x02) packed[size++] = note.instrument;
+            if (flags & 0x04) packed[size++] = note.volume;
+            if (flags & 0x08) packed[size++] = note.fxtype;
+            if (flags & 0x10) packed[size++] = note.fxparam;
+        }
+    }
+
+    G_Write32(fp, 9);
+    G_Write8(fp, 0);
+    G_Write16(fp, go.num_rows);
+    G_Write16(fp, size);
+    fwrite(packed, 1, size, fp);
+
+    free(packed);
+}
+
+void G_WriteEnvelopePoints(FILE *fp, u8 num_points)
+{
+    u16 frame = 0;
+
+    for (int i = 0; i < XM_MAX_ENVELOPE_POINTS; i++) {
+        if (i < num_points) {
+            G_Write16(fp, frame);
+            G_Write16(fp, G_RandomRange(65));
+            frame += 1 + G_RandomRange(32);
+        } else {
+            G_Write16(fp, 0);
+            G_Write16(fp, 0);
+        }
+    }
+}
+
+void G_WriteInstrument(FILE *fp, int index)
+{
+    char name[23];
+    snprintf(name, sizeof(name), "instrument %d", index + 1);
+
+    // FT2 writes 263 bytes, the last 20 being reserved
+    G_Write32(fp, 263);
+    G_WriteString(fp, name, 22);
+    G_Write8(fp, 0);
+    G_Write16(fp, 1);
+    G_Write32(fp, 40);
+
+    for (int i = 0; i < 96; i++)
+        G_Write8(fp, 0);
+
+    u8 num_points = go.envelopes ? 4 : 0;
+    u8 flags = go.envelopes ? XM_ENVELOPE_ENABLED | XM_ENVELOPE_SUSTAIN : 0;
+
+    G_WriteEnvelopePoints(fp, num_points);
+    G_WriteEnvelopePoints(fp, num_points);
+
+    G_Write8(fp, num_points);
+    G_Write8(fp, num_points);
+    G_Write8(fp, 2);
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+    G_Write8(fp, 2);
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+    G_Write8(fp, flags);
+    G_Write8(fp, flags);
+
+    // vibrato type, sweep, depth, rate
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+
+    G_Write16(fp, go.envelopes ? 256 : 0);
+    G_Write16(fp, 0);
+
+    for (int i = 0; i < 20; i++)
+        G_Write8(fp, 0);
+
+    // a single sample per instrument
+    u8 loop_type = go.loop_type >= 0 ? go.loop_type : G_RandomRange(3);
+    u8 bytes = go.bits == 16 ? 2 : 1;
+    u32 loop_start = loop_type ? G_RandomRange(go.sample_length / 2) : 0;
+    u32 loop_length = loop_type ? go.sample_length - loop_start : 0;
+
+    // lengths are stored in bytes
+    G_Write32(fp, go.sample_length * bytes);
+    G_Write32(fp, loop_start * bytes);
+    G_Write32(fp, loop_length * bytes);
+    G_Write8(fp, 32 + G_RandomRange(33));
+    G_Write8(fp, 0);
+    G_Write8(fp, loop_type | (go.bits == 16 ? XM_SAMPLE_16BIT : 0));
+    G_Write8(fp, G_Random() & 0xFF);
+    G_Write8(fp, 0);
+    G_Write8(fp, 0);
+    G_WriteString(fp, name, 22);
+
+    // integer-only saw plus noise, delta encoded
+    u32 period = 16 + G_RandomRange(240);
+    s32 old = 0;
+
+    for (u32 i = 0; i < go.sample_length; i++) {
+        s32 saw = (s32)((i % period) * 65535 / period) - 32768;
+        s32 noise = (s32)(G_Random() >> 20) - 2048;
+        s32 value = (saw * 3) / 4 + noise;
+
+        if (go.bits == 16) {
+            G_Write16(fp, (u16)(value - old));
+            old = value;
+        } else {
+            G_Write8(fp, (u8)((value >> 8) - old));
+            old = value >> 8;
+        }
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+
+void G_Usage()
+{
+    printf("usage: xm_gen [options] output.xm\n");
+    printf("  -s seed         random seed (1)\n");
+    printf("  -c channels     1..64 (8)\n");
+    printf("  -p patterns     1..256 (16)\n");
+    printf("  -o orders       song length, 1..256 (number of patterns)\n");
+    printf("  -r rows         rows per pattern, 1..256 (64)\n");
+    printf("  -i instruments  1..128 (8)\n");
+    printf("  -n density      note density, 0..1 (0.5)\n");
+    printf("  -e density      effect density, 0..1 (0.25)\n");
+    printf("  -b bits         sample resolution, 8 or 16 (8)\n");
+    printf("  -l loop         none, fwd, pp, both or mixed (fwd)\n");
+    printf("  -L frames       sample length (16384)\n");
+    printf("  -E              enable volume and panning envelopes\n");
+    printf("  -t tempo        ticks per row (6)\n");
+    printf("  -B bpm          (125)\n");
+}
+
+int main(int argc, char **argv)
+{
+    go.seed = 1;
+    go.num_channels = 8;
+    go.num_patterns = 16;
+    go.song_length = 0;
+    go.num_rows = 64;
+    go.num_instruments = 8;
+    go.note_density = 0.5f;
+    go.effect_density = 0.25f;
+    go.bits = 8;
+    go.loop_type = 1;
+    go.sample_length = 16384;
+    go.envelopes = 0;
+    go.tempo = 6;
+    go.bpm = 125;
+
+    int i = 1;
+
+    for (; i < argc - 1 && argv[i][0] == '-'; i++) {
+        char opt = argv[i][1];
+
+        if (opt == 'E') {
+            go.envelopes = 1;
+            continue;
+        }
+
+        if (i + 1 >= argc - 1) {
+            G_Usage();
+            return 2;
+        }
+
+        const char *arg = argv[++i];
+
+        switch (opt) {
+            case 's': go.seed = strtoull(arg, 0, 0); break;
+            case 'c': go.num_channels = atoi(arg); break;
+            case 'p': go.num_patterns = atoi(arg); break;
+            case 'o': go.song_length = atoi(arg); break;
+            case 'r': go.num_rows = atoi(arg); break;
+            case 'i': go.num_instruments = atoi(arg); break;
+            case 'n': go.note_density = atof(arg); break;
+            case 'e': go.effect_density = atof(arg); break;
+            case 'b': go.bits = atoi(arg); break;
+            case 'L': go.sample_length = strtoul(arg, 0, 0); break;
+            case 't': go.tempo = atoi(arg); break;
+            case 'B': go.bpm = atoi(arg); break;
+
+            case 'l':
+                if (!strcmp(arg, "none")) go.loop_type = 0;
+                else if (!strcmp(arg, "fwd")) go.loop_type = 1;
+                else if (!strcmp(arg, "pp")) go.loop_type = 2;
+                else if (!strcmp(arg, "both")) go.loop_type = 3;
+                else go.loop_type = -1;
+                break;
+
+            default:
+                G_Usage();
+                return 2;
+        }
+    }
+
+    if (!go.song_length)
+        go.song_length = go.num_patterns;
+
+    if (i != argc - 1 ||
+        go.num_channels < 1 || go.num_channels > 64 ||
+        go.num_patterns < 1 || go.num_patterns > 256 ||
+        go.song_length < 1 || go.song_length > 256 ||
+        go.num_rows < 1 || go.num_rows > 256 ||
+        go.num_instruments < 1 || go.num_instruments > 128 ||
+        (go.bits != 8 && go.bits != 16) ||
+        go.sample_length < 2 || go.tempo < 2 || go.tempo > 31 || go.bpm < 32 || go.bpm > 255) {
+        G_Usage();
+        return 2;
+    }
+
+    FILE *fp = fopen(argv[i], "wb");
+    if (!fp) {
+        perror(argv[i]);
+        return 1;
+    }
+
+    g_state = go.seed ? go.seed : 0x9E3779B97F4A7C15ULL;
+
+    G_WriteHeader(fp);
+
+    for (int p = 0; p < go.num_patterns; p++)
+        G_WritePattern(fp);
+
+    for (int n = 0; n < go.num_instruments; n++)
+        G_WriteInstrument(fp, n);
+
+    fclose(fp);
+
+    return 0;
+}
@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "xm.h"
+#include "audio.h"
+#include "parallel.h"
+#include "playlist.h"
+#include "preview.h"
+
+
+#define W_BLOCK_FRAMES 4096
+
+static const char *w_interp_names[] = { "nearest", "linear", "cubic" };
+
+struct w_options
+{
+    u32 rate;
+    u8 interpolation;
+    double seconds;
+    const char *stems;   // file prefix, 0 for no stems
+    u8 mono_stems;
+    u8 format;
+    u32 num_threads;     // parallel segment render, 0 for serial
+    u8 loop;
+    u32 cache_mb;        // loop cache size, 0 for none
+    u8 compress;
+    u8 strip;
+    u8 playlist;
+    u32 crossfade_ms;
+    u8 preview;
+    double start;
+    u32 window_frames;   // peaks instead of PCM, 0 for PCM
+    u32 num_windows;
+    float gain;
+    u8 clip;
+    u8 dither;
+} wo;
+
+
+// ---------------------------------------------------------------------------
+
+double W_Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// plain file names are WAV files, anything else is a sink spec
+void W_SinkSpec(char *spec, size_t size, const char *output)
+{
+    if (!strcmp(output, "-") || !strcmp(output, "null") || !strcmp(output, "stdout") || !strcmp(output, "alsa") || strchr(output, ':'))
+        snprintf(spec, size, "%s", output);
+    else
+        snprintf(spec, size, "wav:%s", output);
+}
+
+// every sink converts through the same output stage
+S_sink_t *W_OpenSink(const char *spec, u8 num_channels)
+{
+    S_sink_t *sink = S_OpenSink(spec, wo.rate, num_channels, wo.format);
+
+    if (sink)
+        S_SetSinkOutput(sink, wo.gain, wo.clip, wo.dither);
+
+    return sink;
+}
+
+int W_WriteSegment(void *user, const float *left, const float *right, u32 num_frames)
+{
+    return S_WriteSink((S_sink_t*)user, left, right, num_frames) < num_frames;
+}
+
+int W_RenderParallel(XM_module_t *module, const char *output)
+{
+    char spec[1024];
+    W_SinkSpec(spec, sizeof(spec), output);
+
+    S_sink_t *sink = W_OpenSink(spec, 2);
+    if (!sink)
+        return 1;
+
+    PR_config_t config;
+    PR_DefaultConfig(&config);
+
+    config.rate = wo.rate;
+    config.interpolation = wo.interpolation;
+    config.num_threads = wo.num_threads;
+    config.max_frames = wo.seconds > 0 ? (u64)(wo.seconds * wo.rate) : 0;
+
+    double t0 = W_Now();
+    s64 frames = PR_RenderSong(module, &config, W_WriteSegment, sink);
+
+    S_DrainSink(sink);
+    S_CloseSink(sink);
+
+    if (frames < 0) {
+        fprintf(stderr, "%s: render failed\n", output);
+        return 1;
+    }
+
+    double elapsed = W_Now() - t0;
+
+    fprintf(stderr, "%s: %llu frames at %u Hz [%s], %.1fx realtime on %u threads\n", output, (unsigned long long)frames,
+            wo.rate, w_interp_names[wo.interpolation], elapsed > 0 ? frames / (elapsed * wo.rate) : 0.0, wo.num_threads);
+
+    return 0;
+}
+
+int W_Render(XM_module_t *module, const char *output)
+{
+    static float left[W_BLOCK_FRAMES], right[W_BLOCK_FRAMES];
+
+    int num_stems = wo.stems ? module->num_channels : 0;
+
+    float **stem_left = (float**)calloc(num_stems + 1, sizeof(float*));
+    float **stem_right = (float**)calloc(num_stems + 1, sizeof(float*));
+    S_sink_t **stem_sinks = (S_sink_t**)calloc(num_stems + 1, sizeof(S_sink_t*));
+
+    char spec[1024];
+    W_SinkSpec(spec, sizeof(spec), output);
+
+    S_sink_t *sink = W_OpenSink(spec, 2);
+    int failed = !sink;
+
+    for (int c = 0; c < num_stems && !failed; c++) {
+        snprintf(spec, sizeof(spec), "wav:%s%02d.wav", wo.stems, c + 1);
+
+        stem_left[c] = (float*)malloc(sizeof(float) * W_BLOCK_FRAMES);
+        stem_right[c] = (float*)malloc(sizeof(float) * W_BLOCK_FRAMES);
+        stem_sinks[c] = W_OpenSink(spec, wo.mono_stems ? 1 : 2);
+
+        failed = !stem_sinks[c];
+    }
+
+    if (!failed) {
+        S_Init(module->num_channels, wo.rate);
+        S_SetInterpolation(wo.interpolation);
+        XM_InitPlayer(module);
+        XM_SetLooping(wo.loop);
+
+        // offline there is no deadline, wait for a stream rather than
+        // rendering silence
+        XM_SetStreamWait(1);
+
+        if (wo.cache_mb && XM_EnableLoopCache(wo.cache_mb << 20))
+            fprintf(stderr, "%s: no memory for the loop cache\n", output);
+
+        u64 max_frames = wo.seconds > 0 ? (u64)(wo.seconds * wo.rate) : ~0ULL;
+        u64 frames = 0;
+        double t0 = W_Now();
+
+        while (frames < max_frames) {
+            u32 n = W_BLOCK_FRAMES;
+            if (n > max_frames - frames)
+                n = (u32)(max_frames - frames);
+
+            // one pass renders the mix and every stem
+            if (num_stems)
+                S_SetStemBuffers(stem_left, wo.mono_stems ? 0 : stem_right);
+
+            n = XM_RenderFrames(left, right, n);
+
+            if (S_WriteSink(sink, left, right, n) < n) {
+                fprintf(stderr, "%s: write failed\n", output);
+                failed = 1;
+                break;
+            }
+
+            for (int c = 0; c < num_stems; c++)
+                S_WriteSink(stem_sinks[c], stem_left[c], stem_right[c], n);
+
+            frames += n;
+            if (n < W_BLOCK_FRAMES)
+                break;
+        }
+
+        S_DrainSink(sink);
+
+        double elapsed = W_Now() - t0;
+        u8 cached = XM_IsLoopCached();
+
+        XM_ShutdownPlayer();
+        S_Shutdown();
+
+        // stdout may carry the audio, so the summary goes to stderr
+        fprintf(stderr, "%s: %llu frames at %u Hz [%s], %.1fx realtime", output, (unsigned long long)frames,
+                wo.rate, w_interp_names[wo.interpolation], elapsed > 0 ? frames / (elapsed * wo.rate) : 0.0);
+        if (num_stems)
+            fprintf(stderr, ", %d %s stems", num_stems, wo.mono_stems ? "mono" : "stereo");
+        if (cached)
+            fprintf(stderr, ", loop cached");
+        fprintf(stderr, "\n");
+    }
+
+    S_CloseSink(sink);
+
+    for (int c = 0; c < num_stems; c++) {
+        S_CloseSink(stem_sinks[c]);
+
+        free(stem_left[c]);
+        free(stem_right[c]);
+    }
+
+    free(stem_left);
+    free(stem_right);
+    free(stem_sinks);
+
+    return failed;
+}
+
+
+int W_WritePreview(void *user, const float *frames, u32 num_frames)
+{
+    return S_WriteSink((S_sink_t*)user, frames, 0, num_frames) < num_frames;
+}
+
+int W_WritePeaks(void *user, const PV_peak_t *peaks, u32 num_peaks)
+{
+    for (u32 i = 0; i < num_peaks; i++)
+        fprintf((FILE*)user, "%.6f %.6f %.6f\n", peaks[i].min, peaks[i].max, peaks[i].rms);
+
+    return ferror((FILE*)user);
+}
+
+// mono at a low rate, or its peaks one line per window
+int W_RenderPreview(XM_module_t *module, const char *output)
+{
+    PV_config_t config;
+    PV_DefaultConfig(&config);
+
+    config.rate = wo.rate;
+    config.start = wo.start;
+    config.seconds = wo.seconds;
+    config.window_frames = wo.window_frames;
+    config.num_windows = wo.num_windows;
+
+    u8 peaks = wo.window_frames || wo.num_windows;
+    double t0 = W_Now();
+    s64 frames;
+
+    if (peaks) {
+        FILE *fp = strcmp(output, "-") ? fopen(output, "w") : stdout;
+        if (!fp) {
+            fprintf(stderr, "%s: unable to open\n", output);
+            return 1;
+        }
+
+        frames = PV_RenderPeaks(module, &config, W_WritePeaks, fp);
+
+        if (fp != stdout && fclose(fp))
+            frames = -1;
+    } else {
+        char spec[1024];
+        W_SinkSpec(spec, sizeof(spec), output);
+
+        S_sink_t *sink = W_OpenSink(spec, 1);
+        if (!sink)
+            return 1;
+
+        frames = PV_RenderPreview(module, &config, W_WritePreview, sink);
+
+        S_DrainSink(sink);
+        S_CloseSink(sink);
+    }
+
+    if (frames < 0) {
+        fprintf(stderr, "%s: render failed\n", output);
+        return 1;
+    }
+
+    double elapsed = W_Now() - t0;
+
+    if (peaks)
+        fprintf(stderr, "%s: %lld peaks at %u Hz in %.1f ms\n", output, (long long)frames, wo.rate, elapsed * 1000);
+    else
+        fprintf(stderr, "%s: %lld mono frames at %u Hz, %.1fx realtime\n", output, (long long)frames,
+                wo.rate, elapsed > 0 ? frames / (elapsed * wo.rate) : 0.0);
+
+    return 0;
+}
+
+int W_RenderPlaylist(char **files, int num_files, const char *output)
+{
+    static float left[W_BLOCK_FRAMES], right[W_BLOCK_FRAMES];
+
+    char spec[1024];
+    W_SinkSpec(spec, sizeof(spec), output);
+
+    S_sink_t *sink = W_OpenSink(spec, 2);
+    if (!sink)
+        return 1;
+
+    PL_config_t config;
+    PL_DefaultConfig(&config);
+
+    config.rate = wo.rate;
+    config.interpolation = wo.interpolation;
+    config.crossfade_ms = wo.crossfade_ms;
+    config.max_seconds = wo.seconds;
+
+    if (PL_Start(&config)) {
+        S_CloseSink(sink);
+        return 1;
+    }
+
+    for (int f = 0; f < num_files; f++)
+        PL_Add(files[f]);
+
+    u64 frames = 0;
+    int failed = 0;
+    double t0 = W_Now();
+
+    while (!PL_IsFinished()) {
+        // offline there is no deadline, so wait for the loader rather than
+        // rendering silence
+        while (!PL_IsPreloaded()) {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, 0);
+        }
+
+        u32 n = PL_RenderFrames(left, right, W_BLOCK_FRAMES);
+
+        if (S_WriteSink(sink, left, right, n) < n) {
+            fprintf(stderr, "%s: write failed\n", output);
+            failed = 1;
+            break;
+        }
+
+        frames += n;
+    }
+
+    S_DrainSink(sink);
+
+    double elapsed = W_Now() - t0;
+
+    PL_Stop();
+    S_CloseSink(sink);
+
+    fprintf(stderr, "%s: %d modules, %llu frames at %u Hz [%s], %.1fx realtime\n", output, num_files, (unsigned long long)frames,
+            wo.rate, w_interp_names[wo.interpolation], elapsed > 0 ? frames / (elapsed * wo.rate) : 0.0);
+
+    return failed;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void W_Usage()
+{
+    printf("usage: xm_render [options] module.xm output\n");
+    printf("  module.xm       a file, or - to stream one from stdin\n");
+    printf("       xm_render -P [options] module.xm... output\n");
+    printf("  output          a WAV file name or a sink: null, wav:file, raw:file, stdout (-)");
+#ifdef XM_HAVE_ALSA
+    printf(", alsa[:device]");
+#endif
+    printf("\n");
+    printf("  -r rate         mixing rate (44100)\n");
+    printf("  -i interp       nearest, linear or cubic (linear)\n");
+    printf("  -s seconds      stop after this long, 0 for the whole song (0)\n");
+    printf("  -S prefix       also write every channel to prefixNN.wav\n");
+    printf("  -m              mono stems\n");
+    printf("  -f format       s16, s24 or f32 (f32)\n");
+    printf("  -g db           master gain\n");
+    printf("  -k              soft clip instead of clipping hard at full scale\n");
+    printf("  -D              TPDF dither the integer formats\n");
+    printf("  -j threads      render song segments in parallel, same output as serial\n");
+    printf("  -l              loop the song, needs -s\n");
+    printf("  -C megabytes    cache a repeating loop instead of rendering it again\n");
+    printf("  -z              play ADPCM compressed samples\n");
+    printf("  -d              drop unreachable patterns and samples no note plays\n");
+    printf("  -P              play the modules back to back, -s limits each one\n");
+    printf("  -x ms           crossfade between playlist modules (0)\n");
+    printf("  -V              preview: mono, nearest, no ramps, at 11025 Hz unless -r\n");
+    printf("  -t seconds      start the preview this far into the song (0)\n");
+    printf("  -w frames       write the min, max and RMS of every window as text\n");
+    printf("  -W windows      the same for this many windows over the preview\n");
+}
+
+int main(int argc, char **argv)
+{
+    wo.rate = 44100;
+    wo.interpolation = S_INTERP_LINEAR;
+    wo.seconds = 0;
+    wo.stems = 0;
+    wo.mono_stems = 0;
+    wo.format = S_SINK_F32;
+    wo.num_threads = 0;
+    wo.loop = 0;
+    wo.cache_mb = 0;
+    wo.compress = 0;
+    wo.strip = 0;
+    wo.playlist = 0;
+    wo.crossfade_ms = 0;
+    wo.preview = 0;
+    wo.start = 0;
+    wo.window_frames = 0;
+    wo.num_windows = 0;
+    wo.gain = 1.0f;
+    wo.clip = S_CLIP_NONE;
+    wo.dither = 0;
+
+    u8 rate_set = 0;
+    int i = 1;
+
+    for (; i < argc - 2 && argv[i][0] == '-'; i++) {
+        char opt = argv[i][1];
+
+        if (opt == 'm' || opt == 'l' || opt == 'z' || opt == 'd' || opt == 'P' || opt == 'V' || opt == 'k' || opt == 'D') {
+            if (opt == 'm')
+                wo.mono_stems = 1;
+            else if (opt == 'l')
+                wo.loop = 1;
+            else if (opt == 'z')
+                wo.compress = 1;
+            else if (opt == 'd')
+                wo.strip = 1;
+            else if (opt == 'V')
+                wo.preview = 1;
+            else if (opt == 'k')
+                wo.clip = S_CLIP_SOFT;
+            else if (opt == 'D')
+                wo.dither = 1;
+            else
+                wo.playlist = 1;
+            continue;
+        }
+
+        if (i + 1 >= argc - 2) {
+            W_Usage();
+            return 2;
+        }
+
+        const char *arg = argv[++i];
+
+        switch (opt) {
+            case 'r': wo.rate = atoi(arg); rate_set = 1; break;
+            case 's': wo.seconds = atof(arg); break;
+            case 'S': wo.stems = arg; break;
+            case 'j': wo.num_threads = atoi(arg); break;
+            case 'C': wo.cache_mb = atoi(arg); break;
+            case 'x': wo.crossfade_ms = atoi(arg); break;
+            case 't': wo.start = atof(arg); break;
+            case 'w': wo.window_frames = atoi(arg); wo.preview = 1; break;
+            case 'W': wo.num_windows = atoi(arg); wo.preview = 1; break;
+            case 'g': wo.gain = powf(10.0f, (float)atof(arg) / 20.0f); break;
+
+            case 'f':
+                if (!strcmp(arg, "s16")) wo.format = S_SINK_S16;
+                else if (!strcmp(arg, "s24")) wo.format = S_SINK_S24;
+                else wo.format = S_SINK_F32;
+                break;
+
+            case 'i':
+                if (!strcmp(arg, "nearest")) wo.interpolation = S_INTERP_NEAREST;
+                else if (!strcmp(arg, "cubic")) wo.interpolation = S_INTERP_CUBIC;
+                else wo.interpolation = S_INTERP_LINEAR;
+                break;
+
+            default:
+                W_Usage();
+                return 2;
+        }
+    }
+
+    if (wo.preview && !rate_set)
+        wo.rate = 11025;
+
+    // offline there is no reason to ever take the denormal slow path
+    S_EnableFlushToZero();
+
+    // a playlist renders each module with the plain serial path
+    if (wo.playlist) {
+        if (i > argc - 2 || !wo.rate || wo.num_threads || wo.stems || wo.loop || wo.cache_mb || wo.compress || wo.strip || wo.preview) {
+            W_Usage();
+            return 2;
+        }
+
+        return W_RenderPlaylist(argv + i, argc - 1 - i, argv[argc - 1]);
+    }
+
+    // stems come from one serial pass, a looping song needs an end
+    if (i != argc - 2 || !wo.rate || (wo.num_threads && (wo.stems || wo.loop)) || (wo.loop && wo.seconds <= 0) ||
+        (wo.preview && (wo.num_threads || wo.stems || wo.loop || wo.cache_mb))) {
+        W_Usage();
+        return 2;
+    }
+
+    XM_module_t module;
+
+    // a module on stdin starts playing as soon as its first order is in
+    if (!strcmp(argv[i], "-")) {
+        XM_reader_t reader;
+        XM_FdReader(&reader, 0);
+
+        double t0 = W_Now();
+
+        if (XM_OpenStream(&reader, &module) < 0) {
+            fprintf(stderr, "stdin: unable to load module\n");
+            return 1;
+        }
+
+        // segments, stripping, compression and previews need the whole module
+        s32 result = wo.num_threads || wo.strip || wo.compress || wo.preview ? XM_CloseStream(&module) : XM_WaitStreamStart(&module, 1);
+
+        if (result < 0) {
+            fprintf(stderr, "stdin: unable to load module\n");
+            XM_FreeModule(&module);
+            return 1;
+        }
+
+        fprintf(stderr, "stdin: playing after %.1f ms\n", (W_Now() - t0) * 1000);
+    } else if (XM_LoadFile(argv[i], &module) < 0) {
+        fprintf(stderr, "%s: unable to load module\n", argv[i]);
+        return 1;
+    }
+
+    if (wo.strip) {
+        u64 freed = XM_StripModule(&module);
+
+        XM_memory_usage_t usage;
+        XM_GetMemoryUsage(&module, &usage);
+
+        fprintf(stderr, "%s: %llu bytes of unused patterns and samples freed, %llu bytes of patterns and %llu of samples left\n", argv[i],
+                (unsigned long long)freed, (unsigned long long)usage.patterns, (unsigned long long)usage.samples);
+    }
+
+    if (wo.compress) {
+        u64 saved = XM_CompressSamples(&module);
+        fprintf(stderr, "%s: samples compressed, %llu bytes saved\n", argv[i], (unsigned long long)saved);
+    }
+
+    int failed;
+
+    if (wo.preview)
+        failed = W_RenderPreview(&module, argv[i + 1]);
+    else if (wo.num_threads)
+        failed = W_RenderParallel(&module, argv[i + 1]);
+    else
+        failed = W_Render(&module, argv[i + 1]);
+
+    if (XM_CloseStream(&module) < 0) {
+        fprintf(stderr, "stdin: the module ended early\n");
+        failed = 1;
+    }
+
+    XM_FreeModule(&module);
+
+    return failed;
+}
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xm.h"
+#include "audio.h"
+#include "engine.h"
+#include "playlist.h"
+#include "profile.h"
+#include "rtcheck.h"
+
+
+#define R_BLOCK_FRAMES 512
+#define R_LOOP_SECONDS 600     // longest a song may take to reach its loop
+#define R_CACHE_BYTES  (64 << 20)
+#define R_CROSSFADE_MS 500
+#define R_STREAM_CHUNK 4096    // bytes the streamed module arrives in, one per ms
+
+static const char *r_interp_names[] = { "nearest", "linear", "cubic" };
+
+struct r_options
+{
+    u32 rate;
+    double seconds;
+} ro;
+
+
+// ---------------------------------------------------------------------------
+
+// make sure the interposers actually see calls before trusting a clean run
+int R_SelfTest()
+{
+    RT_ResetViolations();
+
+    {
+        RT_SCOPE();
+        void *volatile p = malloc(16);
+        free(p);
+    }
+
+    u32 caught = RT_GetViolations();
+    RT_ResetViolations();
+
+    return caught == 2;
+}
+
+static void R_Sleep()
+{
+    struct timespec ts = { 0, 1000000 };
+    nanosleep(&ts, 0);
+}
+
+static u64 R_MaxFrames(double seconds)
+{
+    return seconds > 0 ? (u64)(seconds * ro.rate) : ~0ULL;
+}
+
+static int R_Report(const char *file, const char *what, u64 frames)
+{
+    u32 violations = RT_GetViolations();
+
+    if (violations)
+        printf("%s [%s]: %u violation(s), first in %s\n", file, what, violations, RT_GetFirstViolation());
+    else
+        printf("%s [%s]: clean, %llu frames\n", file, what, (unsigned long long)frames);
+
+    return violations ? 1 : 0;
+}
+
+// renders on the calling thread and passes every block through the output
+// stage, shaping in place and converting to each sample format
+int R_CheckModule(XM_module_t *module, const char *file, u8 interp)
+{
+    static float left[R_BLOCK_FRAMES], right[R_BLOCK_FRAMES];
+    static float pcm_f32[2 * R_BLOCK_FRAMES];
+    static s16 pcm_s16[2 * R_BLOCK_FRAMES];
+    static u8 pcm_s24[6 * R_BLOCK_FRAMES];
+
+    S_output_t shape, convert;
+    S_InitOutput(&shape, 0.5f, S_CLIP_SOFT, 0);
+    S_InitOutput(&convert, 1.0f, S_CLIP_HARD, 1);
+
+    S_Init(module->num_channels, ro.rate);
+    S_SetInterpolation(interp);
+    XM_InitPlayer(module);
+
+    u64 max_frames = R_MaxFrames(ro.seconds);
+    u64 frames = 0;
+
+    RT_ResetViolations();
+
+    while (frames < max_frames) {
+        u32 n = XM_RenderFrames(left, right, R_BLOCK_FRAMES);
+
+        S_ProcessOutput(&shape, left, right, n);
+        S_ConvertF32(&convert, left, right, pcm_f32, n);
+        S_ConvertS16(&convert, left, right, pcm_s16, n);
+        S_ConvertS24(&convert, left, right, pcm_s24, n);
+
+        frames += n;
+        if (n < R_BLOCK_FRAMES)
+            break;
+    }
+
+    int failed = R_Report(file, r_interp_names[interp], frames);
+
+    XM_ShutdownPlayer();
+    S_Shutdown();
+
+    return failed;
+}
+
+// loops the song until it streams from the loop cache, then plays a
+// second from it
+int R_CheckLoopCache(XM_module_t *module, const char *file)
+{
+    static float left[R_BLOCK_FRAMES], right[R_BLOCK_FRAMES];
+
+    S_Init(module->num_channels, ro.rate);
+    XM_InitPlayer(module);
+    XM_SetLooping(1);
+
+    if (XM_EnableLoopCache(R_CACHE_BYTES)) {
+        printf("%s [loop cache]: no memory for the cache\n", file);
+        XM_ShutdownPlayer();
+        S_Shutdown();
+        return 1;
+    }
+
+    u64 max_frames = R_MaxFrames(ro.seconds > 0 ? ro.seconds : R_LOOP_SECONDS);
+    u64 frames = 0;
+    u64 cached = 0;
+
+    RT_ResetViolations();
+
+    while (frames < max_frames && cached < ro.rate) {
+        u32 n = XM_RenderFrames(left, right, R_BLOCK_FRAMES);
+
+        if (XM_IsLoopCached())
+            cached += n;
+
+        frames += n;
+        if (n < R_BLOCK_FRAMES)
+            break;
+    }
+
+    int failed = R_Report(file, "loop cache", frames);
+
+    if (!failed && !cached)
+        printf("%s [loop cache]: the loop was not reached, only the recording was checked\n", file);
+
+    XM_DisableLoopCache();
+    XM_ShutdownPlayer();
+    S_Shutdown();
+
+    return failed;
+}
+
+// the render thread fills the ring with the output stage and adaptive
+// quality on, this thread drains it through E_ReadFrames
+int R_CheckEngine(XM_module_t *module, const char *file)
+{
+    static float left[R_BLOCK_FRAMES], right[R_BLOCK_FRAMES];
+
+    S_Init(module->num_channels, ro.rate);
+    XM_InitPlayer(module);
+
+    E_config_t config;
+    E_DefaultConfig(&config);
+
+    config.adaptive = 1;
+    config.gain = 0.5f;
+    config.clip = S_CLIP_SOFT;
+
+    RT_ResetViolations();
+
+    if (E_Start(XM_GetCurrentPlayer(), S_GetCurrentMixer(), &config)) {
+        printf("%s [engine]: unable to start the render thread\n", file);
+        XM_ShutdownPlayer();
+        S_Shutdown();
+        return 1;
+    }
+
+    u64 max_frames = R_MaxFrames(ro.seconds);
+    u64 frames = 0;
+
+    while (frames < max_frames && !E_IsFinished()) {
+        if (!E_GetBufferedFrames()) {
+            R_Sleep();
+            continue;
+        }
+
+        frames += E_ReadFrames(left, right, R_BLOCK_FRAMES);
+    }
+
+    E_Stop();
+
+    int failed = R_Report(file, "engine", frames);
+
+    XM_ShutdownPlayer();
+    S_Shutdown();
+
+    return failed;
+}
+
+// the module twice in a row with a crossfade between, at most the render
+// length altogether
+int R_CheckPlaylist(const char *file)
+{
+    static float left[R_BLOCK_FRAMES], right[R_BLOCK_FRAMES];
+
+    PL_config_t config;
+    PL_DefaultConfig(&config);
+
+    config.rate = ro.rate;
+    config.crossfade_ms = R_CROSSFADE_MS;
+    config.max_seconds = ro.seconds / 2;
+
+    RT_ResetViolations();
+
+    if (PL_Start(&config)) {
+        printf("%s [playlist]: unable to start the playlist\n", file);
+        return 1;
+    }
+
+    PL_Add(file);
+    PL_Add(file);
+
+    u64 frames = 0;
+
+    while (!PL_IsFinished()) {
+        // wait for the loader, as an offline render does
+        while (!PL_IsPreloaded())
+            R_Sleep();
+
+        frames += PL_RenderFrames(left, right, R_BLOCK_FRAMES);
+    }
+
+    PL_Stop();
+
+    return R_Report(file, "playlist", frames);
+}
+
+
+// a trickle, so playback catches up with the download
+static s32 R_SlowRead(void *user, void *buffer, u32 bytes)
+{
+    R_Sleep();
+    return (s32)fread(buffer, 1, bytes < R_STREAM_CHUNK ? bytes : R_STREAM_CHUNK, (FILE*)user);
+}
+
+// plays the module while it is still streaming in, the player has to hold
+// its ticks instead of waiting for the download
+int R_CheckStream(const char *file)
+{
+    static float left[R_BLOCK_FRAMES], right[R_BLOCK_FRAMES];
+
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        printf("%s [stream]: unable to open\n", file);
+        return 1;
+    }
+
+    XM_reader_t reader;
+    reader.read = R_SlowRead;
+    reader.user = fp;
+
+    XM_module_t module;
+
+    // plays straight after the header, with nothing of the song in yet
+    if (XM_OpenStream(&reader, &module) < 0) {
+        printf("%s [stream]: unable to load module\n", file);
+        fclose(fp);
+        return 1;
+    }
+
+    S_Init(module.num_channels, ro.rate);
+    XM_InitPlayer(&module);
+
+    u64 max_frames = R_MaxFrames(ro.seconds);
+    u64 frames = 0;
+    u32 held = 0;
+
+    RT_ResetViolations();
+
+    while (frames < max_frames) {
+        u32 n = XM_RenderFrames(left, right, R_BLOCK_FRAMES);
+
+        held += XM_GetCurrentPlayer()->stalled;
+
+        frames += n;
+        if (n < R_BLOCK_FRAMES)
+            break;
+    }
+
+    int failed = R_Report(file, "stream", frames);
+
+    if (!failed && !held)
+        printf("%s [stream]: the download never fell behind\n", file);
+
+    XM_ShutdownPlayer();
+    S_Shutdown();
+
+    // waits for the rest of the download
+    XM_FreeModule(&module);
+    fclose(fp);
+
+    return failed;
+}
+
+
+// ---------------------------------------------------------------------------
+
+void R_Usage()
+{
+    printf("usage: xm_rtcheck [-s seconds] [-r rate] module.xm ...\n");
+    printf("  -s seconds     render length per module and check, 0 for the whole song (0)\n");
+    printf("  -r rate        mixing rate (44100)\n");
+}
+
+int main(int argc, char **argv)
+{
+    ro.rate = 44100;
+    ro.seconds = 0;
+
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            ro.seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            ro.rate = atoi(argv[++i]);
+        } else {
+            R_Usage();
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        R_Usage();
+        return 2;
+    }
+
+    if (!RT_IsEnforced() || !R_SelfTest()) {
+        printf("xm_rtcheck: allocation and lock interposers are not active in this build\n");
+        return 2;
+    }
+
+    // profiler scopes would otherwise allocate their buffer on first use
+    P_InitThread("xm_rtcheck", 0);
+
+    int failures = 0;
+
+    for (; i < argc; i++) {
+        XM_module_t module;
+
+        if (XM_LoadFile(argv[i], &module) < 0) {
+            printf("%s: unable to load module\n", argv[i]);
+            failures++;
+            continue;
+        }
+
+        for (u8 interp = S_INTERP_NEAREST; interp <= S_INTERP_CUBIC; interp++)
+            failures += R_CheckModule(&module, argv[i], interp);
+
+        failures += R_CheckLoopCache(&module, argv[i]);
+        failures += R_CheckEngine(&module, argv[i]);
+
+        XM_FreeModule(&module);
+
+        failures += R_CheckPlaylist(argv[i]);
+        failures += R_CheckStream(argv[i]);
+    }
+
+    printf("%d failure(s)\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -32,6 +32,7 @@
 #define XM_FX_E_SET_FINETUNE           0x5
 #define XM_FX_E_SET_LOOP_BEGIN         0x6
 #define XM_FX_E_SET_TREMOLO_CONTROL    0x7
+#define XM_FX_E_SYNC                   0x8   // unused by FT2, a marker for XM_EVENT_MARKER
 #define XM_FX_E_RETRIG_NOTE            0x9
 #define XM_FX_E_FINE_VOLUME_SLIDE_UP   0xA
 #define XM_FX_E_FINE_VOLUME_SLIDE_DOWN 0xB
@@ -72,6 +73,7 @@ typedef struct XM_pattern_t{
 #define XM_SAMPLE_FWD_LOOP 0x1
 #define XM_SAMPLE_PP_LOOP  0x2
 #define XM_SAMPLE_16BIT    0x10
+#define XM_SAMPLE_ADPCM    0x80   // in memory only, see XM_CompressSamples
 
 typedef struct XM_sample_t {
     u32 length;
@@ -148,10 +150,104 @@ typedef struct XM_module_t {
 
     XM_pattern_t *patterns;
     XM_instrument_t *instruments;
+
+    // sample data found in the pool instead of being kept twice
+    u64 shared_bytes;
+
+    // set while a stream is still loading the module
+    struct XM_stream_t *stream;
 } XM_module_t;
 
 
+// Modules load from any byte source without seeking, so pipes and sockets
+// work as well as files.  read() fills up to `bytes` and returns the bytes
+// read, 0 at the end of the input or negative on an error.
+typedef struct {
+    s32 (*read)(void *user, void *buffer, u32 bytes);
+    void *user;
+} XM_reader_t;
+
+void XM_FdReader(XM_reader_t *reader, int fd);
+
 s32 XM_LoadFile(const char* file, XM_module_t *module);
+s32 XM_LoadReader(const XM_reader_t *reader, XM_module_t *module);
+void XM_FreeModule(XM_module_t *module);
+
+// Streaming load: reads the header, then loads the rest on a thread of its
+// own.  Patterns and instruments become usable as they arrive.  When
+// playback catches up with the download the player holds the tick and
+// renders silence until the row's pattern and instruments are in, or with
+// XM_SetStreamWait blocks for them.  XM_WaitStreamStart blocks until the
+// first `orders` orders can play.  XM_CloseStream waits for the whole
+// module and returns the load result, a failed load ends the song where
+// the data stopped.  XM_FreeModule closes a stream first.
+s32 XM_OpenStream(const XM_reader_t *reader, XM_module_t *module);
+s32 XM_WaitStreamStart(XM_module_t *module, u16 orders);
+s32 XM_CloseStream(XM_module_t *module);
+
+// used by the player.  The poll is lock-free and returns 1 when the data
+// is in, 0 while the download is behind and -1 if the load failed first.
+// The wait blocks and returns 0 if the load failed before getting this far.
+s8 XM_PollStream(struct XM_stream_t *stream, u32 patterns, u32 instruments);
+u8 XM_WaitStream(struct XM_stream_t *stream, u32 patterns, u32 instruments);
+
+// Re-encodes every sample as ADPCM (see audio.h), about a quarter of the
+// size of 16 bit data and half of 8 bit, at some loss of quality and a
+// block decode now and then while mixing.  The old sample data is freed,
+// so no player may be playing the module.  Returns the bytes saved, 0 for
+// a module still streaming in.
+u64 XM_CompressSamples(XM_module_t *module);
+
+// Frees what the song can never play: patterns missing from the order
+// list and the data of samples no note or note delay can trigger.  The
+// headers stay, so indices and the player's behaviour do not change.  No
+// player may be playing the module.  Returns the bytes freed, 0 for a
+// module still streaming in.
+u64 XM_StripModule(XM_module_t *module);
+
+typedef struct {
+    u64 patterns;      // unpacked pattern data
+    u64 samples;       // sample data the module references
+    u64 shared;        // of that, also referenced by other modules
+    u64 instruments;   // module, instrument and sample headers
+    u64 tables;        // the player's frequency table
+    u64 player;        // player state, mixer and loop cache
+} XM_memory_usage_t;
+
+// The player parts are those of the current player when it plays the
+// module, and 0 otherwise.
+void XM_GetMemoryUsage(const XM_module_t *module, XM_memory_usage_t *usage);
+
+
+// ----------------------------------------------------------------------------
+// Sample pool (sample_pool.cpp)
+// ----------------------------------------------------------------------------
+
+// Decoded sample data lives in one process-wide pool keyed by a hash of its
+// contents, so identical samples in any number of loaded modules and players
+// share one immutable, reference-counted copy.  Safe to use from any thread.
+
+typedef struct {
+    u32 num_samples;    // distinct samples held
+    u64 bytes;          // their size
+    u64 shared_bytes;   // what the extra references would have cost
+} XM_pool_stats_t;
+
+// a private block for the loader to decode into
+void *XM_PoolAlloc(u32 bytes);
+
+// hands a block from XM_PoolAlloc over to the pool and returns the pooled
+// copy, which is an earlier identical block when there is one; its size
+// goes to shared_bytes then, 0 otherwise
+void *XM_PoolShare(void *data, u32 *shared_bytes);
+
+// drops one reference, the last one frees the data
+void XM_PoolRelease(void *data);
+
+// references to the data, 0 while private to the loader
+u32 XM_PoolRefs(const void *data);
+
+void XM_GetPoolStats(XM_pool_stats_t *stats);
 
 
 // ----------------------------------------------------------------------------
@@ -172,52 +268,178 @@ typedef struct {
     u8 active; // 0..1
 } XM_envelope_state_t;
 
-typedef struct XM_channel_state_t {    
-    u16 period;  // 0..7681
-    s8 volume;   // 0..64
-    u8 panning;  // 0..255
-    u8 note;     // 0..97
-    u8 note_control;
+// a multiple of the player's 16 channel lanes
+#define XM_MAX_CHANNELS 128
 
+// per-channel state only needed when a row is read
+typedef struct XM_channel_state_t {    
+    u8 note;       // 0..97
     u8 instrument; // 0..127
     
     XM_sample_t *sample;
     u32 sample_offset;
 
-    u8 fxtype; // 0..31
-    u8 fxparam; // 0..255
-
     XM_envelope_state_t volume_envelope;
     XM_envelope_state_t panning_envelope;
-    
-    u16 tone_porta_target; // 0..7681
-    u8 tone_porta_speed;   // 0..255
-    
-    s8 vibrato_pos;    // -31..+31
-    u8 vibrato_speed;  // 0..15
-    u8 vibrato_depth;  // 0..15
-    s16 vibrato_delta;
-    
-    u16 volume_fadeout; // 0..65535
 } XM_channel_state_t;
 
+// Per-channel state touched on every tick, one array per field so the
+// effect and voice update passes run across all channels at once.
+typedef struct XM_channel_hot_t {
+    u16 period[XM_MAX_CHANNELS];            // 0..7681
+    u16 tone_porta_target[XM_MAX_CHANNELS]; // 0..7681
+    u16 volume_fadeout[XM_MAX_CHANNELS];    // 0..65535
+    s16 vibrato_delta[XM_MAX_CHANNELS];
+
+    s8 volume[XM_MAX_CHANNELS];           // 0..64
+    u8 panning[XM_MAX_CHANNELS];          // 0..255
+    u8 note_control[XM_MAX_CHANNELS];
+    u8 fxtype[XM_MAX_CHANNELS];           // 0..31
+    u8 fxparam[XM_MAX_CHANNELS];          // 0..255
+    u8 tone_porta_speed[XM_MAX_CHANNELS]; // 0..255
+    s8 vibrato_pos[XM_MAX_CHANNELS];      // -31..+31
+    u8 vibrato_speed[XM_MAX_CHANNELS];    // 0..15
+    u8 vibrato_depth[XM_MAX_CHANNELS];    // 0..15
+
+    // envelope values, 64 and 32 while the envelope is inactive
+    u8 envelope_volume[XM_MAX_CHANNELS];
+    u8 envelope_panning[XM_MAX_CHANNELS];
+
+    // global volume as each channel saw it, Gxx only reaches the
+    // channels after it until the row is over
+    u8 global_volume[XM_MAX_CHANNELS];
+} XM_channel_hot_t;
+
 typedef struct XM_player_state_t {
     XM_module_t *module;
     u32 tick;
-    u8 pattern_index;
+    u64 frame;    // output frames rendered since XM_InitPlayer
+    u16 pattern_index;
     u16 row;
     u32 *linear_frequencies;
-    XM_channel_state_t *cs;
+    XM_channel_state_t cs[XM_MAX_CHANNELS];
+    XM_channel_hot_t ch;
+    u32 row_effects; // bit n set when a channel runs effect n this row
     
     u16 current_bpm;
     u16 current_tempo;
     
     u8 global_volume;
+
+    u32 tick_frames_left;
+    u32 tick_frames_frac;
+
+    // the row playing now, pattern_index and row already point at the next
+    u16 playing_order;
+    u16 playing_row;
+
+    u8 looping;
+    u8 stream_wait;     // block for a streaming module's rows, offline only
+    u8 stalled;         // the tick was held, the download is behind
+    struct XM_loop_cache_t *loop_cache;
+    struct XM_event_queue_t *events;
 } XM_player_state_t;
 
+// All player functions act on the calling thread's current player, a zeroed
+// XM_player_state_t can be selected to run several songs side by side.
+//
+// Realtime contract: once XM_InitPlayer (and S_Init) returned, XM_RunTick
+// and XM_RenderFrames never allocate, lock or make system calls, a stream
+// that falls behind included, unless XM_SetStreamWait is on.  Builds with
+// XM_RTCHECK enforce this, see rtcheck.h.
+void XM_SetCurrentPlayer(XM_player_state_t *player);
+XM_player_state_t *XM_GetCurrentPlayer();
+
 void XM_InitPlayer(XM_module_t *module);
+void XM_ShutdownPlayer();
 void XM_RunTick();
 
+// run ticks and mix until num_frames are rendered or the song ends
+u32 XM_RenderFrames(float *left, float *right, u32 num_frames);
+
+u8 XM_IsSongFinished();
+
+// play forever, restarting from song_restart_pos after the last order
+void XM_SetLooping(u8 enable);
+
+// For offline renders of a module still streaming in: wait for a row that
+// has not arrived instead of holding the tick and rendering silence.  The
+// wait locks and blocks, so this breaks the realtime contract.
+void XM_SetStreamWait(u8 enable);
+
+// Loop cache for songs that repeat forever.  A loop's audio is recorded as
+// it renders, and when the player and mixer reach the next loop point in the
+// exact state the recording started from, every later pass is the same and
+// is streamed from memory instead of being rendered.  If the state changes
+// from outside (a mute, a new interpolation mode, stems) rendering resumes
+// from the matching point in the loop.  Loops longer than max_bytes of audio
+// are always rendered.  Call after S_Init and XM_InitPlayer, not realtime safe.
+int XM_EnableLoopCache(u32 max_bytes);
+void XM_DisableLoopCache();
+
+// the current audio comes from the loop cache
+u8 XM_IsLoopCached();
+
+
+// ----------------------------------------------------------------------------
+// Sync events (xm_events.cpp)
+// ----------------------------------------------------------------------------
+
+// The player reports rows, orders, note triggers and E8x markers through a
+// lock-free single-producer/single-consumer queue, each tagged with the
+// output frame (counted like XM_player_state_t::frame) it becomes audible
+// at.  The rendering thread produces, any one other thread polls.
+
+#define XM_EVENT_ROW    0
+#define XM_EVENT_ORDER  1   // value: pattern number
+#define XM_EVENT_NOTE   2   // value: note 1..96, instrument: 1..128
+#define XM_EVENT_MARKER 3   // value: the x of E8x
+
+#define XM_EVENT_MASK(type) (1u << (type))
+#define XM_EVENTS_ALL       0xF
+
+typedef struct {
+    u64 frame;
+    u8 type;
+    u8 channel;
+    u8 value;
+    u8 instrument;
+    u16 order;
+    u16 row;
+} XM_event_t;
+
+typedef struct XM_event_queue_t XM_event_queue_t;
+
+// capacity is rounded up to a power of two, mask selects the event types;
+// returns 0 when out of memory
+XM_event_queue_t *XM_CreateEventQueue(u32 capacity, u32 mask);
+void XM_DestroyEventQueue(XM_event_queue_t *queue);
+
+// the current player reports to this queue from now on, 0 stops it
+void XM_SetEventQueue(XM_event_queue_t *queue);
+
+// consumer side, returns 0 when the queue is empty
+u8 XM_PollEvent(XM_event_queue_t *queue, XM_event_t *event);
+
+// events lost to a full queue
+u32 XM_GetDroppedEvents(XM_event_queue_t *queue);
+
+// producer side, the player calls this while rendering
+void XM_PushEvent(XM_event_queue_t *queue, const XM_event_t *event);
+
+// A muted channel still runs all of its row and effect logic, the mixer
+// only advances its voice without mixing it, so unmuting is seamless.
+// Acts on the current mixer and holds until its next S_Init.
+void XM_SetChannelMute(u8 channel, u8 mute);
+
+#define XM_SOLO_NONE 0xFF
+
+// mute every channel but one, XM_SOLO_NONE unmutes all of them
+void XM_SetChannelSolo(u8 channel);
+
+// print a pattern row to stdout, not realtime safe
+void XM_PrintRow(u16 pattern_index, u16 row);
+
 u16 XM_GetCurrentBPM();
 
 u32 XM_NoteToFrequency(u8 note, s8 finetune);
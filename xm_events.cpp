@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <atomic>
+
+#include "xm.h"
+
+
+// single producer (the thread rendering the player), single consumer
+struct XM_event_queue_t
+{
+    XM_event_t *events;
+    u32 capacity;    // a power of two
+    u32 mask;
+
+    std::atomic<u32> write_index;
+    std::atomic<u32> read_index;
+    std::atomic<u32> dropped;
+};
+
+
+// ---------------------------------------------------------------------------
+
+XM_event_queue_t *XM_CreateEventQueue(u32 capacity, u32 mask)
+{
+    u32 n = 16;
+    while (n < capacity && n < 0x80000000)
+        n <<= 1;
+
+    XM_event_queue_t *queue = (XM_event_queue_t*)calloc(1, sizeof(XM_event_queue_t));
+    if (!queue)
+        return 0;
+
+    queue->events = (XM_event_t*)malloc(sizeof(XM_event_t) * n);
+    queue->capacity = n;
+    queue->mask = mask;
+
+    // the atomics are lock-free, zeroed memory only needs their values set
+    queue->write_index.store(0);
+    queue->read_index.store(0);
+    queue->dropped.store(0);
+
+    if (!queue->events) {
+        free(queue);
+        return 0;
+    }
+
+    return queue;
+}
+
+void XM_DestroyEventQueue(XM_event_queue_t *queue)
+{
+    if (!queue)
+        return;
+
+    free(queue->events);
+    free(queue);
+}
+
+void XM_PushEvent(XM_event_queue_t *queue, const XM_event_t *event)
+{
+    if (!(queue->mask & XM_EVENT_MASK(event->type)))
+        return;
+
+    u32 w = queue->write_index.load(std::memory_order_relaxed);
+    u32 r = queue->read_index.load(std::memory_order_acquire);
+
+    // a full queue keeps the older events, the consumer fell behind
+    if (w - r == queue->capacity) {
+        queue->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    queue->events[w & (queue->capacity - 1)] = *event;
+    queue->write_index.store(w + 1, std::memory_order_release);
+}
+
+u8 XM_PollEvent(XM_event_queue_t *queue, XM_event_t *event)
+{
+    u32 r = queue->read_index.load(std::memory_order_relaxed);
+    u32 w = queue->write_index.load(std::memory_order_acquire);
+
+    if (r == w)
+        return 0;
+
+    *event = queue->events[r & (queue->capacity - 1)];
+    queue->read_index.store(r + 1, std::memory_order_release);
+
+    return 1;
+}
+
+u32 XM_GetDroppedEvents(XM_event_queue_t *queue)
+{
+    return queue->dropped.load(std::memory_order_relaxed);
+}
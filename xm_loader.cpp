@@ -12,61 +12,215 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <atomic>
 
 #include "xm.h"
+#include "audio.h"
+#include "profile.h"
 
 
 
-s32 XM_ReadFileHeader(int fd, XM_module_t* module)
+// ---------------------------------------------------------------------------
+// Buffered input
+
+#define XM_INPUT_BUFFER 4096
+
+// reads ahead from any reader, so the byte-wise pattern unpacking does not
+// cost a call each
+struct xm_input
+{
+    XM_reader_t reader;
+    u8 buffer[XM_INPUT_BUFFER];
+    u32 pos;
+    u32 fill;
+    u8 error;    // the input ended or failed, every read after it gives zeroes
+};
+
+static void XM_InitInput(xm_input *in, const XM_reader_t *reader)
+{
+    in->reader = *reader;
+    in->pos = 0;
+    in->fill = 0;
+    in->error = 0;
+}
+
+// readers may return less than asked for, pipes and sockets usually do
+static u32 XM_ReadFully(xm_input *in, u8 *dst, u32 bytes)
+{
+    u32 done = 0;
+
+    while (done < bytes) {
+        s32 n = in->reader.read(in->reader.user, dst + done, bytes - done);
+
+        if (n <= 0) {
+            in->error = 1;
+            break;
+        }
+
+        done += n;
+    }
+
+    return done;
+}
+
+static u32 XM_Read(xm_input *in, void *dst, u32 bytes)
+{
+    u8 *out = (u8*)dst;
+    u32 done = 0;
+
+    while (done < bytes && !in->error) {
+        if (in->pos == in->fill) {
+            // large reads bypass the buffer
+            if (bytes - done >= XM_INPUT_BUFFER) {
+                done += XM_ReadFully(in, out + done, bytes - done);
+                break;
+            }
+
+            s32 n = in->reader.read(in->reader.user, in->buffer, XM_INPUT_BUFFER);
+
+            if (n <= 0) {
+                in->error = 1;
+                break;
+            }
+
+            in->pos = 0;
+            in->fill = n;
+        }
+
+        u32 n = in->fill - in->pos < bytes - done ? in->fill - in->pos : bytes - done;
+
+        memcpy(out + done, in->buffer + in->pos, n);
+        in->pos += n;
+        done += n;
+    }
+
+    if (done < bytes)
+        memset(out + done, 0, bytes - done);
+
+    return in->error ? 0 : bytes;
+}
+
+// there is no seeking, skipped bytes are read and dropped
+static void XM_Skip(xm_input *in, u32 bytes)
+{
+    u8 scratch[256];
+
+    while (bytes && !in->error) {
+        u32 n = bytes < sizeof(scratch) ? bytes : sizeof(scratch);
+
+        XM_Read(in, scratch, n);
+        bytes -= n;
+    }
+}
+
+static s32 XM_ReadFd(void *user, void *buffer, u32 bytes)
 {
+    for (;;) {
+        ssize_t n = read((int)(intptr_t)user, buffer, bytes);
+
+        if (n >= 0 || errno != EINTR)
+            return (s32)n;
+    }
+}
+
+void XM_FdReader(XM_reader_t *reader, int fd)
+{
+    reader->read = XM_ReadFd;
+    reader->user = (void*)(intptr_t)fd;
+}
+
+
+// ---------------------------------------------------------------------------
+// Streaming state
+
+struct XM_stream_t
+{
+    xm_input in;
+    pthread_t thread;
+
+    // what the player may use, published in file order
+    std::atomic<u32> patterns;
+    std::atomic<u32> instruments;
+    std::atomic<u8> done;
+    s32 result;
+
+    // only taken by waits outside the realtime path
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void XM_Publish(XM_stream_t *stream, u32 patterns, u32 instruments)
+{
+    if (!stream)
+        return;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->patterns.store(patterns, std::memory_order_release);
+    stream->instruments.store(instruments, std::memory_order_release);
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+
+// ---------------------------------------------------------------------------
+
+s32 XM_ReadFileHeader(xm_input *in, XM_module_t* module)
+{
+    P_SCOPE("XM_ReadFileHeader");
+
     // read id text (must be "Extended Module: ")
     char id[18];
-    read(fd, id, 17);
+    XM_Read(in, id, 17);
     id[17] = 0;
     if (strcmp(id, "Extended Module: ") != 0)
         return -1;
     
     // module name
-    lseek(fd, 20, SEEK_CUR);
+    XM_Skip(in, 20);
     
     // next byte must always be 0x1A
     u8 magic;
-    read(fd, &magic, 1);
+    XM_Read(in, &magic, 1);
     if (magic != 0x1A)
         return -1;
     
     // tracker name
-    lseek(fd, 20, SEEK_CUR);
+    XM_Skip(in, 20);
     
     // version must be 0x0104
-    read(fd, &module->version, 2);
+    XM_Read(in, &module->version, 2);
     if (module->version != 0x0104) {
         printf("Warning: Version not 0x0104\n");
         //return -1;
     }
     
     // header size
-    lseek(fd, 4, SEEK_CUR);
+    XM_Skip(in, 4);
     
-    read(fd, &module->song_length, 2);
-    read(fd, &module->song_restart_pos, 2);
-    read(fd, &module->num_channels, 2);
-    read(fd, &module->num_patterns, 2);
-    read(fd, &module->num_instruments, 2);
-    read(fd, &module->flags, 2);
-    read(fd, &module->default_tempo, 2);
-    read(fd, &module->default_bpm, 2);
-    read(fd, module->pattern_order, 256);
+    XM_Read(in, &module->song_length, 2);
+    XM_Read(in, &module->song_restart_pos, 2);
+    XM_Read(in, &module->num_channels, 2);
+    if (module->num_channels == 0 || module->num_channels > XM_MAX_CHANNELS)
+        return -1;
+    XM_Read(in, &module->num_patterns, 2);
+    XM_Read(in, &module->num_instruments, 2);
+    XM_Read(in, &module->flags, 2);
+    XM_Read(in, &module->default_tempo, 2);
+    XM_Read(in, &module->default_bpm, 2);
+    XM_Read(in, module->pattern_order, 256);
     
-    return 0;
+    return in->error ? -1 : 0;
 }
 
 
-void XM_UnpackPattern(int fd, XM_module_t *module, XM_pattern_t *pattern)
+void XM_UnpackPattern(xm_input *in, XM_module_t *module, XM_pattern_t *pattern)
 {
     // determine packed size of pattern data
     u16 packed_size;
-    read(fd, &packed_size, 2);
+    XM_Read(in, &packed_size, 2);
     
     // empty pattern? initialize
     if (packed_size == 0) {
@@ -78,24 +232,28 @@ void XM_UnpackPattern(int fd, XM_module_t *module, XM_pattern_t *pattern)
     int k = 0;
     int channel = 0;
     int i = 0;
-    while(k < packed_size) {
-        XM_note_t *note = &pattern->data[i];
+    int num_notes = pattern->num_rows * module->num_channels;
+    XM_note_t dummy;
+
+    while(k < packed_size && !in->error) {
+        // notes past the end of the pattern are read and dropped
+        XM_note_t *note = i < num_notes ? &pattern->data[i] : &dummy;
         u8 cur_byte;
         
-        k += read(fd, &cur_byte, 1);
+        k += XM_Read(in, &cur_byte, 1);
         
         if (cur_byte & 0x80) {
-            if (cur_byte & 0x01) k += read(fd, &note->note, 1);
-            if (cur_byte & 0x02) k += read(fd, &note->instrument, 1);
-            if (cur_byte & 0x04) k += read(fd, &note->volume, 1);
-            if (cur_byte & 0x08) k += read(fd, &note->fxtype, 1);
-            if (cur_byte & 0x10) k += read(fd, &note->fxparam, 1);
+            if (cur_byte & 0x01) k += XM_Read(in, &note->note, 1);
+            if (cur_byte & 0x02) k += XM_Read(in, &note->instrument, 1);
+            if (cur_byte & 0x04) k += XM_Read(in, &note->volume, 1);
+            if (cur_byte & 0x08) k += XM_Read(in, &note->fxtype, 1);
+            if (cur_byte & 0x10) k += XM_Read(in, &note->fxparam, 1);
         } else {
             note->note = cur_byte;
-            k += read(fd, &note->instrument, 1);
-            k += read(fd, &note->volume, 1);
-            k += read(fd, &note->fxtype, 1);
-            k += read(fd, &note->fxparam, 1);
+            k += XM_Read(in, &note->instrument, 1);
+            k += XM_Read(in, &note->volume, 1);
+            k += XM_Read(in, &note->fxtype, 1);
+            k += XM_Read(in, &note->fxparam, 1);
         }
         
         // disambiguate arpeggio (0x0) from no effect (0xFF)
@@ -110,39 +268,55 @@ void XM_UnpackPattern(int fd, XM_module_t *module, XM_pattern_t *pattern)
     }
 }
 
-void XM_ReadPattern(int fd, XM_module_t *module, XM_pattern_t *pattern)
+void XM_ReadPattern(xm_input *in, XM_module_t *module, XM_pattern_t *pattern)
 {
     // header length & packing_type
-    lseek(fd, 5, SEEK_CUR);
+    XM_Skip(in, 5);
     
-    read(fd, &pattern->num_rows, 2);
+    XM_Read(in, &pattern->num_rows, 2);
+    
+    P_SCOPE1("XM_ReadPattern", "rows", pattern->num_rows);
     
     // alloc pattern data
-    pattern->data = (XM_note_t*)malloc(pattern->num_rows * module->num_channels * sizeof(XM_note_t));
-    memset(pattern->data, 0, pattern->num_rows * module->num_channels * sizeof(XM_note_t));
+    pattern->data = (XM_note_t*)calloc(pattern->num_rows * module->num_channels, sizeof(XM_note_t));
+
+    if (!pattern->data) {
+        in->error = 1;
+        return;
+    }
     
-    XM_UnpackPattern(fd, module, pattern);
+    XM_UnpackPattern(in, module, pattern);
 }
 
 
-void XM_ReadSampleHeader(int fd, XM_sample_t *sample)
+void XM_ReadSampleHeader(xm_input *in, XM_sample_t *sample)
 {
-    read(fd, &sample->length, 4);
-    read(fd, &sample->loop_start, 4);
-    read(fd, &sample->loop_length, 4);
-    read(fd, &sample->volume, 1);
-    read(fd, &sample->finetune, 1);
-    read(fd, &sample->type, 1);
-    read(fd, &sample->panning, 1);
-    read(fd, &sample->relative_note, 1);
+    XM_Read(in, &sample->length, 4);
+    XM_Read(in, &sample->loop_start, 4);
+    XM_Read(in, &sample->loop_length, 4);
+    XM_Read(in, &sample->volume, 1);
+    XM_Read(in, &sample->finetune, 1);
+    XM_Read(in, &sample->type, 1);
+    XM_Read(in, &sample->panning, 1);
+    XM_Read(in, &sample->relative_note, 1);
+
+    // FT2 plays a sample with both loop bits set as ping-pong
+    if ((sample->type & XM_SAMPLE_FWD_LOOP) && (sample->type & XM_SAMPLE_PP_LOOP))
+        sample->type &= ~XM_SAMPLE_FWD_LOOP;
+    
+    // lengths are stored in bytes, the player wants them in frames
+    if (sample->type & XM_SAMPLE_16BIT) {
+        sample->length >>= 1;
+        sample->loop_start >>= 1;
+        sample->loop_length >>= 1;
+    }
     
     // reserved & sample name
-    lseek(fd, 1, SEEK_CUR);
+    XM_Skip(in, 1);
     char name[23];
-    read(fd, name, 22);
+    XM_Read(in, name, 22);
     name[22] = 0;
         
-    //lseek(fd, 23, SEEK_CUR);
     /*
      printf(" name: %s\n", name);
      printf(" sample->length: %d\n", sample->length);
@@ -156,8 +330,10 @@ void XM_ReadSampleHeader(int fd, XM_sample_t *sample)
      */
 }
 
-void XM_ReadSampleData(int fd, XM_sample_t *sample)
+void XM_ReadSampleData(xm_input *in, XM_module_t *module, XM_sample_t *sample)
 {
+    P_SCOPE1("XM_ReadSampleData", "length", sample->length);
+
     if (sample->length == 0) {
         sample->data = 0;
         return;
@@ -165,9 +341,20 @@ void XM_ReadSampleData(int fd, XM_sample_t *sample)
     
     int data_type = sample->type & XM_SAMPLE_16BIT ? 2 : 1;
     
-    sample->data = (void*)malloc(sample->length * data_type);
+    sample->data = XM_PoolAlloc(sample->length * data_type);
+
+    if (!sample->data) {
+        XM_Skip(in, sample->length * data_type);
+        sample->length = 0;
+        return;
+    }
     
-    read(fd, sample->data, sample->length * data_type);
+    if (!XM_Read(in, sample->data, sample->length * data_type)) {
+        XM_PoolRelease(sample->data);
+        sample->data = 0;
+        sample->length = 0;
+        return;
+    }
     
     // convert sample data from delta-code representation
     if (sample->type & XM_SAMPLE_16BIT) {
@@ -191,118 +378,559 @@ void XM_ReadSampleData(int fd, XM_sample_t *sample)
             old = new_s;
         }
     }
+
+    // identical samples in other modules share one copy
+    u32 shared;
+    sample->data = XM_PoolShare(sample->data, &shared);
+    module->shared_bytes += shared;
 }
 
 
 
-void XM_ReadInstrument(int fd, XM_instrument_t *instrument)
+void XM_ReadInstrument(xm_input *in, XM_instrument_t *instrument)
 {
+    P_SCOPE("XM_ReadInstrument");
+
     u32 header_length;
-    read(fd, &header_length, 4);
+    XM_Read(in, &header_length, 4);
     
     // name
-    //lseek(fd, 22, SEEK_CUR);
     char name[23];
-    read(fd, name, 22);
+    XM_Read(in, name, 22);
     name[22] = 0;
     
-    read(fd, &instrument->type, 1);
-    read(fd, &instrument->num_samples, 2);
+    XM_Read(in, &instrument->type, 1);
+    XM_Read(in, &instrument->num_samples, 2);
     
     if (instrument->num_samples > 0) {
         // sample header length
-        lseek(fd, 4, SEEK_CUR);
+        XM_Skip(in, 4);
         
-        read(fd, instrument->sample_numbers, 96);
+        XM_Read(in, instrument->sample_numbers, 96);
         
         for (int i = 0; i < XM_MAX_ENVELOPE_POINTS; i++) {
-            read(fd, &instrument->volume_envelope.points[i].frame, 2);
-            read(fd, &instrument->volume_envelope.points[i].value, 2);
+            XM_Read(in, &instrument->volume_envelope.points[i].frame, 2);
+            XM_Read(in, &instrument->volume_envelope.points[i].value, 2);
         }
 
         for (int i = 0; i < XM_MAX_ENVELOPE_POINTS; i++) {
-            read(fd, &instrument->panning_envelope.points[i].frame, 2);
-            read(fd, &instrument->panning_envelope.points[i].value, 2);
+            XM_Read(in, &instrument->panning_envelope.points[i].frame, 2);
+            XM_Read(in, &instrument->panning_envelope.points[i].value, 2);
         }
         
-        read(fd, &instrument->volume_envelope.num_points, 1);
-        read(fd, &instrument->panning_envelope.num_points, 1);
-        read(fd, &instrument->volume_envelope.sustain_point, 1);
-        read(fd, &instrument->volume_envelope.loop_start, 1);
-        read(fd, &instrument->volume_envelope.loop_end, 1);
-        read(fd, &instrument->panning_envelope.sustain_point, 1);
-        read(fd, &instrument->panning_envelope.loop_start, 1);
-        read(fd, &instrument->panning_envelope.loop_end, 1);
-        read(fd, &instrument->volume_envelope.flags, 1);
-        read(fd, &instrument->panning_envelope.flags, 1);
-        read(fd, &instrument->vibrato_type, 1);
-        read(fd, &instrument->vibrato_sweep, 1);
-        read(fd, &instrument->vibrato_depth, 1);
-        read(fd, &instrument->vibrato_rate, 1);
-        read(fd, &instrument->volume_fadeout, 2);
+        XM_Read(in, &instrument->volume_envelope.num_points, 1);
+        XM_Read(in, &instrument->panning_envelope.num_points, 1);
+        XM_Read(in, &instrument->volume_envelope.sustain_point, 1);
+        XM_Read(in, &instrument->volume_envelope.loop_start, 1);
+        XM_Read(in, &instrument->volume_envelope.loop_end, 1);
+        XM_Read(in, &instrument->panning_envelope.sustain_point, 1);
+        XM_Read(in, &instrument->panning_envelope.loop_start, 1);
+        XM_Read(in, &instrument->panning_envelope.loop_end, 1);
+        XM_Read(in, &instrument->volume_envelope.flags, 1);
+        XM_Read(in, &instrument->panning_envelope.flags, 1);
+        XM_Read(in, &instrument->vibrato_type, 1);
+        XM_Read(in, &instrument->vibrato_sweep, 1);
+        XM_Read(in, &instrument->vibrato_depth, 1);
+        XM_Read(in, &instrument->vibrato_rate, 1);
+        XM_Read(in, &instrument->volume_fadeout, 2);
         
         // skip reserved
-        lseek(fd, 2, SEEK_CUR);
+        XM_Skip(in, 2);
         
-        lseek(fd, header_length - 243, SEEK_CUR);
-    } else
-        lseek(fd, header_length - 29, SEEK_CUR);
+        if (header_length > 243)
+            XM_Skip(in, header_length - 243);
+    } else if (header_length > 29)
+        XM_Skip(in, header_length - 29);
     
     // prepare to read samples
-    instrument->samples = (XM_sample_t*)malloc(instrument->num_samples * sizeof(XM_sample_t));
+    instrument->samples = (XM_sample_t*)calloc(instrument->num_samples, sizeof(XM_sample_t));
+
+    if (!instrument->samples) {
+        instrument->num_samples = 0;
+        in->error = 1;
+        return;
+    }
     
     // for some strange reason, the header and data is not stored continously
     for (int i = 0; i < instrument->num_samples; i++)
-        XM_ReadSampleHeader(fd, &instrument->samples[i]);
+        XM_ReadSampleHeader(in, &instrument->samples[i]);
 }
 
 
-s32 XM_LoadFile(const char *file, XM_module_t *module)
+static s32 XM_ReadHeader(xm_input *in, XM_module_t *module)
 {
-    int fd = open(file, O_RDONLY, 0);
-    
-    if (fd == -1) {
-        perror("XM_LoadFile");
+    memset(module, 0, sizeof(XM_module_t));
+
+    if (XM_ReadFileHeader(in, module) < 0)
         return -1;
-    }
-    
-    // read header
-    if (XM_ReadFileHeader(fd, module) < 0)
+
+    // alloc data, zeroed so that a partly loaded module frees cleanly
+    module->patterns = (XM_pattern_t*)calloc(module->num_patterns, sizeof(XM_pattern_t));
+    module->instruments = (XM_instrument_t*)calloc(module->num_instruments, sizeof(XM_instrument_t));
+
+    if ((module->num_patterns && !module->patterns) || (module->num_instruments && !module->instruments)) {
+        XM_FreeModule(module);
         return -1;
-    
-    // alloc data
-    module->patterns = (XM_pattern_t*)malloc(module->num_patterns * sizeof(XM_pattern_t));
-    module->instruments = (XM_instrument_t*)malloc(module->num_instruments * sizeof(XM_instrument_t));
+    }
+
+    return 0;
+}
+
+// everything after the header, a stream publishes each pattern and
+// instrument as soon as the player can use it
+static s32 XM_ReadBody(xm_input *in, XM_module_t *module, XM_stream_t *stream)
+{
+    int p = 0, i = 0;
 
     // read instruments, samples and pattern data
     // XM has a different layout for differing versions
     if (module->version >= 0x0104) {
-        for (int i = 0; i < module->num_patterns; i++)
-            XM_ReadPattern(fd, module, &module->patterns[i]);
+        for (; p < module->num_patterns && !in->error; p++) {
+            XM_ReadPattern(in, module, &module->patterns[p]);
+            XM_Publish(stream, p + 1, 0);
+        }
     
-        for (int i = 0; i < module->num_instruments; i++) {
-            XM_ReadInstrument(fd, &module->instruments[i]);
+        for (; i < module->num_instruments && !in->error; i++) {
+            XM_ReadInstrument(in, &module->instruments[i]);
         
             for (int s = 0; s < module->instruments[i].num_samples; s++)
-                XM_ReadSampleData(fd, &module->instruments[i].samples[s]);
+                XM_ReadSampleData(in, module, &module->instruments[i].samples[s]);
+
+            if (!in->error)
+                XM_Publish(stream, p, i + 1);
         }
     } else {
-        for (int i = 0; i < module->num_instruments; i++)
-            XM_ReadInstrument(fd, &module->instruments[i]);
+        for (int h = 0; h < module->num_instruments && !in->error; h++)
+            XM_ReadInstrument(in, &module->instruments[h]);
 
-        for (int i = 0; i < module->num_patterns; i++)
-            XM_ReadPattern(fd, module, &module->patterns[i]);
+        for (; p < module->num_patterns && !in->error; p++) {
+            XM_ReadPattern(in, module, &module->patterns[p]);
+            XM_Publish(stream, p + 1, 0);
+        }
 
-        for (int i = 0; i < module->num_instruments; i++)
+        for (; i < module->num_instruments && !in->error; i++) {
             for (int s = 0; s < module->instruments[i].num_samples; s++)
-                XM_ReadSampleData(fd, &module->instruments[i].samples[s]);
+                XM_ReadSampleData(in, module, &module->instruments[i].samples[s]);
+
+            if (!in->error)
+                XM_Publish(stream, p, i + 1);
+        }
     }
+
+    return in->error ? -1 : 0;
+}
+
+s32 XM_LoadReader(const XM_reader_t *reader, XM_module_t *module)
+{
+    P_SCOPE("XM_LoadReader");
+
+    xm_input *in = (xm_input*)malloc(sizeof(xm_input));
+    if (!in)
+        return -1;
+
+    XM_InitInput(in, reader);
+
+    s32 result = XM_ReadHeader(in, module);
+
+    if (!result) {
+        result = XM_ReadBody(in, module, 0);
+
+        if (result < 0)
+            XM_FreeModule(module);
+    }
+
+    free(in);
+
+    return result;
+}
+
+s32 XM_LoadFile(const char *file, XM_module_t *module)
+{
+    P_SCOPE("XM_LoadFile");
+
+    int fd = open(file, O_RDONLY, 0);
+    
+    if (fd == -1) {
+        perror("XM_LoadFile");
+        return -1;
+    }
+    
+    XM_reader_t reader;
+    XM_FdReader(&reader, fd);
+
+    s32 result = XM_LoadReader(&reader, module);
     
     close(fd);
     
+    return result;
+}
+
+
+// ---------------------------------------------------------------------------
+// Streaming load
+
+static void *XM_StreamThread(void *arg)
+{
+    XM_module_t *module = (XM_module_t*)arg;
+    XM_stream_t *stream = module->stream;
+
+    s32 result = XM_ReadBody(&stream->in, module, stream);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->result = result;
+    stream->done.store(1, std::memory_order_release);
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
     return 0;
 }
 
+s32 XM_OpenStream(const XM_reader_t *reader, XM_module_t *module)
+{
+    XM_stream_t *stream = (XM_stream_t*)calloc(1, sizeof(XM_stream_t));
+    if (!stream)
+        return -1;
+
+    XM_InitInput(&stream->in, reader);
+    stream->patterns.store(0);
+    stream->instruments.store(0);
+    stream->done.store(0);
+    stream->result = 0;
+
+    if (XM_ReadHeader(&stream->in, module) < 0) {
+        free(stream);
+        return -1;
+    }
+
+    pthread_mutex_init(&stream->lock, 0);
+    pthread_cond_init(&stream->cond, 0);
+
+    module->stream = stream;
+
+    if (pthread_create(&stream->thread, 0, XM_StreamThread, module)) {
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->cond);
+        free(stream);
+
+        module->stream = 0;
+        XM_FreeModule(module);
+        return -1;
+    }
+
+    return 0;
+}
+
+s8 XM_PollStream(XM_stream_t *stream, u32 patterns, u32 instruments)
+{
+    // done first, once it is set the counts are final
+    u8 done = stream->done.load(std::memory_order_acquire);
+
+    if (stream->patterns.load(std::memory_order_acquire) >= patterns &&
+        stream->instruments.load(std::memory_order_acquire) >= instruments)
+        return 1;
+
+    return done ? -1 : 0;
+}
+
+u8 XM_WaitStream(XM_stream_t *stream, u32 patterns, u32 instruments)
+{
+    if (stream->patterns.load(std::memory_order_acquire) >= patterns &&
+        stream->instruments.load(std::memory_order_acquire) >= instruments)
+        return 1;
+
+    pthread_mutex_lock(&stream->lock);
+
+    while (!stream->done.load(std::memory_order_acquire) &&
+           (stream->patterns.load(std::memory_order_acquire) < patterns ||
+            stream->instruments.load(std::memory_order_acquire) < instruments))
+        pthread_cond_wait(&stream->cond, &stream->lock);
+
+    u8 ready = stream->patterns.load(std::memory_order_acquire) >= patterns &&
+               stream->instruments.load(std::memory_order_acquire) >= instruments;
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return ready;
+}
+
+s32 XM_WaitStreamStart(XM_module_t *module, u16 orders)
+{
+    if (!module->stream)
+        return 0;
+
+    if (orders > module->song_length)
+        orders = module->song_length;
+
+    u32 patterns = 0;
+
+    for (int o = 0; o < orders; o++)
+        if (module->pattern_order[o] < module->num_patterns && module->pattern_order[o] + 1u > patterns)
+            patterns = module->pattern_order[o] + 1;
+
+    if (!XM_WaitStream(module->stream, patterns, 0))
+        return -1;
+
+    // every instrument a note in those orders asks for
+    u32 instruments = 0;
+
+    for (int o = 0; o < orders; o++) {
+        if (module->pattern_order[o] >= module->num_patterns)
+            continue;
+
+        XM_pattern_t *pattern = &module->patterns[module->pattern_order[o]];
+
+        for (int n = 0; n < pattern->num_rows * module->num_channels; n++)
+            if (pattern->data[n].instrument > instruments)
+                instruments = pattern->data[n].instrument;
+    }
+
+    if (instruments > module->num_instruments)
+        instruments = module->num_instruments;
+
+    return XM_WaitStream(module->stream, patterns, instruments) ? 0 : -1;
+}
+
+s32 XM_CloseStream(XM_module_t *module)
+{
+    XM_stream_t *stream = module->stream;
+    if (!stream)
+        return 0;
+
+    pthread_join(stream->thread, 0);
 
+    s32 result = stream->result;
 
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->cond);
+    free(stream);
 
+    module->stream = 0;
+
+    return result;
+}
+
+static u64 XM_CompressSample(XM_sample_t *sample)
+{
+    if (!sample->data || !sample->length || (sample->type & XM_SAMPLE_ADPCM))
+        return 0;
+
+    u8 is_16bit = sample->type & XM_SAMPLE_16BIT ? 1 : 0;
+    u32 bytes = sample->length * (is_16bit ? 2 : 1);
+    s16 *frames = (s16*)sample->data;
+
+    // 8 bit frames are scaled to the same level in 16 bit
+    if (!is_16bit) {
+        frames = (s16*)malloc(sample->length * sizeof(s16));
+        if (!frames)
+            return 0;
+
+        for (u32 i = 0; i < sample->length; i++) {
+            s32 v = ((s8*)sample->data)[i] * 258;
+            frames[i] = (s16)(v < -32768 ? -32768 : v);
+        }
+    }
+
+    u32 size = S_AdpcmSize(sample->length);
+    void *data = size < bytes ? XM_PoolAlloc(size) : 0;
+
+    if (data) {
+        S_EncodeAdpcm(frames, sample->length, (u8*)data);
+
+        XM_PoolRelease(sample->data);
+        sample->data = XM_PoolShare(data, 0);
+        sample->type |= XM_SAMPLE_ADPCM;
+    }
+
+    if (!is_16bit)
+        free(frames);
+
+    return data ? bytes - size : 0;
+}
+
+u64 XM_CompressSamples(XM_module_t *module)
+{
+    if (module->stream)
+        return 0;
+
+    u64 saved = 0;
+
+    for (int i = 0; i < module->num_instruments; i++)
+        for (int s = 0; s < module->instruments[i].num_samples; s++)
+            saved += XM_CompressSample(&module->instruments[i].samples[s]);
+
+    return saved;
+}
+
+static u32 XM_SampleBytes(const XM_sample_t *sample)
+{
+    if (sample->type & XM_SAMPLE_ADPCM)
+        return S_AdpcmSize(sample->length);
+
+    return sample->length * (sample->type & XM_SAMPLE_16BIT ? 2 : 1);
+}
+
+// marks the sample a trigger of instrument i on note n plays
+static void XM_MarkSample(XM_module_t *module, u8 **used, u32 i, u32 n)
+{
+    XM_instrument_t *instrument = &module->instruments[i];
+    u8 s = instrument->sample_numbers[n];
+
+    if (s < instrument->num_samples)
+        used[i][s] = 1;
+}
+
+u64 XM_StripModule(XM_module_t *module)
+{
+    if (module->stream)
+        return 0;
+
+    int nc = module->num_channels;
+    int ni = module->num_instruments;
+
+    u8 *reachable = (u8*)calloc(module->num_patterns + 1, 1);
+    u8 *held = (u8*)calloc(nc * ni + 1, 1);    // instruments a channel may hold
+    u8 *notes = (u8*)calloc(nc * 96, 1);       // notes a channel may be on
+    u8 **used = (u8**)calloc(ni + 1, sizeof(u8*));
+    u8 unmapped = 0;
+
+    for (int i = 0; i < ni && used; i++) {
+        used[i] = (u8*)calloc(module->instruments[i].num_samples + 1, 1);
+        if (!used[i])
+            unmapped = 1;
+    }
+
+    if (!reachable || !held || !notes || !used)
+        unmapped = 1;
+
+    for (int o = 0; o < module->song_length && reachable; o++)
+        if (module->pattern_order[o] < module->num_patterns)
+            reachable[module->pattern_order[o]] = 1;
+
+    // every channel starts on the first instrument and note
+    for (int c = 0; c < nc && !unmapped; c++) {
+        if (ni)
+            held[c * ni] = 1;
+        notes[c * 96] = 1;
+    }
+
+    for (int p = 0; p < module->num_patterns && !unmapped; p++) {
+        if (!reachable[p])
+            continue;
+
+        XM_pattern_t *pattern = &module->patterns[p];
+
+        for (int k = 0; k < pattern->num_rows * nc; k++) {
+            XM_note_t *note = &pattern->data[k];
+            int c = k % nc;
+
+            if (note->instrument && note->instrument <= ni)
+                held[c * ni + note->instrument - 1] = 1;
+
+            // notes past 97 index outside the sample map, keep it all
+            if (note->note > 97)
+                unmapped = 1;
+            else if (note->note && note->note != 97)
+                notes[c * 96 + note->note - 1] = 1;
+        }
+    }
+
+    // a note triggers the sample of its instrument, or the one the channel
+    // holds; a note delay also retriggers without a note
+    for (int p = 0; p < module->num_patterns && !unmapped; p++) {
+        if (!reachable[p])
+            continue;
+
+        XM_pattern_t *pattern = &module->patterns[p];
+
+        for (int k = 0; k < pattern->num_rows * nc; k++) {
+            XM_note_t *note = &pattern->data[k];
+            int c = k % nc;
+
+            u8 tone_porta = note->fxtype == XM_FX_TONE_PORTA || note->fxtype == XM_FX_TONE_PORTA_VOLUME_SLIDE;
+            u8 delayed = note->fxtype == XM_FX_MULTI_EFFECT_E && (note->fxparam >> 4) == XM_FX_E_NOTE_DELAY;
+            u8 has_note = note->note && note->note != 97 && !tone_porta;
+
+            if (!has_note && !delayed)
+                continue;
+
+            for (int i = 0; i < ni; i++) {
+                if (note->instrument && note->instrument <= ni && !tone_porta ? i != note->instrument - 1 : !held[c * ni + i])
+                    continue;
+
+                if (has_note) {
+                    XM_MarkSample(module, used, i, note->note - 1);
+                } else {
+                    for (int n = 0; n < 96; n++)
+                        if (notes[c * 96 + n])
+                            XM_MarkSample(module, used, i, n);
+                }
+            }
+        }
+    }
+
+    u64 freed = 0;
+
+    for (int p = 0; p < module->num_patterns && reachable; p++) {
+        XM_pattern_t *pattern = &module->patterns[p];
+
+        if (reachable[p] || !pattern->data)
+            continue;
+
+        freed += (u64)pattern->num_rows * nc * sizeof(XM_note_t);
+
+        free(pattern->data);
+        pattern->data = 0;
+        pattern->num_rows = 0;
+    }
+
+    for (int i = 0; i < ni && !unmapped; i++) {
+        for (int s = 0; s < module->instruments[i].num_samples; s++) {
+            XM_sample_t *sample = &module->instruments[i].samples[s];
+
+            if (used[i][s] || !sample->data)
+                continue;
+
+            freed += XM_SampleBytes(sample);
+
+            XM_PoolRelease(sample->data);
+            sample->data = 0;
+            sample->length = 0;
+            sample->loop_start = 0;
+            sample->loop_length = 0;
+        }
+    }
+
+    for (int i = 0; i < ni && used; i++)
+        free(used[i]);
+
+    free(used);
+    free(notes);
+    free(held);
+    free(reachable);
+
+    return freed;
+}
+
+void XM_FreeModule(XM_module_t *module)
+{
+    // a stream still loading into the module has to finish first
+    XM_CloseStream(module);
+
+    for (int i = 0; i < module->num_patterns; i++)
+        free(module->patterns[i].data);
+
+    for (int i = 0; i < module->num_instruments; i++) {
+        for (int s = 0; s < module->instruments[i].num_samples; s++)
+            XM_PoolRelease(module->instruments[i].samples[s].data);
+
+        free(module->instruments[i].samples);
+    }
+
+    free(module->patterns);
+    free(module->instruments);
+
+    module->patterns = 0;
+    module->instruments = 0;
+    module->num_patterns = 0;
+    module->num_instruments = 0;
+}
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include "xm.h"
 #include "audio.h"
+#include "profile.h"
+#include "rtcheck.h"
 
 
 u8 xm_sine_table[] =
@@ -14,9 +18,25 @@ u8 xm_sine_table[] =
 };
 
 
-XM_player_state_t ps;
+// The per-tick passes run over whole vectors of channels so they never
+// need a scalar tail, the padding lanes only touch their own unused state.
+#define XM_CHANNEL_LANES 16
 
 
+XM_player_state_t xm_default_player;
+
+// every thread drives the default player unless it selects its own
+static __thread XM_player_state_t *ps = &xm_default_player;
+
+static void XM_FreeLoopCache();
+static void XM_RecordEvent(const XM_event_t *event);
+
+
+static inline int XM_ChannelLanes()
+{
+    return (ps->module->num_channels + XM_CHANNEL_LANES - 1) & ~(XM_CHANNEL_LANES - 1);
+}
+
 u32 XM_NoteToPeriod(u8 note, s8 finetune)
 {
     return 7680 - (note * 64) - (finetune / 2);
@@ -32,61 +52,104 @@ void XM_ResetEnvelopeState(XM_envelope_state_t *env)
     }
 }
 
+void XM_StoreEnvelopes(u8 ci)
+{
+    XM_channel_state_t *channel = &ps->cs[ci];
+
+    ps->ch.envelope_volume[ci] = channel->volume_envelope.active ? channel->volume_envelope.value : 64;
+    ps->ch.envelope_panning[ci] = channel->panning_envelope.active ? channel->panning_envelope.value : 32;
+}
+
 void XM_ResetChannelState(u8 ci)
 {
-    XM_channel_state_t *channel = &ps.cs[ci];
+    XM_channel_state_t *channel = &ps->cs[ci];
+    XM_channel_hot_t *ch = &ps->ch;
 
-    channel->period = 0;
-    channel->volume = 0x7F;
-    channel->panning = 0x80;
+    ch->period[ci] = 0;
+    ch->volume[ci] = 0x7F;
+    ch->panning[ci] = 0x80;
     channel->note = 0;
-    channel->note_control = XM_NOTE_VOLUME | XM_NOTE_PANNING;
+    ch->note_control[ci] = XM_NOTE_VOLUME | XM_NOTE_PANNING;
     channel->instrument = 0;
 
     channel->sample = 0;
     channel->sample_offset = 0;
 
-    channel->fxtype = 0;
-    channel->fxparam = 0;
+    ch->fxtype[ci] = 0;
+    ch->fxparam[ci] = 0;
 
     XM_ResetEnvelopeState(&channel->volume_envelope);
     XM_ResetEnvelopeState(&channel->panning_envelope);
+    XM_StoreEnvelopes(ci);
     
-    channel->tone_porta_target = 0;
-    channel->tone_porta_speed = 0;
+    ch->tone_porta_target[ci] = 0;
+    ch->tone_porta_speed[ci] = 0;
     
-    channel->vibrato_pos = 0;
-    channel->vibrato_speed = 0;
-    channel->vibrato_depth = 0;
-    channel->vibrato_delta = 0;
+    ch->vibrato_pos[ci] = 0;
+    ch->vibrato_speed[ci] = 0;
+    ch->vibrato_depth[ci] = 0;
+    ch->vibrato_delta[ci] = 0;
     
+    ch->volume_fadeout[ci] = 65535;
+    ch->global_volume[ci] = ps->global_volume;
 }
 
 
 void XM_InitPlayer(XM_module_t *module)
 {
     // create frequency table
-    ps.linear_frequencies = (u32*)malloc(7681 * sizeof(u32));
+    ps->linear_frequencies = (u32*)malloc(7681 * sizeof(u32));
 
     for (int i = 0; i < 7681; i++)
-        ps.linear_frequencies[i] = 8363 * pow(2, (4608.0f - i) / 768.0f);
+        ps->linear_frequencies[i] = 8363 * pow(2, (4608.0f - i) / 768.0f);
 
-    ps.module = module;
-    ps.tick = 0;
-    ps.pattern_index = 0;
-    ps.row = 0;
+    ps->module = module;
+    ps->tick = 0;
+    ps->pattern_index = 0;
+    ps->row = 0;
 
-    ps.current_bpm = module->default_bpm;
-    ps.current_tempo = module->default_tempo;
+    ps->current_bpm = module->default_bpm;
+    ps->current_tempo = module->default_tempo;
 
-    ps.global_volume = 64;
-    
-    ps.cs = (XM_channel_state_t*)malloc(module->num_channels * sizeof(XM_channel_state_t));
+    ps->global_volume = 64;
+
+    ps->tick_frames_left = 0;
+    ps->tick_frames_frac = 0;
+    ps->row_effects = 0;
+
+    ps->frame = 0;
+    ps->playing_order = 0xFFFF;
+    ps->playing_row = 0;
+
+    ps->looping = 0;
+    ps->stream_wait = 0;
+    ps->stalled = 0;
+    ps->loop_cache = 0;
+    ps->events = 0;
  
-    for (int i = 0; i < module->num_channels; i++)
+    for (int i = 0; i < XM_ChannelLanes(); i++)
         XM_ResetChannelState(i);
 }
 
+void XM_SetCurrentPlayer(XM_player_state_t *player)
+{
+    ps = player ? player : &xm_default_player;
+}
+
+XM_player_state_t *XM_GetCurrentPlayer()
+{
+    return ps;
+}
+
+void XM_ShutdownPlayer()
+{
+    XM_FreeLoopCache();
+
+    free(ps->linear_frequencies);
+
+    ps->linear_frequencies = 0;
+}
+
 void XM_PrintNote(u8 ci, XM_note_t *note)
 {
     if (note->note)
@@ -109,78 +172,111 @@ void XM_PrintNote(u8 ci, XM_note_t *note)
     else
         printf("...");
     
-    if (ci != ps.module->num_channels-1)
+    if (ci != ps->module->num_channels-1)
         printf(" | ");    
 }
 
-void XM_UpdateChannel(u8 ci)
+void XM_PrintRow(u16 pattern_index, u16 row)
 {
-    XM_channel_state_t *channel = &ps.cs[ci];
+    XM_pattern_t *pattern = &ps->module->patterns[ps->module->pattern_order[pattern_index]];
 
-    // trigger sample
-    if (channel->note_control & XM_NOTE_TRIGGER) {
-        u8 data_type = channel->sample->type & XM_SAMPLE_16BIT ? 2 : 1;
-        
-        if (channel->fxtype == XM_FX_SAMPLE_OFFSET)
-            S_SetSampleOffset(ci, channel->sample_offset);
-        else
-            S_SetSampleOffset(ci, 0);
-        
-        S_PlayVoice(ci, data_type, channel->sample->length, channel->sample->data);
-        
-        channel->note_control &= ~XM_NOTE_TRIGGER;
-    }
+    if (row == 0)
+        printf("playing pattern %d\n", ps->module->pattern_order[pattern_index]);
 
-    // set sample frequency
-    if (channel->note_control & XM_NOTE_FREQ) {
-        u16 period = channel->period;
-        
-        if (channel->fxtype == XM_FX_VIBRATO)
-            period += channel->vibrato_delta;
-        
-        u32 freq = ps.linear_frequencies[channel->period];
+    for (int ci = 0; ci < ps->module->num_channels; ci++)
+        XM_PrintNote(ci, &pattern->data[ci + row * ps->module->num_channels]);
 
-        S_SetVoiceFrequency(ci, freq);
-        
-        channel->note_control &= ~XM_NOTE_FREQ;
+    printf("\n");
+}
+
+// events carry the frame the current tick starts at
+static void XM_Emit(u8 type, u8 channel, u8 value, u8 instrument)
+{
+    if (!ps->events)
+        return;
+
+    XM_event_t event;
+    event.frame = ps->frame;
+    event.type = type;
+    event.channel = channel;
+    event.value = value;
+    event.instrument = instrument;
+    event.order = ps->playing_order;
+    event.row = ps->playing_row;
+
+    XM_PushEvent(ps->events, &event);
+    XM_RecordEvent(&event);
+}
+
+// push the channel state to the mixer voices, the volume and panning math
+// runs across all channels before the per-voice calls
+void XM_UpdateVoices()
+{
+    P_SCOPE("XM_UpdateVoices");
+
+    XM_channel_hot_t *ch = &ps->ch;
+    int num_channels = ps->module->num_channels;
+    int num_lanes = XM_ChannelLanes();
+    u8 final_volume[XM_MAX_CHANNELS];
+    u8 final_panning[XM_MAX_CHANNELS];
+
+    for (int ci = 0; ci < num_lanes; ci++) {
+        float volume = 1.0f;
+        volume *= (float)ch->global_volume[ci] / 64.0f;
+        volume *= (float)ch->volume[ci] / 64.0f;
+        volume *= (float)ch->volume_fadeout[ci] / 65535.0f;
+        volume *= (float)ch->envelope_volume[ci] / 64.0f;
+
+        final_volume[ci] = (s32)(volume * 127.0f);
     }
 
-    // set channel volume
-    if (channel->note_control & XM_NOTE_VOLUME) {
-        float final_volume = 1.0f;
-        final_volume *= (float)ps.global_volume / 64.0f;
-        final_volume *= (float)channel->volume / 64.0f;
-        final_volume *= (float)channel->volume_fadeout / 65535.0f;
-        
-        if (channel->volume_envelope.active)
-            final_volume *= (float)channel->volume_envelope.value / 64.0f;
-        
-        S_SetVoiceVolume(ci, final_volume * 127.0f);
-        
-        channel->note_control &= ~XM_NOTE_VOLUME;
+    for (int ci = 0; ci < num_lanes; ci++) {
+        s32 pan = ch->panning[ci];
+        s32 envpan = ch->envelope_panning[ci];
+
+        final_panning[ci] = pan + ((envpan-32) * (128-abs(pan-128)) / 32);
     }
 
-    // set channel panning
-    if (channel->note_control & XM_NOTE_PANNING) {
-        u8 pan, envpan, final_pan;
-        
-        pan = channel->panning;
-        
-        if (channel->panning_envelope.active)
-            envpan = channel->panning_envelope.value;
-        else
-            envpan = 32;
-        
-        final_pan = pan + ((envpan-32) * (128-abs(pan-128)) / 32);
-        
-        S_SetVoicePanning(ci, final_pan);
-        
-        channel->note_control &= ~XM_NOTE_PANNING;
+    for (int ci = 0; ci < num_channels; ci++) {
+        XM_channel_state_t *channel = &ps->cs[ci];
+        u8 note_control = ch->note_control[ci];
+
+        // trigger sample
+        if (note_control & XM_NOTE_TRIGGER) {
+            u8 data_type = channel->sample->type & XM_SAMPLE_ADPCM ? S_FORMAT_ADPCM : channel->sample->type & XM_SAMPLE_16BIT ? 2 : 1;
+            
+            if (ch->fxtype[ci] == XM_FX_SAMPLE_OFFSET)
+                S_SetSampleOffset(ci, channel->sample_offset);
+            else
+                S_SetSampleOffset(ci, 0);
+            
+            S_PlayVoice(ci, data_type, channel->sample->length, channel->sample->data);
+            XM_Emit(XM_EVENT_NOTE, ci, channel->note + 1, channel->instrument + 1);
+            S_SetSampleLoop(ci, channel->sample->type & (XM_SAMPLE_FWD_LOOP | XM_SAMPLE_PP_LOOP),
+                            channel->sample->loop_start,
+                            channel->sample->loop_start + channel->sample->loop_length);
+        }
+
+        // set sample frequency
+        // FIXME: vibrato_delta is not applied
+        if (note_control & XM_NOTE_FREQ)
+            S_SetVoiceFrequency(ci, ps->linear_frequencies[ch->period[ci]]);
+
+        // set channel volume and panning
+        if (note_control & XM_NOTE_VOLUME)
+            S_SetVoiceVolume(ci, final_volume[ci]);
+
+        if (note_control & XM_NOTE_PANNING)
+            S_SetVoicePanning(ci, final_panning[ci]);
+
+        ch->note_control[ci] = note_control & ~(XM_NOTE_TRIGGER | XM_NOTE_FREQ | XM_NOTE_VOLUME | XM_NOTE_PANNING);
     }
 }
 
 u32 XM_ProcessEnvelope(XM_envelope_t *envelope, XM_envelope_state_t *state)
 {
+    P_SCOPE("XM_ProcessEnvelope");
+
     XM_envelope_point_t *current_point, *next_point;
 
     state->active = envelope->flags & XM_ENVELOPE_ENABLED;
@@ -232,80 +328,87 @@ u32 XM_ProcessEnvelope(XM_envelope_t *envelope, XM_envelope_state_t *state)
     return 1;
 }
 
-void XM_ProcessVolumeByte(u8 volbyte, XM_channel_state_t *channel)
+void XM_ProcessVolumeByte(u8 volbyte, u8 ci)
 {
     // FIXME: process volume byte effects
     if (volbyte >= 0x10 && volbyte <= 0x50) {
-        channel->note_control |= XM_NOTE_VOLUME;
-        channel->volume = volbyte - 0x10;
+        ps->ch.note_control[ci] |= XM_NOTE_VOLUME;
+        ps->ch.volume[ci] = volbyte - 0x10;
     }    
 }
 
-void XM_ProcessVolumeFadeout(XM_channel_state_t *channel)
+void XM_ProcessVolumeFadeout(u8 ci)
 {
-    XM_instrument_t *instrument = &ps.module->instruments[channel->instrument];
+    XM_channel_state_t *channel = &ps->cs[ci];
+    XM_channel_hot_t *ch = &ps->ch;
+    XM_instrument_t *instrument = &ps->module->instruments[channel->instrument];
     
-    if ((channel->note_control & XM_NOTE_KEY_OFF) && channel->volume_envelope.active) {
-        if (channel->volume_fadeout > instrument->volume_fadeout)
-            channel->volume_fadeout -= instrument->volume_fadeout;
+    if ((ch->note_control[ci] & XM_NOTE_KEY_OFF) && channel->volume_envelope.active) {
+        if (ch->volume_fadeout[ci] > instrument->volume_fadeout)
+            ch->volume_fadeout[ci] -= instrument->volume_fadeout;
         else
-            channel->volume_fadeout = 0;
+            ch->volume_fadeout[ci] = 0;
     }    
 }
 
-void XM_ProcessEffectByte(XM_channel_state_t *channel)
+void XM_ProcessEffectByte(u8 ci)
 {
-    switch (channel->fxtype) {
+    XM_channel_state_t *channel = &ps->cs[ci];
+    XM_channel_hot_t *ch = &ps->ch;
+    u8 fxparam = ch->fxparam[ci];
+
+    P_SCOPE2("XM_ProcessEffectByte", "channel", ci, "effect", ch->fxtype[ci]);
+
+    switch (ch->fxtype[ci]) {
         case XM_FX_SET_TEMPO:
-            if (channel->fxparam > 0) {
-                if (channel->fxparam <= 0x1F)
-                    ps.current_tempo = channel->fxparam;
+            if (fxparam > 0) {
+                if (fxparam <= 0x1F)
+                    ps->current_tempo = fxparam;
                 else
-                    ps.current_bpm = channel->fxparam;
+                    ps->current_bpm = fxparam;
             }
             break;
             
         case XM_FX_SET_VOLUME:
-            channel->volume = channel->fxparam;
-            channel->note_control |= XM_NOTE_VOLUME;
+            ch->volume[ci] = fxparam;
+            ch->note_control[ci] |= XM_NOTE_VOLUME;
             break;
             
         case XM_FX_SET_GLOBAL_VOLUME:
-            ps.global_volume = channel->fxparam;
+            ps->global_volume = fxparam;
             break;
             
         case XM_FX_SET_PANNING:
-            channel->panning = channel->fxparam;
-            channel->note_control |= XM_NOTE_PANNING;
+            ch->panning[ci] = fxparam;
+            ch->note_control[ci] |= XM_NOTE_PANNING;
             break;
             
         case XM_FX_PATTERN_BREAK:
             // FIXME: pattern break is not correct (use flag)
-            ps.pattern_index++;
-            ps.row = channel->fxparam;
-            printf("playing pattern %d\n", ps.module->pattern_order[ps.pattern_index]);
+            ps->pattern_index++;
+            ps->row = fxparam;
             return;
             
         case XM_FX_TONE_PORTA:
-            channel->tone_porta_speed = channel->fxparam;
+            ch->tone_porta_speed[ci] = fxparam;
             break;
             
         case XM_FX_SAMPLE_OFFSET:
-            if (channel->fxparam > 0)
-                channel->sample_offset = channel->fxparam << 8;
+            if (fxparam > 0)
+                channel->sample_offset = fxparam << 8;
             break;
             
         case XM_FX_VIBRATO:
-            if (channel->fxparam > 0) {
-                channel->vibrato_pos = 0;
-                channel->vibrato_speed = channel->fxparam >> 4;
-                channel->vibrato_depth = channel->fxparam & 0xF;
+            if (fxparam > 0) {
+                ch->vibrato_pos[ci] = 0;
+                ch->vibrato_speed[ci] = fxparam >> 4;
+                ch->vibrato_depth[ci] = fxparam & 0xF;
             }
             break;
             
             /*
         case XM_FX_MULTI_EFFECT_E:
-             switch (channel->fxparam >> 4) {
+             switch (fxparam >> 4) {
                  case XM_FX_E_NOTE_DELAY:
                      channel->volume = old_volume;
                      channel->period = old_period;
@@ -325,19 +428,44 @@ void XM_ProcessEffectByte(XM_channel_state_t *channel)
             break;
             
         default:
-            printf("Unhandled effect: %.1X%.2X\n", channel->fxtype, channel->fxparam);
+            // unhandled effect
             break;
     }    
 }
 
 void XM_UpdateRow()
 {
+    // past the last order, only looping songs get here
+    if (ps->pattern_index >= ps->module->song_length) {
+        ps->pattern_index = ps->module->song_restart_pos < ps->module->song_length ? ps->module->song_restart_pos : 0;
+
+        if (ps->row >= ps->module->patterns[ps->module->pattern_order[ps->pattern_index]].num_rows)
+            ps->row = 0;
+    }
+
     // get current pattern from order table
-    XM_pattern_t *pattern = &ps.module->patterns[ps.module->pattern_order[ps.pattern_index]];
-    //XM_pattern_t *pattern = &ps.module->patterns[16];
+    XM_pattern_t *pattern = &ps->module->patterns[ps->module->pattern_order[ps->pattern_index]];
+
+    P_SCOPE2("XM_UpdateRow", "pattern", ps->module->pattern_order[ps->pattern_index], "row", ps->row);
+    //XM_pattern_t *pattern = &ps->module->patterns[16];
+
+    XM_channel_hot_t *ch = &ps->ch;
+
+    ps->row_effects = 0;
+
+    // an order starts on its first row, or any row after a pattern break
+    u8 new_order = ps->row == 0 || ps->pattern_index != ps->playing_order;
+
+    ps->playing_order = ps->pattern_index;
+    ps->playing_row = ps->row;
+
+    if (new_order)
+        XM_Emit(XM_EVENT_ORDER, 0, ps->module->pattern_order[ps->pattern_index], 0);
+
+    XM_Emit(XM_EVENT_ROW, 0, 0, 0);
 
     // process every channel
-    for (int ci = 0; ci < ps.module->num_channels; ci++) {
+    for (int ci = 0; ci < ps->module->num_channels; ci++) {
         XM_note_t *note = 0;
         XM_instrument_t *instrument = 0;
         XM_sample_t *sample = 0;
@@ -345,25 +473,31 @@ void XM_UpdateRow()
         u8 tone_porta, note_delayed;
 
         // get current note
-        note = &pattern->data[ci + ps.row * ps.module->num_channels];
+        note = &pattern->data[ci + ps->row * ps->module->num_channels];
 
         // get channel state
-        channel = &ps.cs[ci];
+        channel = &ps->cs[ci];
 
-        channel->note_control = 0;
+        ch->note_control[ci] = 0;
         
         // get effect parameter values
-        channel->fxtype = note->fxtype;
-        channel->fxparam = note->fxparam;
+        ch->fxtype[ci] = note->fxtype;
+        ch->fxparam[ci] = note->fxparam;
+
+        if (note->fxtype < 32)
+            ps->row_effects |= 1 << note->fxtype;
+
+        if (note->fxtype == XM_FX_MULTI_EFFECT_E && (note->fxparam >> 4) == XM_FX_E_SYNC)
+            XM_Emit(XM_EVENT_MARKER, ci, note->fxparam & 0xF, 0);
 
         // handle key off
-        if (note->note == 97 || channel->fxparam == XM_FX_KEY_OFF)
-            channel->note_control |= XM_NOTE_KEY_OFF;
+        if (note->note == 97 || ch->fxparam[ci] == XM_FX_KEY_OFF)
+            ch->note_control[ci] |= XM_NOTE_KEY_OFF;
         
         // are there any tone portamento effects running?
-        tone_porta = (channel->fxtype == XM_FX_TONE_PORTA) || (channel->fxtype == XM_FX_TONE_PORTA_VOLUME_SLIDE);
+        tone_porta = (ch->fxtype[ci] == XM_FX_TONE_PORTA) || (ch->fxtype[ci] == XM_FX_TONE_PORTA_VOLUME_SLIDE);
         // should the note be delayed?
-        note_delayed = (channel->fxtype == XM_FX_MULTI_EFFECT_E) && ((channel->fxparam >> 4) == XM_FX_E_NOTE_DELAY);
+        note_delayed = (ch->fxtype[ci] == XM_FX_MULTI_EFFECT_E) && ((ch->fxparam[ci] >> 4) == XM_FX_E_NOTE_DELAY);
         
         // grab instrument number
         if (note->instrument && !tone_porta)
@@ -372,19 +506,19 @@ void XM_UpdateRow()
         // grab note
         if (note->note && note->note != 97 && !tone_porta) {
             channel->note = note->note - 1;
-            channel->volume_fadeout = 65535;
+            ch->volume_fadeout[ci] = 65535;
             
             XM_ResetEnvelopeState(&channel->volume_envelope);
             XM_ResetEnvelopeState(&channel->panning_envelope);            
         }
 
-        channel->note_control = 0;
+        ch->note_control[ci] = 0;
         
         // stop the current sample if invalid instrument
-        if (channel->instrument >= ps.module->num_instruments) {
+        if (channel->instrument >= ps->module->num_instruments) {
             S_StopVoice(ci);
         } else {
-            instrument = &ps.module->instruments[channel->instrument];
+            instrument = &ps->module->instruments[channel->instrument];
             
             // set sample
             sample = &instrument->samples[instrument->sample_numbers[channel->note]];
@@ -395,12 +529,12 @@ void XM_UpdateRow()
             XM_ResetEnvelopeState(&channel->panning_envelope);
 
             // set default panning and volume, unless the note is delayed
-            channel->panning = sample->panning;
-            channel->volume = sample->volume;
+            ch->panning[ci] = sample->panning;
+            ch->volume[ci] = sample->volume;
 
             if (!note_delayed) {            
-                channel->note_control |= XM_NOTE_PANNING;
-                channel->note_control |= XM_NOTE_VOLUME;
+                ch->note_control[ci] |= XM_NOTE_PANNING;
+                ch->note_control[ci] |= XM_NOTE_VOLUME;
             }
         }
 
@@ -409,163 +543,660 @@ void XM_UpdateRow()
             u16 period = XM_NoteToPeriod(note->note + sample->relative_note - 1, sample->finetune);
             
             if (!tone_porta) {
-                channel->period = period;
+                ch->period[ci] = period;
 
                 if (!note_delayed) {
-                    channel->note_control |= XM_NOTE_FREQ;
-                    channel->note_control |= XM_NOTE_TRIGGER;
+                    ch->note_control[ci] |= XM_NOTE_FREQ;
+                    ch->note_control[ci] |= XM_NOTE_TRIGGER;
                 }
             } else {
-                channel->tone_porta_target = period;
+                ch->tone_porta_target[ci] = period;
             }
         }
 
         
         // update envelopes
         if (XM_ProcessEnvelope(&instrument->volume_envelope, &channel->volume_envelope))
-            channel->note_control |= XM_NOTE_VOLUME;
+            ch->note_control[ci] |= XM_NOTE_VOLUME;
         if (XM_ProcessEnvelope(&instrument->volume_envelope, &channel->panning_envelope))
-            channel->note_control |= XM_NOTE_PANNING;
+            ch->note_control[ci] |= XM_NOTE_PANNING;
+        XM_StoreEnvelopes(ci);
 
-        XM_ProcessVolumeFadeout(channel);        
-        XM_ProcessVolumeByte(note->volume, channel);
-        XM_ProcessEffectByte(channel);
+        XM_ProcessVolumeFadeout(ci);        
+        XM_ProcessVolumeByte(note->volume, ci);
+        XM_ProcessEffectByte(ci);
 
-        XM_PrintNote(ci, note);
-        
-        XM_UpdateChannel(ci);
+        ch->global_volume[ci] = ps->global_volume;
     }
 
-    ps.row++;
-    printf("\n");
+    XM_UpdateVoices();
 
-    if (ps.row >= pattern->num_rows) {
-        ps.pattern_index++;
-        ps.row = 0;
+    ps->row++;
 
-        printf("playing pattern %d\n", ps.module->pattern_order[ps.pattern_index]);
+    if (ps->row >= pattern->num_rows) {
+        ps->pattern_index++;
+        ps->row = 0;
     }
 }
 
 
-void XM_FXVolumeSlide(XM_channel_state_t *channel)
+// The per-tick effects below are branch-free passes over the hot channel
+// arrays, every channel computes the effect and only the ones running it
+// keep the result.  This lets the compiler vectorize them across channels.
+
+void XM_FXVolumeSlide(int num_lanes)
 {
-    u8 param_x, param_y;
+    XM_channel_hot_t *ch = &ps->ch;
 
-    param_x = channel->fxparam >> 4;
-    param_y = channel->fxparam & 0xF;
+    for (int ci = 0; ci < num_lanes; ci++) {
+        u8 slide = ch->fxtype[ci] == XM_FX_VOLUME_SLIDE;
+        u8 param_x = ch->fxparam[ci] >> 4;
+        u8 param_y = ch->fxparam[ci] & 0xF;
+        s8 volume = ch->volume[ci];
 
-    if (param_x) {
-        channel->volume += param_x;
-        if (channel->volume > 64)
-            channel->volume = 64;
-    } else if (param_y) {
-        channel->volume -= param_y;
-        if (channel->volume < 0)
-            channel->volume = 0;
-    }
+        s8 up = volume + param_x;
+        if (up > 64)
+            up = 64;
+
+        s8 down = volume - param_y;
+        if (down < 0)
+            down = 0;
 
-    channel->note_control |= XM_NOTE_VOLUME;
+        s8 result = param_x ? up : param_y ? down : volume;
+
+        ch->volume[ci] = slide ? result : volume;
+        ch->note_control[ci] |= slide ? XM_NOTE_VOLUME : 0;
+    }
 }
 
-void XM_FXTonePorta(XM_channel_state_t *channel)
+void XM_FXTonePorta(int num_lanes)
 {
-    if (channel->period < channel->tone_porta_target) {
-        channel->period += channel->tone_porta_speed << 2;
+    XM_channel_hot_t *ch = &ps->ch;
 
-        if (channel->period > channel->tone_porta_target)
-            channel->period = channel->tone_porta_target;
-    } else if (channel->period > channel->tone_porta_target) {
-        channel->period -= channel->tone_porta_speed << 2;
+    for (int ci = 0; ci < num_lanes; ci++) {
+        u8 porta = ch->fxtype[ci] == XM_FX_TONE_PORTA;
 
-        if (channel->period < channel->tone_porta_target)
-            channel->period = channel->tone_porta_target;
-    }
+        // compare the distance to the target first, small periods would
+        // wrap around otherwise
+        u16 period = ch->period[ci];
+        u16 target = ch->tone_porta_target[ci];
+        u16 speed = ch->tone_porta_speed[ci] << 2;
+
+        u16 up = (u16)(target - period) > speed ? (u16)(period + speed) : target;
+        u16 down = (u16)(period - target) > speed ? (u16)(period - speed) : target;
+
+        u16 result = period < target ? up : period > target ? down : period;
 
-    channel->note_control |= XM_NOTE_FREQ;
+        ch->period[ci] = porta ? result : period;
+        ch->note_control[ci] |= porta ? XM_NOTE_FREQ : 0;
+    }
 }
 
-void XM_FXVibrato(XM_channel_state_t *channel)
+// the sine lookup is a gather, so vibrato stays a scalar pass over the
+// channels that run it
+void XM_FXVibrato(int num_lanes)
 {
-    s32 delta = xm_sine_table[abs(channel->vibrato_pos)];
-    delta *= channel->vibrato_depth;
-    delta /= 4;
-    
-    if (channel->vibrato_pos < 0)
-        delta *= -1;
-    
-    channel->vibrato_delta = delta;
-    
-    channel->vibrato_pos += channel->vibrato_speed;
-    
-    if (channel->vibrato_pos > 31)
-        channel->vibrato_pos -= 64;
-        
-    channel->note_control |= XM_NOTE_FREQ;
+    XM_channel_hot_t *ch = &ps->ch;
+
+    for (int ci = 0; ci < num_lanes; ci++) {
+        u8 vibrato = ch->fxtype[ci] == XM_FX_VIBRATO;
+        s8 pos = ch->vibrato_pos[ci];
+
+        s32 delta = xm_sine_table[abs(pos) & 31] * ch->vibrato_depth[ci] / 4;
+        if (pos < 0)
+            delta = -delta;
+
+        s8 next = pos + ch->vibrato_speed[ci];
+        if (next > 31)
+            next -= 64;
+
+        ch->vibrato_delta[ci] = vibrato ? delta : ch->vibrato_delta[ci];
+        ch->vibrato_pos[ci] = vibrato ? next : pos;
+        ch->note_control[ci] |= vibrato ? XM_NOTE_FREQ : 0;
+    }
 }
 
-void XM_FXENoteDelay(XM_channel_state_t *channel)
+void XM_FXENoteDelay(u8 ci)
 {
-    if (ps.tick == (channel->fxparam & 0xF)) {
-        channel->note_control |= XM_NOTE_TRIGGER;
-        channel->note_control |= XM_NOTE_FREQ;
-        channel->note_control |= XM_NOTE_VOLUME;
-        channel->note_control |= XM_NOTE_PANNING;
-    }
+    if (ps->tick == (ps->ch.fxparam[ci] & 0xF))
+        ps->ch.note_control[ci] |= XM_NOTE_TRIGGER | XM_NOTE_FREQ | XM_NOTE_VOLUME | XM_NOTE_PANNING;
 }
 
 void XM_UpdateEffects()
 {
-    for (int i = 0; i < ps.module->num_channels; i++) {
-        XM_channel_state_t *channel = &ps.cs[i];
-        XM_instrument_t *instrument = &ps.module->instruments[channel->instrument];
+    P_SCOPE1("XM_UpdateEffects", "tick", ps->tick);
+
+    XM_channel_hot_t *ch = &ps->ch;
+    int num_channels = ps->module->num_channels;
+    int num_lanes = XM_ChannelLanes();
+
+    // envelopes, fadeout and note delay depend on the instrument
+    for (int ci = 0; ci < num_channels; ci++) {
+        XM_channel_state_t *channel = &ps->cs[ci];
+        XM_instrument_t *instrument = &ps->module->instruments[channel->instrument];
         
         XM_ProcessEnvelope(&instrument->volume_envelope, &channel->volume_envelope);
         XM_ProcessEnvelope(&instrument->panning_envelope, &channel->panning_envelope);
+        XM_StoreEnvelopes(ci);
 
-        XM_ProcessVolumeFadeout(channel);
-        
-        switch (channel->fxtype) {
-            case XM_FX_VOLUME_SLIDE:
-                XM_FXVolumeSlide(channel);
-                break;
+        XM_ProcessVolumeFadeout(ci);
 
-            case XM_FX_TONE_PORTA:
-                XM_FXTonePorta(channel);
-                break;
-                
-            case XM_FX_VIBRATO:
-                XM_FXVibrato(channel);
-                break;
-        
-            case XM_FX_MULTI_EFFECT_E:
-                switch (channel->fxparam >> 4) {
-                    case XM_FX_E_NOTE_DELAY:
-                        XM_FXENoteDelay(channel);
-                        break;
-                }
-        }
-        
-        XM_UpdateChannel(i);
+        if (ch->fxtype[ci] == XM_FX_MULTI_EFFECT_E && (ch->fxparam[ci] >> 4) == XM_FX_E_NOTE_DELAY)
+            XM_FXENoteDelay(ci);
+
+        ch->global_volume[ci] = ps->global_volume;
     }
+
+    // skip the passes for effects no channel runs
+    if (ps->row_effects & (1 << XM_FX_VOLUME_SLIDE))
+        XM_FXVolumeSlide(num_lanes);
+    if (ps->row_effects & (1 << XM_FX_TONE_PORTA))
+        XM_FXTonePorta(num_lanes);
+    if (ps->row_effects & (1 << XM_FX_VIBRATO))
+        XM_FXVibrato(num_lanes);
+
+    XM_UpdateVoices();
 }
 
 
 
+void XM_SetChannelMute(u8 ci, u8 mute)
+{
+    // channels map one to one onto mixer voices
+    S_SetVoiceMute(ci, mute);
+}
+
+void XM_SetChannelSolo(u8 ci)
+{
+    for (int i = 0; i < ps->module->num_channels; i++)
+        S_SetVoiceMute(i, ci != XM_SOLO_NONE && i != ci);
+}
+
+u8 XM_IsSongFinished()
+{
+    // the last row still runs its effect ticks after the order index moved on
+    return !ps->looping && ps->pattern_index >= ps->module->song_length && ps->tick % ps->current_tempo == 0;
+}
+
+void XM_SetLooping(u8 enable)
+{
+    ps->looping = enable;
+}
+
+void XM_SetStreamWait(u8 enable)
+{
+    ps->stream_wait = enable;
+}
+
+// 1 when the stream has the data, 0 while the download is behind and -1
+// if it failed first; only an offline player blocks
+static s8 XM_StreamHas(XM_stream_t *stream, u32 patterns, u32 instruments)
+{
+    if (ps->stream_wait)
+        return XM_WaitStream(stream, patterns, instruments) ? 1 : -1;
+
+    return XM_PollStream(stream, patterns, instruments);
+}
+
+// a streaming module may still be loading what the next row plays
+static s8 XM_CheckRow()
+{
+    XM_module_t *module = ps->module;
+
+    u16 index = ps->pattern_index;
+    if (index >= module->song_length)
+        index = module->song_restart_pos < module->song_length ? module->song_restart_pos : 0;
+
+    u32 p = module->pattern_order[index];
+    if (p >= module->num_patterns)
+        return -1;
+
+    s8 has = XM_StreamHas(module->stream, p + 1, 0);
+    if (has <= 0)
+        return has;
+
+    XM_pattern_t *pattern = &module->patterns[p];
+    u16 row = ps->row < pattern->num_rows ? ps->row : 0;
+
+    // the row's instruments and the ones the channels still play
+    u32 instruments = 0;
+
+    for (int ci = 0; ci < module->num_channels; ci++) {
+        u32 n = pattern->data[ci + row * module->num_channels].instrument;
+
+        if (n < ps->cs[ci].instrument + 1u)
+            n = ps->cs[ci].instrument + 1;
+        if (n > instruments)
+            instruments = n;
+    }
+
+    if (instruments > module->num_instruments)
+        instruments = module->num_instruments;
+
+    return XM_StreamHas(module->stream, p + 1, instruments);
+}
+
 void XM_RunTick()
 {
-    if (ps.pattern_index >= ps.module->song_length)
+    RT_SCOPE();
+
+    ps->stalled = 0;
+
+    if (XM_IsSongFinished())
         return;
 
-    if (ps.tick % ps.current_tempo == 0)
+    if (ps->tick % ps->current_tempo == 0 && ps->module->stream) {
+        s8 has = XM_CheckRow();
+
+        // the download failed before this row, the song ends here
+        if (has < 0) {
+            ps->looping = 0;
+            ps->pattern_index = ps->module->song_length;
+            return;
+        }
+
+        // not in yet, hold the tick and try again on the next one
+        if (!has) {
+            ps->stalled = 1;
+            return;
+        }
+    }
+
+    if (ps->tick % ps->current_tempo == 0)
         XM_UpdateRow();
     else
         XM_UpdateEffects();
     
-    ps.tick++;
+    ps->tick++;
+}
+
+// ---------------------------------------------------------------------------
+// Loop cache
+
+#define XM_CACHE_IDLE      0   // waiting for a loop point
+#define XM_CACHE_RECORDING 1   // recording the audio since the last loop point
+#define XM_CACHE_PLAYING   2   // the state repeats, playing the recording
+
+struct XM_loop_cache_t
+{
+    u8 state;
+
+    // the player and mixer at the loop point the recording started from
+    XM_player_state_t player;
+    S_mixer_t *mixer;
+
+    // ps->tick only matters modulo the tempos, a loop repeats exactly when
+    // its length in ticks is a multiple of every tempo it used
+    u64 tempo_lcm;
+
+    float *left;
+    float *right;
+    u32 max_frames;
+    u32 num_frames;
+    u32 pos;
+
+    // events of the recorded pass, frames counted from its start
+    XM_event_t *events;
+    u32 max_events;
+    u32 num_events;
+    u32 event_pos;
+    u64 start_frame;
+};
+
+static u64 XM_Gcd(u64 a, u64 b)
+{
+    while (b) {
+        u64 t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static inline u8 XM_IsLoopPoint()
+{
+    return ps->looping && ps->pattern_index >= ps->module->song_length && ps->tick % ps->current_tempo == 0;
+}
+
+// everything but the tick and frame counters, which keep running across
+// passes
+static u8 XM_LoopStateMatches(XM_loop_cache_t *lc)
+{
+    const size_t tick = offsetof(XM_player_state_t, tick);
+    const size_t rest = offsetof(XM_player_state_t, pattern_index);
+
+    return !memcmp(ps, &lc->player, tick) &&
+           !memcmp((u8*)ps + rest, (u8*)&lc->player + rest, sizeof(XM_player_state_t) - rest) &&
+           S_MixersMatch(S_GetCurrentMixer(), lc->mixer);
+}
+
+static void XM_StartLoopRecording(XM_loop_cache_t *lc)
+{
+    memcpy(&lc->player, ps, sizeof(XM_player_state_t));
+
+    lc->state = S_CopyMixer(lc->mixer, S_GetCurrentMixer()) ? XM_CACHE_IDLE : XM_CACHE_RECORDING;
+    lc->tempo_lcm = 1;
+    lc->num_frames = 0;
+    lc->pos = 0;
+    lc->num_events = 0;
+    lc->event_pos = 0;
+    lc->start_frame = ps->frame;
+}
+
+static void XM_AtLoopPoint(XM_loop_cache_t *lc)
+{
+    if (lc->state == XM_CACHE_RECORDING && lc->num_frames &&
+        (ps->tick - lc->player.tick) % lc->tempo_lcm == 0 && XM_LoopStateMatches(lc)) {
+        lc->state = XM_CACHE_PLAYING;
+        lc->pos = 0;
+        lc->event_pos = 0;
+        return;
+    }
+
+    // first loop point, or the last pass went differently
+    XM_StartLoopRecording(lc);
+}
+
+static void XM_RecordEvent(const XM_event_t *event)
+{
+    XM_loop_cache_t *lc = ps->loop_cache;
+
+    if (!lc || lc->state != XM_CACHE_RECORDING)
+        return;
+
+    if (lc->num_events == lc->max_events) {
+        lc->state = XM_CACHE_IDLE;
+        return;
+    }
+
+    lc->events[lc->num_events] = *event;
+    lc->events[lc->num_events].frame -= lc->start_frame;
+    lc->num_events++;
+}
+
+static void XM_RecordLoop(XM_loop_cache_t *lc, const float *left, const float *right, u32 num_frames)
+{
+    if (!left || num_frames > lc->max_frames - lc->num_frames) {
+        lc->state = XM_CACHE_IDLE;
+        return;
+    }
+
+    memcpy(lc->left + lc->num_frames, left, sizeof(float) * num_frames);
+    memcpy(lc->right + lc->num_frames, right, sizeof(float) * num_frames);
+
+    lc->num_frames += num_frames;
+}
+
+// runs ticks and mixes, stops early when the loop cache takes over
+static u32 XM_RunFrames(float *left, float *right, u32 num_frames)
+{
+    XM_loop_cache_t *lc = ps->loop_cache;
+
+    u32 rate = S_GetMixingRate();
+    u32 done = 0;
+
+    while (done < num_frames) {
+        if (!ps->tick_frames_left) {
+            if (XM_IsSongFinished())
+                break;
+
+            if (lc) {
+                if (XM_IsLoopPoint())
+                    XM_AtLoopPoint(lc);
+
+                if (lc->state == XM_CACHE_PLAYING)
+                    break;
+
+                if (lc->state == XM_CACHE_RECORDING) {
+                    lc->tempo_lcm = lc->tempo_lcm / XM_Gcd(lc->tempo_lcm, ps->current_tempo) * ps->current_tempo;
+
+                    if (lc->tempo_lcm > 0xFFFFFFFF)
+                        lc->state = XM_CACHE_IDLE;
+                }
+            }
+
+            XM_RunTick();
+
+            // a tick lasts 2.5 / bpm seconds, carry the remainder over
+            u32 den = 2 * ps->current_bpm;
+            u32 num = rate * 5 + ps->tick_frames_frac % den;
+
+            ps->tick_frames_left = num / den;
+            ps->tick_frames_frac = num % den;
+        }
+
+        u32 n = num_frames - done;
+        if (n > ps->tick_frames_left)
+            n = ps->tick_frames_left;
+
+        if (ps->stalled) {
+            // silence while the download catches up, the voices wait
+            if (left) {
+                memset(left + done, 0, sizeof(float) * n);
+                memset(right + done, 0, sizeof(float) * n);
+            }
+
+            // a pass with a gap in it is not worth repeating
+            if (lc && lc->state == XM_CACHE_RECORDING)
+                lc->state = XM_CACHE_IDLE;
+        } else {
+            S_RenderFrames(left + done, right + done, n);
+        }
+
+        if (lc && lc->state == XM_CACHE_RECORDING)
+            XM_RecordLoop(lc, left ? left + done : 0, right + done, n);
+
+        ps->tick_frames_left -= n;
+        ps->frame += n;
+        done += n;
+    }
+
+    return done;
+}
+
+// the player and mixer wait at the loop point while the cache plays, catch
+// them up with the audio and render from there
+static void XM_LeaveLoop(XM_loop_cache_t *lc)
+{
+    u8 state_only = S_GetStateOnly();
+    u32 skip = lc->pos;
+
+    // the cache already played out the frames and events being skipped
+    XM_event_queue_t *events = ps->events;
+    u64 frame = ps->frame;
+
+    lc->state = XM_CACHE_IDLE;
+    ps->events = 0;
+
+    S_SetStateOnly(1);
+    XM_RunFrames(0, 0, skip);
+    S_SetStateOnly(state_only);
+
+    ps->events = events;
+    ps->frame = frame;
+}
+
+static u32 XM_PlayLoop(XM_loop_cache_t *lc, float *left, float *right, u32 num_frames)
+{
+    // any difference from the loop point was made from outside
+    if (!left || !XM_LoopStateMatches(lc)) {
+        XM_LeaveLoop(lc);
+        return 0;
+    }
+
+    u32 done = 0;
+
+    while (done < num_frames) {
+        u32 n = num_frames - done;
+        if (n > lc->num_frames - lc->pos)
+            n = lc->num_frames - lc->pos;
+
+        memcpy(left + done, lc->left + lc->pos, sizeof(float) * n);
+        memcpy(right + done, lc->right + lc->pos, sizeof(float) * n);
+
+        for (; lc->event_pos < lc->num_events && lc->events[lc->event_pos].frame < lc->pos + n; lc->event_pos++) {
+            XM_event_t event = lc->events[lc->event_pos];
+            event.frame = ps->frame + (event.frame - lc->pos);
+
+            if (ps->events)
+                XM_PushEvent(ps->events, &event);
+        }
+
+        lc->pos += n;
+        ps->frame += n;
+
+        if (lc->pos == lc->num_frames) {
+            lc->pos = 0;
+            lc->event_pos = 0;
+        }
+
+        done += n;
+    }
+
+    return done;
+}
+
+int XM_EnableLoopCache(u32 max_bytes)
+{
+    XM_DisableLoopCache();
+
+    XM_loop_cache_t *lc = (XM_loop_cache_t*)calloc(1, sizeof(XM_loop_cache_t));
+    if (!lc)
+        return 1;
+
+    lc->max_frames = max_bytes / (2 * sizeof(float));
+    lc->left = (float*)malloc(sizeof(float) * (lc->max_frames + 1));
+    lc->right = (float*)malloc(sizeof(float) * (lc->max_frames + 1));
+    lc->mixer = S_CreateMixer();
+
+    // far more than a song has, a pass with more is not cached
+    lc->max_events = lc->max_frames / 32 + 1;
+    lc->events = (XM_event_t*)malloc(sizeof(XM_event_t) * lc->max_events);
+
+    // size the snapshot now so taking one never allocates
+    if (!lc->left || !lc->right || !lc->events || !lc->mixer || S_CopyMixer(lc->mixer, S_GetCurrentMixer())) {
+        free(lc->left);
+        free(lc->right);
+        free(lc->events);
+        if (lc->mixer)
+            S_DestroyMixer(lc->mixer);
+        free(lc);
+        return 1;
+    }
+
+    ps->loop_cache = lc;
+    return 0;
+}
+
+static void XM_FreeLoopCache()
+{
+    XM_loop_cache_t *lc = ps->loop_cache;
+    if (!lc)
+        return;
+
+    ps->loop_cache = 0;
+
+    free(lc->left);
+    free(lc->right);
+    free(lc->events);
+    S_DestroyMixer(lc->mixer);
+    free(lc);
+}
+
+void XM_DisableLoopCache()
+{
+    if (ps->loop_cache && ps->loop_cache->state == XM_CACHE_PLAYING)
+        XM_LeaveLoop(ps->loop_cache);
+
+    XM_FreeLoopCache();
+}
+
+void XM_SetEventQueue(XM_event_queue_t *queue)
+{
+    ps->events = queue;
+}
+
+u8 XM_IsLoopCached()
+{
+    return ps->loop_cache && ps->loop_cache->state == XM_CACHE_PLAYING;
+}
+
+void XM_GetMemoryUsage(const XM_module_t *module, XM_memory_usage_t *usage)
+{
+    memset(usage, 0, sizeof(XM_memory_usage_t));
+
+    usage->instruments = sizeof(XM_module_t) + module->num_patterns * sizeof(XM_pattern_t) +
+                         module->num_instruments * sizeof(XM_instrument_t);
+
+    for (int p = 0; p < module->num_patterns; p++)
+        if (module->patterns[p].data)
+            usage->patterns += (u64)module->patterns[p].num_rows * module->num_channels * sizeof(XM_note_t);
+
+    for (int i = 0; i < module->num_instruments; i++) {
+        XM_instrument_t *instrument = &module->instruments[i];
+
+        usage->instruments += instrument->num_samples * sizeof(XM_sample_t);
+
+        for (int s = 0; s < instrument->num_samples; s++) {
+            XM_sample_t *sample = &instrument->samples[s];
+
+            if (!sample->data)
+                continue;
+
+            u64 bytes = sample->type & XM_SAMPLE_ADPCM ? S_AdpcmSize(sample->length) :
+                        sample->length * (sample->type & XM_SAMPLE_16BIT ? 2 : 1);
+
+            usage->samples += bytes;
+            if (XM_PoolRefs(sample->data) > 1)
+                usage->shared += bytes;
+        }
+    }
+
+    if (ps->module != module)
+        return;
+
+    usage->tables = ps->linear_frequencies ? 7681 * sizeof(u32) : 0;
+    usage->player = sizeof(XM_player_state_t) + S_GetMemoryUsage();
+
+    XM_loop_cache_t *lc = ps->loop_cache;
+
+    if (lc) {
+        S_mixer_t *mixer = S_GetCurrentMixer();
+
+        S_SetCurrentMixer(lc->mixer);
+        usage->player += S_GetMemoryUsage();
+        S_SetCurrentMixer(mixer);
+
+        usage->player += sizeof(XM_loop_cache_t) + 2 * sizeof(float) * (lc->max_frames + 1) +
+                         sizeof(XM_event_t) * lc->max_events;
+    }
+}
+
+u32 XM_RenderFrames(float *left, float *right, u32 num_frames)
+{
+    RT_SCOPE();
+
+    XM_loop_cache_t *lc = ps->loop_cache;
+    u32 done = 0;
+
+    while (done < num_frames) {
+        if (lc && lc->state == XM_CACHE_PLAYING) {
+            done += XM_PlayLoop(lc, left ? left + done : 0, right + done, num_frames - done);
+            continue;
+        }
+
+        u32 n = XM_RunFrames(left ? left + done : 0, right + done, num_frames - done);
+        done += n;
+
+        if (!lc || lc->state != XM_CACHE_PLAYING)
+            break;
+    }
+
+    return done;
 }
 
 u16 XM_GetCurrentBPM()
 {
-    return ps.current_bpm;
+    return ps->current_bpm;
 }